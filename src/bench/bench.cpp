@@ -0,0 +1,386 @@
+// End-to-end render benchmark. Renders a set of standard scenes at a fixed seed several
+// times and reports median and 95th percentile times per stage, Mrays/s and samples/s.
+// Every scene is rendered with each integrator, both of them unless --integrator picks.
+//
+// prismatica_bench [--scene <file>|builtin]... [--integrator megakernel|wavefront]... [--runs <n>] [--warmup <n>]
+//                  [--width <px>] [--height <px>] [--spp <n>] [--isa <isa>] [--threads <n>] [--json <file>] [--csv <file>]
+//                  [--baseline <file.csv>] [--tolerance <fraction>]
+//                  [--publish <file:path|tcp://host:port>] [--publish-topic <topic>]
+//
+// A baseline is a CSV file written by an earlier --csv run. Scenes whose median trace
+// time with the same integrator got slower than the baseline by more than the tolerance
+// fail the run (exit code 2).
+
+#include "../include/prismatica.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#define BENCH_HINT "[\e[0;31mBENCH\033[0m]\t\t"
+
+#ifndef PRISMATICA_SCENE_DIR
+    #define PRISMATICA_SCENE_DIR "resources/scenes"
+#endif
+
+// Milliseconds of every run for one stage
+class StageTimes {
+public:
+    std::vector<double> ms;
+
+    double Percentile(const double& p) const {
+        if (ms.empty()) return 0.0;
+
+        // Nearest rank
+        std::vector<double> sorted = ms;
+        std::sort(sorted.begin(), sorted.end());
+        std::size_t rank = (std::size_t) std::ceil(p * sorted.size());
+        return sorted[std::min(sorted.size(), std::max<std::size_t>(rank, 1)) - 1];
+    }
+
+    double Median() const { return Percentile(0.5); }
+    double P95() const { return Percentile(0.95); }
+};
+
+class SceneResult {
+public:
+    std::string name;
+    Integrator integrator = Integrator::Megakernel;
+    std::size_t primitives = 0;
+    double buildMs = 0.0;
+    StageTimes trace, tonemap, encode, total;
+    std::uint64_t rays = 0;     // per run, identical for every run at a fixed seed
+    std::uint64_t samples = 0;
+
+    double MraysPerSecond() const { return rays / (trace.Median() * 1000.0); }
+    double SamplesPerSecond() const { return samples / (trace.Median() / 1000.0); }
+};
+
+class BaselineEntry {
+public:
+    std::size_t width = 0, height = 0, spp = 0;
+    double traceMs = 0.0;
+};
+
+template <typename Function>
+double MeasureMilliseconds(Function&& function) {
+    auto start = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool LoadBenchScene(const std::string& name, Scene& scene) {
+    if (name == "builtin") {
+        scene = CornellBoxScene();
+        return true;
+    }
+
+    return LoadScene(scene, name);
+}
+
+// Scene name without directories and extension, used as the key in reports and baselines
+std::string SceneKey(const std::string& name) {
+    std::size_t slash = name.find_last_of("/\\");
+    std::string key = slash == std::string::npos ? name : name.substr(slash + 1);
+    return key.substr(0, key.find('.'));
+}
+
+// Baselines are matched per scene and integrator
+std::string BaselineKey(const std::string& scene, const std::string& integrator) {
+    return scene + "/" + integrator;
+}
+
+const char* CSV_HEADER = "scene,integrator,width,height,spp,runs,rays,trace_median_ms,trace_p95_ms,tonemap_median_ms,tonemap_p95_ms,"
+                         "encode_median_ms,encode_p95_ms,total_median_ms,total_p95_ms,mrays_per_s,samples_per_s";
+
+void WriteCSV(std::ostream& out, const std::vector<SceneResult>& results, const RenderSettings& settings) {
+    out << CSV_HEADER << '\n';
+
+    for (const SceneResult& r : results) {
+        out << SceneKey(r.name) << ',' << IntegratorName(r.integrator) << ',' << settings.camera.width << ',' << settings.camera.height << ',' << settings.samplesPerPixel << ','
+            << r.total.ms.size() << ',' << r.rays << ','
+            << r.trace.Median() << ',' << r.trace.P95() << ',' << r.tonemap.Median() << ',' << r.tonemap.P95() << ','
+            << r.encode.Median() << ',' << r.encode.P95() << ',' << r.total.Median() << ',' << r.total.P95() << ','
+            << r.MraysPerSecond() << ',' << r.SamplesPerSecond() << '\n';
+    }
+}
+
+void WriteStageJSON(std::ostream& out, const char* name, const StageTimes& stage) {
+    out << "\"" << name << "\": {\"median\": " << stage.Median() << ", \"p95\": " << stage.P95() << "}";
+}
+
+void WriteJSON(std::ostream& out, const std::vector<SceneResult>& results, const RenderSettings& settings, const std::size_t& threads) {
+    out << "{\n  \"config\": {\"width\": " << settings.camera.width << ", \"height\": " << settings.camera.height
+        << ", \"spp\": " << settings.samplesPerPixel << ", \"seed\": " << settings.sampler.seed
+        << ", \"sampler\": \"" << SamplerTypeName(settings.sampler.type) << "\", \"isa\": \"" << SimdISAName(simdKernels.isa)
+        << "\", \"threads\": " << threads << "},\n  \"results\": [\n";
+
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const SceneResult& r = results[i];
+        out << "    {\"scene\": \"" << SceneKey(r.name) << "\", \"integrator\": \"" << IntegratorName(r.integrator) << "\", \"primitives\": " << r.primitives << ", \"runs\": " << r.total.ms.size()
+            << ", \"build_ms\": " << r.buildMs << ", \"rays\": " << r.rays << ", \"samples\": " << r.samples << ", ";
+        WriteStageJSON(out, "trace_ms", r.trace);
+        out << ", ";
+        WriteStageJSON(out, "tonemap_ms", r.tonemap);
+        out << ", ";
+        WriteStageJSON(out, "encode_ms", r.encode);
+        out << ", ";
+        WriteStageJSON(out, "total_ms", r.total);
+        out << ", \"mrays_per_s\": " << r.MraysPerSecond() << ", \"samples_per_s\": " << r.SamplesPerSecond() << "}"
+            << (i + 1 < results.size() ? "," : "") << '\n';
+    }
+
+    out << "  ]\n}\n";
+}
+
+bool LoadBaseline(const std::string& path, std::unordered_map<std::string, BaselineEntry>& baseline) {
+    std::ifstream file(path);
+
+    if (!file) {
+        std::cerr << BENCH_HINT << "Could not open baseline " << path << '\n';
+        return false;
+    }
+
+    std::string line;
+    std::getline(file, line);
+
+    if (line != CSV_HEADER) {
+        std::cerr << BENCH_HINT << path << " is not a CSV written by --csv\n";
+        return false;
+    }
+
+    while (std::getline(file, line)) {
+        std::vector<std::string> fields;
+        std::istringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, ',')) fields.push_back(field);
+        if (fields.size() < 8) continue;
+
+        BaselineEntry entry{};
+        entry.width = std::strtoul(fields[2].c_str(), nullptr, 10);
+        entry.height = std::strtoul(fields[3].c_str(), nullptr, 10);
+        entry.spp = std::strtoul(fields[4].c_str(), nullptr, 10);
+        entry.traceMs = std::atof(fields[7].c_str());
+        baseline[BaselineKey(fields[0], fields[1])] = entry;
+    }
+
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> scenes;
+    std::vector<Integrator> integrators;
+    int runs = 5;
+    int warmup = 1;
+    std::size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    SimdISA isa = DetectSimdISA();
+    std::string jsonPath, csvPath, baselinePath;
+    double tolerance = 0.10;
+    PublishSettings publish{};
+    publish.topic = "prismatica/bench";
+
+    // Fixed configuration so runs on different machines and commits are comparable
+    RenderSettings settings{};
+    settings.samplesPerPixel = 4;
+    settings.sampler.seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--scene" && i + 1 < argc) {
+            scenes.push_back(argv[++i]);
+        } else if (arg == "--integrator" && i + 1 < argc) {
+            Integrator integrator;
+            if (!ParseIntegrator(argv[++i], integrator)) {
+                std::cerr << RENDERER_HINT << "Unknown integrator " << argv[i] << '\n';
+                return 1;
+            }
+            integrators.push_back(integrator);
+        } else if (arg == "--runs" && i + 1 < argc) {
+            runs = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            warmup = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--width" && i + 1 < argc) {
+            settings.camera.width = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--height" && i + 1 < argc) {
+            settings.camera.height = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--spp" && i + 1 < argc) {
+            settings.samplesPerPixel = (std::uint32_t) std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--isa" && i + 1 < argc) {
+            if (!ParseSimdISA(argv[++i], isa) || !SimdISASupported(isa)) {
+                std::cerr << SIMD_HINT << argv[i] << " is not available on this CPU\n";
+                return 1;
+            }
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threadCount = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg == "--csv" && i + 1 < argc) {
+            csvPath = argv[++i];
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (arg == "--tolerance" && i + 1 < argc) {
+            tolerance = std::max(0.0, std::atof(argv[++i]));
+        } else if (arg == "--publish" && i + 1 < argc) {
+            publish.url = argv[++i];
+        } else if (arg == "--publish-topic" && i + 1 < argc) {
+            publish.topic = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--scene <file>]... [--integrator megakernel|wavefront]... [--runs <n>] [--warmup <n>] [--width <px>] [--height <px>]"
+                      << " [--spp <n>] [--isa scalar|sse4.1|avx2|avx512] [--threads <n>] [--json <file>] [--csv <file>]"
+                      << " [--baseline <file.csv>] [--tolerance <fraction>] [--publish <file:path|tcp://host:port>] [--publish-topic <topic>]\n";
+            return 1;
+        }
+    }
+
+    if (scenes.empty()) {
+        scenes = {"builtin", PRISMATICA_SCENE_DIR "/cornell.scene", PRISMATICA_SCENE_DIR "/cornell_mesh.scene", PRISMATICA_SCENE_DIR "/materials.scene"};
+    }
+
+    if (integrators.empty()) integrators = {Integrator::Megakernel, Integrator::Wavefront};
+
+    settings.sampler.samplesPerPixel = settings.samplesPerPixel;
+    simdKernels = SelectSimdKernels(isa);
+
+    const Camera& camera = settings.camera;
+    ThreadPool pool(threadCount);
+    std::vector<SceneResult> results;
+
+    std::cout << BENCH_HINT << camera.width << "x" << camera.height << " at " << settings.samplesPerPixel << " spp, seed " << settings.sampler.seed
+              << ", " << SimdISAName(simdKernels.isa) << ", " << pool.size() << " threads, " << runs << " runs after " << warmup << " warmup\n";
+
+    for (const std::string& name : scenes) {
+        Scene scene{};
+
+        bool loaded = true;
+        double buildMs = MeasureMilliseconds([&]() {
+            loaded = LoadBenchScene(name, scene);
+            if (loaded) BuildAccelerationStructure(scene);
+        });
+
+        if (!loaded) return 1;
+
+        std::vector<unsigned char> image(3 * camera.width * camera.height);
+        std::size_t encodedBytes = 0;
+
+        for (Integrator integrator : integrators) {
+            SceneResult result{};
+            result.name = name;
+            result.integrator = integrator;
+            result.buildMs = buildMs;
+            result.primitives = scene.PrimitiveCount();
+
+            RenderSettings runSettings = settings;
+            runSettings.integrator = integrator;
+
+            for (int run = 0; run < warmup + runs; run++) {
+                Film film(camera.width, camera.height);
+                std::vector<Tile> tiles = MakeTiles(camera.width, camera.height, TILE_SIZE);
+                RenderStats stats{};
+
+                double traceMs = MeasureMilliseconds([&]() { stats = RenderProgressive(scene, film, tiles, pool, runSettings); });
+
+                double tonemapMs = MeasureMilliseconds([&]() {
+                    PostProcess(film, pool, DisplaySettings{}, image.data());
+                });
+
+                // Encode into memory, the disk is not what we are measuring
+                double encodeMs = MeasureMilliseconds([&]() {
+                    encodedBytes = 0;
+                    stbi_write_png_to_func([](void* context, void*, int size) { *(std::size_t*) context += size; },
+                                           &encodedBytes, (int) camera.width, (int) camera.height, 3, image.data(), 0);
+                });
+
+                if (run < warmup) continue;
+
+                result.trace.ms.push_back(traceMs);
+                result.tonemap.ms.push_back(tonemapMs);
+                result.encode.ms.push_back(encodeMs);
+                result.total.ms.push_back(traceMs + tonemapMs + encodeMs);
+                result.rays = stats.rays;
+                result.samples = stats.samples;
+            }
+
+            results.push_back(result);
+        }
+    }
+
+    std::printf("\n%-20s %-11s %10s %10s %10s %10s %10s %10s %10s %12s\n", "scene", "integrator", "trace", "p95", "tonemap", "encode", "total", "p95", "Mrays/s", "samples/s");
+    for (const SceneResult& r : results) {
+        std::printf("%-20s %-11s %8.2fms %8.2fms %8.2fms %8.2fms %8.2fms %8.2fms %10.2f %12.0f\n", SceneKey(r.name).c_str(), IntegratorName(r.integrator),
+                    r.trace.Median(), r.trace.P95(), r.tonemap.Median(), r.encode.Median(), r.total.Median(), r.total.P95(), r.MraysPerSecond(), r.SamplesPerSecond());
+    }
+    std::printf("\n");
+
+    // Which integrator traces each scene fastest, results of one scene are adjacent
+    if (integrators.size() > 1) {
+        for (std::size_t i = 0; i < results.size(); i += integrators.size()) {
+            const SceneResult* fastest = &results[i];
+            const SceneResult* slowest = &results[i];
+
+            for (std::size_t j = i; j < i + integrators.size(); j++) {
+                if (results[j].trace.Median() < fastest->trace.Median()) fastest = &results[j];
+                if (results[j].trace.Median() > slowest->trace.Median()) slowest = &results[j];
+            }
+
+            std::printf("%s%-20s %s wins, %.2fx over %s\n", BENCH_HINT, SceneKey(fastest->name).c_str(), IntegratorName(fastest->integrator),
+                        slowest->trace.Median() / fastest->trace.Median(), IntegratorName(slowest->integrator));
+        }
+        std::printf("\n");
+    }
+
+    if (!jsonPath.empty()) {
+        std::ofstream file(jsonPath);
+        WriteJSON(file, results, settings, pool.size());
+        if (!file) {
+            std::cerr << BENCH_HINT << "Could not write " << jsonPath << '\n';
+            return 1;
+        }
+    }
+
+    if (!csvPath.empty()) {
+        std::ofstream file(csvPath);
+        WriteCSV(file, results, settings);
+        if (!file) {
+            std::cerr << BENCH_HINT << "Could not write " << csvPath << '\n';
+            return 1;
+        }
+    }
+
+    if (publish.Enabled()) {
+        std::ostringstream payload;
+        WriteJSON(payload, results, settings, pool.size());
+        if (!Publish(publish, payload.str())) return 1;
+    }
+
+    int exitCode = 0;
+
+    if (!baselinePath.empty()) {
+        std::unordered_map<std::string, BaselineEntry> baseline;
+        if (!LoadBaseline(baselinePath, baseline)) return 1;
+
+        for (const SceneResult& r : results) {
+            std::string key = BaselineKey(SceneKey(r.name), IntegratorName(r.integrator));
+            auto entry = baseline.find(key);
+
+            if (entry == baseline.end()) {
+                std::cout << BENCH_HINT << key << ": not in the baseline\n";
+                continue;
+            }
+
+            const BaselineEntry& b = entry->second;
+            if (b.width != camera.width || b.height != camera.height || b.spp != settings.samplesPerPixel) {
+                std::cout << BENCH_HINT << key << ": baseline was taken with a different resolution or spp, skipped\n";
+                continue;
+            }
+
+            double change = r.trace.Median() / b.traceMs - 1.0;
+            bool regressed = change > tolerance;
+            std::printf("%s%-32s %8.2fms -> %8.2fms %+7.1f%% %s\n", BENCH_HINT, key.c_str(), b.traceMs, r.trace.Median(), change * 100.0,
+                        regressed ? "REGRESSION" : "ok");
+
+            if (regressed) exitCode = 2;
+        }
+    }
+
+    return exitCode;
+}
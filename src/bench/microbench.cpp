@@ -0,0 +1,243 @@
+// Intersection microbenchmarks: scalar closest-hit against the SIMD packet and
+// multi-plane kernels for every instruction set this CPU supports, and occlusion
+// queries against closest-hit shadow rays.
+//
+// prismatica_microbench [--scene <file>] [--iterations <n>]
+
+#include "../include/prismatica.h"
+
+#define BENCH_HINT "[\e[0;31mBENCH\033[0m]\t\t"
+
+class RaySet {
+public:
+    std::string name;
+    std::vector<glm::vec3> origins;
+    std::vector<glm::vec3> directions;
+};
+
+// Camera rays in scanline order, the coherent case the packets are made for
+RaySet CameraRays() {
+    RaySet rays{"camera", {}, {}};
+    Camera camera{};
+    glm::vec3 origin, direction;
+
+    for (std::size_t y = 0; y < camera.height; y++) {
+        for (std::size_t x = 0; x < camera.width; x++) {
+            GenerateCameraRay(camera, x, y, origin, direction);
+            rays.origins.push_back(origin);
+            rays.directions.push_back(direction);
+        }
+    }
+
+    return rays;
+}
+
+// Random origins and directions inside the box, roughly what diffuse bounces look like
+RaySet IncoherentRays() {
+    RaySet rays{"incoherent", {}, {}};
+    std::mt19937 rng{1234};
+    std::uniform_real_distribution<float> distribution{-0.95f, 0.95f};
+
+    for (std::size_t i = 0; i < VIEWPORT_WIDTH * VIEWPORT_HEIGHT; i++) {
+        glm::vec3 direction;
+        do {
+            direction = glm::vec3(distribution(rng), distribution(rng), distribution(rng));
+        } while (glm::dot(direction, direction) < 0.01f);
+
+        rays.origins.emplace_back(distribution(rng), distribution(rng), distribution(rng));
+        rays.directions.push_back(glm::normalize(direction));
+    }
+
+    return rays;
+}
+
+template <typename Function>
+double MeasureMilliseconds(const int& iterations, Function&& function) {
+    // Best of n, the minimum is the most stable estimate on a busy machine
+    double best = std::numeric_limits<double>::max();
+
+    for (int i = 0; i < iterations; i++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        function();
+        auto stop = std::chrono::high_resolution_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(stop - start).count());
+    }
+
+    return best;
+}
+
+void PrintResult(const std::string& kernel, const RaySet& rays, const SimdISA& isa, const double& ms, const double& scalarMs) {
+    double mrays = rays.origins.size() / (ms * 1000.0);
+    std::printf("%-16s %-11s %-8s %9.3f ms %9.2f Mrays/s %6.2fx\n", kernel.c_str(), rays.name.c_str(), SimdISAName(isa), ms, mrays, scalarMs / ms);
+}
+
+int main(int argc, char* argv[]) {
+    std::string scenePath;
+    int iterations = 10;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--scene" && i + 1 < argc) {
+            scenePath = argv[++i];
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            iterations = std::max(1, std::atoi(argv[++i]));
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--scene <file>] [--iterations <n>]\n";
+            return 1;
+        }
+    }
+
+    Scene scene{};
+
+    if (scenePath.empty()) {
+        scene = CornellBoxScene();
+    } else if (!LoadScene(scene, scenePath)) {
+        return 1;
+    }
+
+    BuildAccelerationStructure(scene);
+
+    std::vector<SimdISA> isas;
+    for (SimdISA isa : {SimdISA::SSE, SimdISA::AVX2, SimdISA::AVX512}) {
+        if (SimdISASupported(isa)) isas.push_back(isa);
+    }
+
+    std::cout << BENCH_HINT << scene.PrimitiveCount() << " primitives, " << iterations << " iterations, best run reported\n";
+
+    volatile float sink = 0.0f;
+
+    for (const RaySet& rays : {CameraRays(), IncoherentRays()}) {
+        const std::size_t count = rays.origins.size();
+        std::vector<float> referenceT(count);
+        std::vector<std::uint32_t> referenceRef(count);
+
+        // Scalar closest hit, planes and BVH
+        simdKernels = SelectSimdKernels(SimdISA::Scalar);
+        double scalarMs = MeasureMilliseconds(iterations, [&]() {
+            for (std::size_t i = 0; i < count; i++) {
+                float t = std::numeric_limits<float>::max();
+                std::uint32_t ref = 0;
+                ClosestHit(scene, t, ref, rays.origins[i], rays.directions[i]);
+                referenceT[i] = t;
+                referenceRef[i] = ref;
+            }
+        });
+        PrintResult("closest-hit", rays, SimdISA::Scalar, scalarMs, scalarMs);
+
+        for (SimdISA isa : isas) {
+            simdKernels = SelectSimdKernels(isa);
+            const std::size_t width = simdKernels.packetSize;
+            std::size_t mismatches = 0;
+            RayPacket packet;
+
+            double ms = MeasureMilliseconds(iterations, [&]() {
+                mismatches = 0;
+
+                for (std::size_t first = 0; first < count; first += width) {
+                    for (std::size_t lane = 0; lane < width; lane++) {
+                        std::size_t i = std::min(first + lane, count - 1);
+                        packet.Set((int) lane, rays.origins[i], rays.directions[i]);
+                    }
+
+                    simdKernels.tracePacket(scene, packet);
+
+                    for (std::size_t lane = 0; lane < width && first + lane < count; lane++) {
+                        mismatches += packet.ref[lane] != referenceRef[first + lane];
+                    }
+                }
+            });
+            PrintResult("packet", rays, isa, ms, scalarMs);
+
+            if (mismatches > 0) {
+                std::cout << BENCH_HINT << "  " << mismatches << " packet results differ from the scalar path\n";
+            }
+        }
+
+        // Multi-primitive kernel, one ray against all planes
+        simdKernels = SelectSimdKernels(SimdISA::Scalar);
+        double planesScalarMs = MeasureMilliseconds(iterations, [&]() {
+            float acc = 0.0f;
+            for (std::size_t i = 0; i < count; i++) {
+                float t = std::numeric_limits<float>::max(), tPlane;
+                for (std::size_t p = 0; p < scene.planes.size(); p++) {
+                    if (IntersectPlane(tPlane, scene.planes.Origin(p), scene.planes.Normal(p), rays.origins[i], rays.directions[i])) t = std::min(t, tPlane);
+                }
+                acc += t;
+            }
+            sink = sink + acc;
+        });
+        PrintResult("planes", rays, SimdISA::Scalar, planesScalarMs, planesScalarMs);
+
+        for (SimdISA isa : isas) {
+            SimdKernels kernels = SelectSimdKernels(isa);
+            double ms = MeasureMilliseconds(iterations, [&]() {
+                float acc = 0.0f;
+                for (std::size_t i = 0; i < count; i++) {
+                    float t = std::numeric_limits<float>::max();
+                    std::uint32_t ref = 0;
+                    kernels.closestPlane(scene, rays.origins[i], rays.directions[i], t, ref);
+                    acc += t;
+                }
+                sink = sink + acc;
+            });
+            PrintResult("planes", rays, isa, ms, planesScalarMs);
+        }
+
+        // Shadow rays, every other one ends behind its closest hit and is occluded
+        std::vector<float> tMax(count);
+        std::vector<char> referenceOccluded(count);
+        for (std::size_t i = 0; i < count; i++) tMax[i] = referenceT[i] * (i % 2 ? 0.5f : 1.5f);
+
+        simdKernels = SelectSimdKernels(SimdISA::Scalar);
+        double shadowClosestMs = MeasureMilliseconds(iterations, [&]() {
+            std::size_t occluded = 0;
+            for (std::size_t i = 0; i < count; i++) {
+                float t = tMax[i];
+                std::uint32_t ref = 0;
+                ClosestHit(scene, t, ref, rays.origins[i], rays.directions[i]);
+                occluded += ref != 0;
+            }
+            sink = sink + occluded;
+        });
+        PrintResult("shadow-closest", rays, SimdISA::Scalar, shadowClosestMs, shadowClosestMs);
+
+        double occludedMs = MeasureMilliseconds(iterations, [&]() {
+            for (std::size_t i = 0; i < count; i++) referenceOccluded[i] = Occluded(scene, rays.origins[i], rays.directions[i], tMax[i]);
+        });
+        PrintResult("occluded", rays, SimdISA::Scalar, occludedMs, shadowClosestMs);
+
+        for (SimdISA isa : isas) {
+            simdKernels = SelectSimdKernels(isa);
+            const std::size_t width = simdKernels.packetSize;
+            std::size_t mismatches = 0;
+            RayPacket packet;
+            bool occluded[MAX_PACKET_SIZE];
+
+            double ms = MeasureMilliseconds(iterations, [&]() {
+                mismatches = 0;
+
+                for (std::size_t first = 0; first < count; first += width) {
+                    for (std::size_t lane = 0; lane < width; lane++) {
+                        std::size_t i = std::min(first + lane, count - 1);
+                        packet.Set((int) lane, rays.origins[i], rays.directions[i]);
+                        packet.t[lane] = tMax[i];
+                    }
+
+                    OccludedPacket(scene, packet, occluded);
+
+                    for (std::size_t lane = 0; lane < width && first + lane < count; lane++) {
+                        mismatches += occluded[lane] != (bool) referenceOccluded[first + lane];
+                    }
+                }
+            });
+            PrintResult("occluded-packet", rays, isa, ms, shadowClosestMs);
+
+            if (mismatches > 0) {
+                std::cout << BENCH_HINT << "  " << mismatches << " occlusion results differ from the scalar path\n";
+            }
+        }
+    }
+
+    return 0;
+}
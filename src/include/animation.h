@@ -0,0 +1,149 @@
+#pragma once
+
+#define ANIMATION_HINT "[\e[0;36mANIMATION\033[0m]\t"
+
+class Keyframe {
+public:
+    float time;
+    glm::vec3 eye;
+    glm::vec3 target;
+    float fov;  // radians
+};
+
+// Camera keyframes sorted by time. Frames are spread evenly in time from the first to
+// the last key, or land on the keys without a frame count, and the camera follows a
+// Catmull-Rom spline through the keys, so a handful of keys around an object already
+// give a round turntable.
+class CameraPath {
+public:
+    std::vector<Keyframe> keys;
+    std::size_t frames = 0;  // 0 renders one frame at the time of every key
+
+    std::size_t FrameCount() const {
+        return frames > 0 ? frames : keys.size();
+    }
+
+    float FrameTime(const std::size_t& frame) const {
+        if (frames == 0) return keys[frame].time;
+        if (FrameCount() < 2) return keys.front().time;
+        return keys.front().time + (keys.back().time - keys.front().time) * (float) frame / (float) (FrameCount() - 1);
+    }
+
+    // Moves the camera, the resolution is left as it is. Where the spline brings eye and
+    // target together the camera keeps its previous orientation.
+    void Apply(Camera& camera, const float& time) const {
+        std::size_t segment = 0;
+        while (segment + 2 < keys.size() && keys[segment + 1].time <= time) segment++;
+
+        const Keyframe& k1 = keys[segment];
+        const Keyframe& k2 = keys[std::min(segment + 1, keys.size() - 1)];
+        const Keyframe& k0 = keys[segment > 0 ? segment - 1 : segment];
+        const Keyframe& k3 = keys[std::min(segment + 2, keys.size() - 1)];
+
+        float span = k2.time - k1.time;
+        float u = span > 0.0f ? glm::clamp((time - k1.time) / span, 0.0f, 1.0f) : 0.0f;
+
+        auto CatmullRom = [&](const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3) {
+            return 0.5f * (2.0f * p1 + (p2 - p0) * u + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * u * u + (3.0f * p1 - p0 - 3.0f * p2 + p3) * u * u * u);
+        };
+
+        camera.LookAt(CatmullRom(k0.eye, k1.eye, k2.eye, k3.eye), CatmullRom(k0.target, k1.target, k2.target, k3.target));
+        camera.fov = glm::mix(k1.fov, k2.fov, u);
+    }
+};
+
+// Text format, one statement per line, # starts a comment:
+//   frames <n>
+//   key <time> <eye x y z> <target x y z> [fov degrees]
+// Keys without a field of view keep the one of the camera passed in.
+bool LoadCameraPath(CameraPath& cameraPath, const std::string& path, const Camera& camera) {
+    std::ifstream file(path);
+
+    if (!file) {
+        std::cerr << ANIMATION_HINT << "Could not open " << path << '\n';
+        return false;
+    }
+
+    std::string line;
+    std::size_t lineNumber = 0;
+
+    auto Fail = [&](const std::string& message) {
+        std::cerr << ANIMATION_HINT << path << ":" << lineNumber << ": " << message << '\n';
+        return false;
+    };
+
+    while (std::getline(file, line)) {
+        lineNumber++;
+
+        std::size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+
+        std::istringstream stream(line);
+        std::string keyword;
+        if (!(stream >> keyword)) continue;
+
+        if (keyword == "frames") {
+            long frames;
+            if (!(stream >> frames) || frames < 1) return Fail("frames needs a positive count");
+            cameraPath.frames = (std::size_t) frames;
+        } else if (keyword == "key") {
+            Keyframe key{};
+            if (!(stream >> key.time >> key.eye.x >> key.eye.y >> key.eye.z >> key.target.x >> key.target.y >> key.target.z)) {
+                return Fail("key needs a time, an eye and a target");
+            }
+
+            Camera probe = camera;
+            if (!probe.LookAt(key.eye, key.target)) return Fail("key needs a target apart from the eye");
+
+            // The field of view is optional, but a token in its place has to be one
+            std::string token;
+            key.fov = camera.fov;
+            if (stream >> token) {
+                std::istringstream fov(token);
+                float degrees;
+                if (!(fov >> degrees) || !fov.eof()) return Fail("fov must be an angle in degrees");
+                key.fov = glm::radians(degrees);
+            }
+
+            if (stream >> token) return Fail("unexpected " + token + " after the key");
+
+            if (!cameraPath.keys.empty() && key.time < cameraPath.keys.back().time) return Fail("keys must be sorted by time");
+            cameraPath.keys.push_back(key);
+        } else {
+            return Fail("unknown statement " + keyword);
+        }
+    }
+
+    if (cameraPath.keys.empty()) {
+        std::cerr << ANIMATION_HINT << path << " has no keys\n";
+        return false;
+    }
+
+    return true;
+}
+
+// Output path of a frame. A printf style %d or %0<width>d in the pattern is replaced by
+// the frame number, otherwise _<frame> is inserted before the extension.
+std::string FramePath(const std::string& pattern, const std::size_t& frame) {
+    std::size_t percent = pattern.find('%');
+
+    if (percent != std::string::npos) {
+        std::size_t end = percent + 1;
+        while (end < pattern.size() && std::isdigit((unsigned char) pattern[end])) end++;
+
+        if (end < pattern.size() && pattern[end] == 'd') {
+            int width = end > percent + 1 ? std::atoi(pattern.substr(percent + 1, end - percent - 1).c_str()) : 0;
+            std::string number = std::to_string(frame);
+            if ((int) number.size() < width) number.insert(0, width - number.size(), '0');
+            return pattern.substr(0, percent) + number + pattern.substr(end + 1);
+        }
+    }
+
+    std::string number = std::to_string(frame);
+    number.insert(0, number.size() < 4 ? 4 - number.size() : 0, '0');
+
+    std::size_t dot = pattern.find_last_of('.');
+    std::size_t slash = pattern.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return pattern + "_" + number;
+    return pattern.substr(0, dot) + "_" + number + pattern.substr(dot);
+}
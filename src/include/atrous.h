@@ -0,0 +1,96 @@
+#pragma once
+
+// Edge-avoiding a-trous wavelet filter after Schied et al., "Spatiotemporal
+// Variance-Guided Filtering" (without the temporal part). Every pass blurs with a 5x5
+// B3-spline kernel whose taps are step pixels apart, and the step doubles from pass to
+// pass. Taps across a change of normal or depth, or whose luminance differs by more
+// than the noise explains, get little weight. Denoise() in denoise.h runs the passes.
+
+class DenoiseSettings {
+public:
+    int iterations = DENOISE_ITERATIONS;
+    float sigmaLuminance = DENOISE_SIGMA_LUMINANCE;
+    float sigmaDepth = DENOISE_SIGMA_DEPTH;
+};
+
+// Per-pixel guides of the filter, one plane per channel so the SIMD kernels can load
+// neighbouring pixels as one vector. Rows are counted from the first row of the film.
+class DenoiseFeatures {
+public:
+    std::size_t width, height;
+    std::vector<float> normalX, normalY, normalZ;  // 0 on a miss
+    std::vector<float> depth;
+    std::vector<float> depthGradient;  // |dz/dx| + |dz/dy| on the surface of the pixel
+
+    DenoiseFeatures(const std::size_t& width, const std::size_t& height)
+        : width(width), height(height), normalX(width * height), normalY(width * height), normalZ(width * height), depth(width * height), depthGradient(width * height) {}
+};
+
+// The signal being filtered: albedo-demodulated color and the variance of its luminance
+class DenoiseColor {
+public:
+    std::vector<float> r, g, b;
+    std::vector<float> variance;
+
+    explicit DenoiseColor(const std::size_t& size) : r(size), g(size), b(size), variance(size) {}
+};
+
+// B3-spline weights by the distance of the tap in steps
+constexpr float ATROUS_KERNEL[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+// The taps have no variance normalization, this keeps the denominators finite
+constexpr float DENOISE_EPSILON = 1e-6f;
+
+// dot(n_p, n_q)^128 as in the paper, by squaring
+inline float NormalWeight(const float& cosine) {
+    float w = std::max(cosine, 0.0f);
+    for (int i = 0; i < 7; i++) w *= w;
+    return w;
+}
+
+// Filters pixel (x, y) of in into out, taps outside the image are left out. The SIMD
+// kernels do the same for pixels whose taps are all inside.
+void ATrousPixel(const DenoiseFeatures& features, const DenoiseColor& in, DenoiseColor& out, const std::size_t& x, const std::size_t& y, const int& step, const DenoiseSettings& settings) {
+    const std::size_t width = features.width;
+    const std::size_t p = y * width + x;
+    const glm::vec3 normal(features.normalX[p], features.normalY[p], features.normalZ[p]);
+    const float luminance = Luminance(glm::vec3(in.r[p], in.g[p], in.b[p]));
+    const float luminanceScale = 1.0f / (settings.sigmaLuminance * std::sqrt(std::max(in.variance[p], 0.0f)) + DENOISE_EPSILON);
+
+    // Taps one and two steps away, in the maximum norm
+    const float depthStep = settings.sigmaDepth * features.depthGradient[p] * (float) step;
+    const float depthScale[2] = {1.0f / (depthStep + DENOISE_EPSILON), 1.0f / (2.0f * depthStep + DENOISE_EPSILON)};
+
+    const float centerWeight = ATROUS_KERNEL[0] * ATROUS_KERNEL[0];
+    glm::vec3 color = centerWeight * glm::vec3(in.r[p], in.g[p], in.b[p]);
+    float variance = centerWeight * centerWeight * in.variance[p];
+    float weightSum = centerWeight;
+
+    for (int dy = -2; dy <= 2; dy++) {
+        std::ptrdiff_t yq = (std::ptrdiff_t) y + dy * step;
+        if (yq < 0 || yq >= (std::ptrdiff_t) features.height) continue;
+
+        for (int dx = -2; dx <= 2; dx++) {
+            std::ptrdiff_t xq = (std::ptrdiff_t) x + dx * step;
+            if ((dx == 0 && dy == 0) || xq < 0 || xq >= (std::ptrdiff_t) width) continue;
+
+            std::size_t q = (std::size_t) yq * width + (std::size_t) xq;
+            float normalWeight = NormalWeight(glm::dot(normal, glm::vec3(features.normalX[q], features.normalY[q], features.normalZ[q])));
+            if (normalWeight == 0.0f) continue;
+
+            glm::vec3 tap(in.r[q], in.g[q], in.b[q]);
+            float distance = std::abs(luminance - Luminance(tap)) * luminanceScale
+                           + std::abs(features.depth[p] - features.depth[q]) * depthScale[std::max(std::abs(dx), std::abs(dy)) - 1];
+            float weight = ATROUS_KERNEL[std::abs(dx)] * ATROUS_KERNEL[std::abs(dy)] * normalWeight * std::exp(-distance);
+
+            color += weight * tap;
+            variance += weight * weight * in.variance[q];
+            weightSum += weight;
+        }
+    }
+
+    out.r[p] = color.r / weightSum;
+    out.g[p] = color.g / weightSum;
+    out.b[p] = color.b / weightSum;
+    out.variance[p] = variance / (weightSum * weightSum);
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+// Scattering beyond the Lambertian diffuse in Render(). Directions point away from the
+// surface: wo back along the incoming ray and wi towards the next vertex or a light.
+
+class BsdfSample {
+public:
+    glm::vec3 direction;
+    glm::vec3 weight;  // f * cos / pdf
+    float pdf;         // solid angle density, 0 for delta lobes
+    bool transmitted;  // crossed the surface, the next ray starts on the other side
+};
+
+// Schlick's approximation for conductors, f0 is the reflectance at normal incidence
+glm::vec3 FresnelSchlick(const glm::vec3& f0, const float& cosTheta) {
+    float m = 1.0f - glm::clamp(cosTheta, 0.0f, 1.0f);
+    float m2 = m * m;
+    return f0 + (glm::vec3(1.0f) - f0) * (m2 * m2 * m);
+}
+
+// Unpolarized reflectance of a dielectric interface. eta is the index on the incident
+// side over the one on the far side, total internal reflection returns 1.
+float FresnelDielectric(const float& cosThetaI, const float& eta) {
+    float sin2ThetaT = eta * eta * std::max(0.0f, 1.0f - cosThetaI * cosThetaI);
+    if (sin2ThetaT >= 1.0f) return 1.0f;
+
+    float cosThetaT = std::sqrt(1.0f - sin2ThetaT);
+    float rs = (eta * cosThetaI - cosThetaT) / (eta * cosThetaI + cosThetaT);
+    float rp = (cosThetaI - eta * cosThetaT) / (cosThetaI + eta * cosThetaT);
+    return 0.5f * (rs * rs + rp * rp);
+}
+
+// Trowbridge-Reitz (GGX) normal distribution
+float GGXDistribution(const float& cosThetaM, const float& alpha) {
+    float a2 = alpha * alpha;
+    float d = cosThetaM * cosThetaM * (a2 - 1.0f) + 1.0f;
+    return a2 / (PI * d * d);
+}
+
+// Smith's auxiliary function, G1 = 1 / (1 + lambda) and the height-correlated
+// G2 = 1 / (1 + lambda(wo) + lambda(wi))
+float GGXLambda(const float& cosTheta, const float& alpha) {
+    float cos2 = cosTheta * cosTheta;
+    float tan2 = std::max(0.0f, 1.0f - cos2) / cos2;
+    return 0.5f * (std::sqrt(1.0f + alpha * alpha * tan2) - 1.0f);
+}
+
+// Heitz, "Sampling the GGX Distribution of Visible Normals". Both vectors are in the
+// local frame with the normal along +z.
+glm::vec3 SampleGGXVisibleNormal(const glm::vec3& wo, const float& alpha, const glm::vec2& rand) {
+    glm::vec3 vh = glm::normalize(glm::vec3(alpha * wo.x, alpha * wo.y, wo.z));
+
+    float lengthSquared = vh.x * vh.x + vh.y * vh.y;
+    glm::vec3 t1 = lengthSquared > 0.0f ? glm::vec3(-vh.y, vh.x, 0.0f) / std::sqrt(lengthSquared) : glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::vec3 t2 = glm::cross(vh, t1);
+
+    float r = std::sqrt(rand.x);
+    float phi = TAU * rand.y;
+    float p1 = r * std::cos(phi);
+    float p2 = r * std::sin(phi);
+    float s = 0.5f * (1.0f + vh.z);
+    p2 = (1.0f - s) * std::sqrt(std::max(0.0f, 1.0f - p1 * p1)) + s * p2;
+
+    glm::vec3 nh = p1 * t1 + p2 * t2 + std::sqrt(std::max(0.0f, 1.0f - p1 * p1 - p2 * p2)) * vh;
+    return glm::normalize(glm::vec3(alpha * nh.x, alpha * nh.y, std::max(1e-6f, nh.z)));
+}
+
+// Rough conductor, f towards wi. pdf is the density SampleConductor()
+// has for the same direction, for multiple importance sampling.
+glm::vec3 EvaluateConductor(const Material& material, const glm::vec3& normal, const glm::vec3& wo, const glm::vec3& wi, float& pdf) {
+    pdf = 0.0f;
+
+    float cosO = glm::dot(normal, wo);
+    float cosI = glm::dot(normal, wi);
+    if (cosO <= 0.0f || cosI <= 0.0f) return glm::vec3(0.0f);
+
+    glm::vec3 m = glm::normalize(wo + wi);
+    float alpha = material.roughness * material.roughness;
+    float d = GGXDistribution(glm::dot(normal, m), alpha);
+    float lambdaO = GGXLambda(cosO, alpha);
+    float lambdaI = GGXLambda(cosI, alpha);
+
+    pdf = d / (4.0f * cosO * (1.0f + lambdaO));
+    return FresnelSchlick(material.albedo, glm::dot(wi, m)) * (d / (4.0f * cosO * cosI * (1.0f + lambdaO + lambdaI)));
+}
+
+// Samples a visible microfacet normal and reflects wo on it. The weight is F * G2 / G1.
+bool SampleConductor(const Material& material, const glm::vec3& normal, const glm::vec3& wo, const glm::vec2& rand, BsdfSample& sample) {
+    glm::vec3 tangent, bitangent;
+    OrthonormalBasis(normal, tangent, bitangent);
+
+    glm::vec3 local = glm::vec3(glm::dot(wo, tangent), glm::dot(wo, bitangent), glm::dot(wo, normal));
+    if (local.z <= 0.0f) return false;
+
+    float alpha = material.roughness * material.roughness;
+    glm::vec3 m = SampleGGXVisibleNormal(local, alpha, rand);
+    glm::vec3 microNormal = tangent * m.x + bitangent * m.y + normal * m.z;
+
+    sample.direction = glm::reflect(-wo, microNormal);
+    sample.transmitted = false;
+
+    float cosI = glm::dot(normal, sample.direction);
+    if (cosI <= 0.0f) return false;
+
+    float lambdaO = GGXLambda(local.z, alpha);
+    float lambdaI = GGXLambda(cosI, alpha);
+
+    sample.pdf = GGXDistribution(m.z, alpha) / (4.0f * local.z * (1.0f + lambdaO));
+    sample.weight = FresnelSchlick(material.albedo, glm::dot(wo, microNormal)) * ((1.0f + lambdaO) / (1.0f + lambdaO + lambdaI));
+    return true;
+}
+
+// Smooth dielectric, reflects with the Fresnel probability and refracts otherwise. The
+// geometric normal tells whether wo is outside the medium or inside it.
+void SampleDielectric(const Material& material, const glm::vec3& geometricNormal, const glm::vec3& wo, const float& rand, BsdfSample& sample) {
+    bool entering = glm::dot(geometricNormal, wo) > 0.0f;
+    glm::vec3 normal = entering ? geometricNormal : -geometricNormal;
+    float eta = entering ? 1.0f / material.ior : material.ior;
+
+    sample.pdf = 0.0f;
+
+    if (rand < FresnelDielectric(glm::dot(normal, wo), eta)) {
+        sample.direction = glm::reflect(-wo, normal);
+        sample.weight = glm::vec3(1.0f);
+        sample.transmitted = false;
+    } else {
+        sample.direction = glm::refract(-wo, normal, eta);
+        sample.weight = material.albedo;
+        sample.transmitted = true;
+    }
+}
@@ -0,0 +1,325 @@
+#pragma once
+
+#define BVH_HINT "[\e[0;35mBVH\033[0m]\t\t"
+
+constexpr int BVH_BINS                  = 16;
+constexpr int BVH_MAX_LEAF_SIZE         = 8;
+constexpr int BVH_STACK_SIZE            = 64;
+constexpr float BVH_TRAVERSAL_COST      = 1.0f;
+constexpr float BVH_INTERSECTION_COST   = 1.0f;
+
+// Subtrees above this size are handed to their own thread during the build.
+// Nodes above the binning threshold also split the binning pass across threads.
+constexpr std::size_t BVH_PARALLEL_SUBTREE_SIZE = 16384;
+constexpr std::size_t BVH_PARALLEL_BINNING_SIZE = 262144;
+
+class AABB {
+public:
+    glm::vec3 min;
+    glm::vec3 max;
+
+    AABB() {
+        min = glm::vec3(std::numeric_limits<float>::max());
+        max = glm::vec3(-std::numeric_limits<float>::max());
+    }
+
+    AABB(const glm::vec3& lo, const glm::vec3& hi) : min(lo), max(hi) {}
+
+    void Grow(const glm::vec3& p) {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+
+    void Grow(const AABB& other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    glm::vec3 Centroid() const { return (min + max) * 0.5f; }
+
+    float Area() const {
+        if (min.x > max.x) return 0.0f;
+        glm::vec3 e = max - min;
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+};
+
+// 32 bytes, two nodes per cache line. Siblings are always allocated next to each
+// other, so an interior node only needs the index of its left child.
+class alignas(32) BVHNode {
+public:
+    float boundsMin[3];
+    std::uint32_t leftOrFirst;  // left child for interior nodes, first primitive for leaves
+    float boundsMax[3];
+    std::uint32_t count;        // 0 for interior nodes
+
+    bool IsLeaf() const { return count != 0; }
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode should stay at 32 bytes");
+
+class BVH {
+public:
+    MappedArray<BVHNode> nodes;
+    MappedArray<std::uint32_t> primitives;  // primitive references in leaf order
+
+    bool empty() const { return primitives.empty(); }
+};
+
+// Zero direction components would turn into infinities in the slab test, which -Ofast
+// doesn't handle reliably. Nudge them to a tiny value before taking the reciprocal.
+constexpr float BVH_MIN_DIRECTION = 1e-12f;
+
+glm::vec3 SafeInverse(const glm::vec3& direction) {
+    glm::vec3 safe;
+    for (int axis = 0; axis < 3; axis++) {
+        safe[axis] = std::abs(direction[axis]) < BVH_MIN_DIRECTION ? BVH_MIN_DIRECTION : direction[axis];
+    }
+    return 1.0f / safe;
+}
+
+// Slab test. Returns the entry distance or FLT_MAX when the box is missed or further than tMax.
+float IntersectAABB(const BVHNode& node, const glm::vec3& rayOrigin, const glm::vec3& invDirection, const float& tMax) {
+    float tx0 = (node.boundsMin[0] - rayOrigin.x) * invDirection.x;
+    float tx1 = (node.boundsMax[0] - rayOrigin.x) * invDirection.x;
+    float ty0 = (node.boundsMin[1] - rayOrigin.y) * invDirection.y;
+    float ty1 = (node.boundsMax[1] - rayOrigin.y) * invDirection.y;
+    float tz0 = (node.boundsMin[2] - rayOrigin.z) * invDirection.z;
+    float tz1 = (node.boundsMax[2] - rayOrigin.z) * invDirection.z;
+
+    float tNear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.0f));
+    float tFar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), tMax));
+
+    return tNear <= tFar ? tNear : std::numeric_limits<float>::max();
+}
+
+class BVHBuilder {
+public:
+    const std::vector<AABB>& bounds;
+    std::vector<glm::vec3> centroids;
+    std::vector<std::uint32_t> order;
+    std::vector<BVHNode>& nodes;
+    std::atomic<std::uint32_t> nodesUsed{0};
+    unsigned int maxThreads;
+    std::atomic<unsigned int> threadsRunning{1};
+
+    BVHBuilder(const std::vector<AABB>& primitiveBounds, std::vector<BVHNode>& outNodes) : bounds(primitiveBounds), nodes(outNodes) {
+        centroids.resize(bounds.size());
+        order.resize(bounds.size());
+
+        for (std::size_t i = 0; i < bounds.size(); i++) {
+            centroids[i] = bounds[i].Centroid();
+            order[i] = (std::uint32_t) i;
+        }
+
+        maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    class Bin {
+    public:
+        AABB bounds;
+        std::uint32_t count = 0;
+    };
+
+    void SetBounds(BVHNode& node, const AABB& box) {
+        for (int axis = 0; axis < 3; axis++) {
+            node.boundsMin[axis] = box.min[axis];
+            node.boundsMax[axis] = box.max[axis];
+        }
+    }
+
+    void BinRange(Bin (&bins)[3][BVH_BINS], std::uint32_t first, std::uint32_t last, const AABB& centroidBounds) {
+        glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+
+        for (std::uint32_t i = first; i < last; i++) {
+            std::uint32_t prim = order[i];
+
+            for (int axis = 0; axis < 3; axis++) {
+                if (extent[axis] <= 0.0f) continue;
+                int b = (int) ((centroids[prim][axis] - centroidBounds.min[axis]) * (BVH_BINS / extent[axis]));
+                b = std::min(b, BVH_BINS - 1);
+                bins[axis][b].bounds.Grow(bounds[prim]);
+                bins[axis][b].count++;
+            }
+        }
+    }
+
+    // Claims up to wanted threads of those not already running, returns how many
+    unsigned int ReserveThreads(unsigned int wanted) {
+        unsigned int running = threadsRunning.load();
+        unsigned int granted;
+
+        do {
+            granted = running < maxThreads ? std::min(wanted, maxThreads - running) : 0;
+            if (granted == 0) return 0;
+        } while (!threadsRunning.compare_exchange_weak(running, running + granted));
+
+        return granted;
+    }
+
+    // Returns the SAH cost of the best split and writes its axis and bin. Large nodes are
+    // binned in chunks by the calling thread and as many more as the subtree threads
+    // leave free.
+    float FindBestSplit(std::uint32_t first, std::uint32_t count, const AABB& centroidBounds, int& bestAxis, int& bestBin) {
+        Bin bins[3][BVH_BINS]{};
+        const unsigned int helpers = count >= BVH_PARALLEL_BINNING_SIZE ? ReserveThreads(maxThreads - 1) : 0;
+
+        if (helpers > 0) {
+            const unsigned int chunks = helpers + 1;
+            std::vector<std::array<std::array<Bin, BVH_BINS>, 3>> partialBins(chunks);
+            std::vector<std::thread> workers;
+
+            auto BinChunk = [&](unsigned int c) {
+                Bin local[3][BVH_BINS]{};
+                BinRange(local, first + count * c / chunks, first + count * (c + 1) / chunks, centroidBounds);
+                for (int axis = 0; axis < 3; axis++) {
+                    for (int b = 0; b < BVH_BINS; b++) partialBins[c][axis][b] = local[axis][b];
+                }
+            };
+
+            for (unsigned int c = 1; c < chunks; c++) workers.emplace_back(BinChunk, c);
+            BinChunk(0);
+
+            for (auto& worker : workers) worker.join();
+            threadsRunning -= helpers;
+
+            for (unsigned int c = 0; c < chunks; c++) {
+                for (int axis = 0; axis < 3; axis++) {
+                    for (int b = 0; b < BVH_BINS; b++) {
+                        bins[axis][b].bounds.Grow(partialBins[c][axis][b].bounds);
+                        bins[axis][b].count += partialBins[c][axis][b].count;
+                    }
+                }
+            }
+        } else {
+            BinRange(bins, first, first + count, centroidBounds);
+        }
+
+        float bestCost = std::numeric_limits<float>::max();
+
+        for (int axis = 0; axis < 3; axis++) {
+            if (centroidBounds.max[axis] <= centroidBounds.min[axis]) continue;
+
+            // Sweep from both sides to get the cost of every bin boundary in linear time
+            float leftArea[BVH_BINS - 1], rightArea[BVH_BINS - 1];
+            std::uint32_t leftCount[BVH_BINS - 1], rightCount[BVH_BINS - 1];
+            AABB leftBox, rightBox;
+            std::uint32_t leftSum = 0, rightSum = 0;
+
+            for (int i = 0; i < BVH_BINS - 1; i++) {
+                leftSum += bins[axis][i].count;
+                leftBox.Grow(bins[axis][i].bounds);
+                leftCount[i] = leftSum;
+                leftArea[i] = leftBox.Area();
+
+                rightSum += bins[axis][BVH_BINS - 1 - i].count;
+                rightBox.Grow(bins[axis][BVH_BINS - 1 - i].bounds);
+                rightCount[BVH_BINS - 2 - i] = rightSum;
+                rightArea[BVH_BINS - 2 - i] = rightBox.Area();
+            }
+
+            for (int i = 0; i < BVH_BINS - 1; i++) {
+                if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+
+                float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = i;
+                }
+            }
+        }
+
+        return bestCost;
+    }
+
+    // Traversal pushes at most one node per level, so leaves are forced at the depth
+    // where the stack would run out, however badly the primitives cluster.
+    void Subdivide(std::uint32_t nodeIndex, std::uint32_t first, std::uint32_t count, std::uint32_t depth) {
+        BVHNode& node = nodes[nodeIndex];
+
+        AABB box, centroidBounds;
+        for (std::uint32_t i = first; i < first + count; i++) {
+            box.Grow(bounds[order[i]]);
+            centroidBounds.Grow(centroids[order[i]]);
+        }
+
+        SetBounds(node, box);
+        node.leftOrFirst = first;
+        node.count = count;
+
+        if (count <= 2 || depth + 1 >= (std::uint32_t) BVH_STACK_SIZE) return;
+
+        int axis = -1, bin = 0;
+        float splitCost = FindBestSplit(first, count, centroidBounds, axis, bin);
+        float leafCost = count * BVH_INTERSECTION_COST;
+        splitCost = BVH_TRAVERSAL_COST + BVH_INTERSECTION_COST * splitCost / box.Area();
+
+        std::uint32_t* begin = order.data() + first;
+        std::uint32_t* end = begin + count;
+        std::uint32_t* middle;
+
+        if (axis >= 0 && (splitCost < leafCost || count > BVH_MAX_LEAF_SIZE)) {
+            float scale = BVH_BINS / (centroidBounds.max[axis] - centroidBounds.min[axis]);
+            float lo = centroidBounds.min[axis];
+
+            middle = std::partition(begin, end, [&](std::uint32_t prim) {
+                int b = std::min((int) ((centroids[prim][axis] - lo) * scale), BVH_BINS - 1);
+                return b <= bin;
+            });
+        } else if (count > BVH_MAX_LEAF_SIZE) {
+            // Coincident centroids, the SAH can't separate them. Split in the middle.
+            middle = begin + count / 2;
+        } else {
+            return;
+        }
+
+        std::uint32_t leftCount = (std::uint32_t) (middle - begin);
+        std::uint32_t leftIndex = nodesUsed.fetch_add(2);
+
+        node.leftOrFirst = leftIndex;
+        node.count = 0;
+
+        if (count >= BVH_PARALLEL_SUBTREE_SIZE && threadsRunning.fetch_add(1) < maxThreads) {
+            std::thread left(&BVHBuilder::Subdivide, this, leftIndex, first, leftCount, depth + 1);
+            Subdivide(leftIndex + 1, first + leftCount, count - leftCount, depth + 1);
+            left.join();
+            threadsRunning--;
+        } else {
+            if (count >= BVH_PARALLEL_SUBTREE_SIZE) threadsRunning--;
+            Subdivide(leftIndex, first, leftCount, depth + 1);
+            Subdivide(leftIndex + 1, first + leftCount, count - leftCount, depth + 1);
+        }
+    }
+};
+
+// Binned SAH build over arbitrary primitive bounds. refs[i] is stored in the leaves for bounds[i].
+void BuildBVH(BVH& bvh, const std::vector<AABB>& bounds, const std::vector<std::uint32_t>& refs) {
+    bvh.nodes.clear();
+    bvh.primitives.clear();
+
+    if (bounds.empty()) return;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<BVHNode> nodes(bounds.size() * 2);
+
+    BVHBuilder builder(bounds, nodes);
+    builder.nodesUsed = 1;
+    builder.Subdivide(0, 0, (std::uint32_t) bounds.size(), 0);
+
+    nodes.resize(builder.nodesUsed);
+    nodes.shrink_to_fit();
+    bvh.nodes = std::move(nodes);
+
+    std::vector<std::uint32_t> primitives(bounds.size());
+    for (std::size_t i = 0; i < bounds.size(); i++) {
+        primitives[i] = refs[builder.order[i]];
+    }
+    bvh.primitives = std::move(primitives);
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds> (stop - start);
+
+    std::cout << BVH_HINT << "Built " << bvh.nodes.size() << " nodes over " << bounds.size() << " primitives in " << duration.count() << "ms\n";
+}
@@ -10,5 +10,41 @@ constexpr float PHI = 1.6180339887498948482f;
 constexpr int VIEWPORT_WIDTH    = 256;
 constexpr int VIEWPORT_HEIGHT   = 256;
 constexpr int SAMPLES           = 1;
-constexpr int THREADS           = 16;
-constexpr int MAX_RECURSIONS    = 3;
\ No newline at end of file
+constexpr int TILE_SIZE         = 16;
+constexpr int MAX_DEPTH         = 8;  // bounces after the camera hit
+constexpr int ROULETTE_DEPTH    = 3;  // Russian roulette starts at this bounce
+
+// Progressive rendering
+constexpr int ADAPTIVE_PASS_SAMPLES     = 8;        // samples per pixel and pass
+constexpr int ADAPTIVE_MIN_SAMPLES      = 16;       // before a tile may be considered converged
+constexpr int ADAPTIVE_MAX_SAMPLES      = 1 << 16;  // default limit when only an error target or time budget is given
+constexpr float ADAPTIVE_ERROR_FLOOR    = 0.01f;    // luminance below which the error is taken as absolute
+
+// Post-process
+constexpr int SRGB_LUT_SIZE             = 4096;     // entries over the square root of [0, 1]
+constexpr int POSTPROCESS_ROWS          = 16;       // rows per post-process task
+constexpr float DISPLAY_MAX_LINEAR      = 1e6f;     // exposed values are clamped to this before tonemapping
+
+// Output
+constexpr int PNG_COMPRESSION_LEVEL     = 6;        // zlib level, 0 stores, 9 is smallest
+constexpr int OUTPUT_QUEUE_DEPTH        = 2;        // finished bands or frames waiting for the output thread
+
+// Materials
+constexpr float GGX_MIN_ROUGHNESS       = 0.03f;    // smoother metals are treated as perfect mirrors
+
+// Wavefront integrator
+constexpr int WAVEFRONT_BATCH_SIZE      = 4096;     // paths in flight per worker
+
+// Denoiser
+constexpr int DENOISE_ITERATIONS        = 5;        // a-trous passes, the footprint doubles with every one
+constexpr float DENOISE_SIGMA_LUMINANCE = 4.0f;     // luminance differences, in standard deviations
+constexpr float DENOISE_SIGMA_DEPTH     = 1.0f;     // depth differences, in depth gradients
+constexpr float DENOISE_MIN_ALBEDO      = 1e-3f;    // darker channels are filtered without demodulation
+constexpr int DENOISE_ROWS              = 16;       // rows per denoise task
+
+// Interactive preview
+constexpr int PREVIEW_SAMPLES           = 256;      // default samples per pixel a view accumulates to
+constexpr int PREVIEW_INTERVAL_MS       = 100;      // least time between two published images of a view
+constexpr int PREVIEW_POLL_MS           = 50;       // control file and listening socket check period
+constexpr int PREVIEW_JPEG_QUALITY      = 85;       // MJPEG frames and .jpg files
+constexpr int PREVIEW_PNG_LEVEL         = 1;        // the file sink favours speed over size
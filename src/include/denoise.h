@@ -0,0 +1,122 @@
+#pragma once
+
+// Edge-aware denoise of the film's mean with the a-trous filter of atrous.h, rows
+// spread over the pool. The color is divided by the first-hit albedo before filtering
+// and multiplied back afterwards, so only the lighting is blurred and texture and
+// material edges stay sharp. A film without features is returned as is.
+Film Denoise(const Film& film, ThreadPool& pool, const DenoiseSettings& settings) {
+    Film result = film;
+    if (!film.HasFeatures()) return result;
+
+    const std::size_t width = film.width, height = film.height;
+    const std::size_t tasks = (height + DENOISE_ROWS - 1) / DENOISE_ROWS;
+    DenoiseFeatures features(width, height);
+    DenoiseColor color(film.size()), filtered(film.size());
+    std::vector<float> sampleVariance(film.size());
+
+    auto forEachRow = [&](const std::function<void(std::size_t)>& row) {
+        pool.Run(tasks, [&](std::size_t task, std::size_t) {
+            std::size_t last = std::min(height, (task + 1) * DENOISE_ROWS);
+            for (std::size_t y = task * DENOISE_ROWS; y < last; y++) row(y);
+        });
+    };
+
+    auto demodulate = [](const float& value, const float& albedo) { return albedo > DENOISE_MIN_ALBEDO ? value / albedo : value; };
+    auto remodulate = [](const float& value, const float& albedo) { return albedo > DENOISE_MIN_ALBEDO ? value * albedo : value; };
+
+    // Demodulated color and the variance of its mean, negative where a single sample
+    // leaves it unknown
+    forEachRow([&](std::size_t y) {
+        for (std::size_t i = y * width; i < (y + 1) * width; i++) {
+            const glm::vec3& albedo = film.albedo[i];
+            const glm::vec3 mean = film.mean[i];
+            color.r[i] = demodulate(mean.r, albedo.r);
+            color.g[i] = demodulate(mean.g, albedo.g);
+            color.b[i] = demodulate(mean.b, albedo.b);
+
+            std::uint32_t n = film.sampleCount[i];
+            float scale = Luminance(mean) > 0.0f ? Luminance(glm::vec3(color.r[i], color.g[i], color.b[i])) / Luminance(mean) : 1.0f;
+            sampleVariance[i] = n >= 2 ? film.luminanceM2[i] / (float) (n - 1) / (float) n * scale * scale : -1.0f;
+
+            features.normalX[i] = film.normal[i].x;
+            features.normalY[i] = film.normal[i].y;
+            features.normalZ[i] = film.normal[i].z;
+            features.depth[i] = film.depth[i];
+        }
+    });
+
+    // The variance is smoothed over 3x3 pixels, the estimates of a few samples are noisy
+    // themselves. Pixels without one take the variance of their neighbours' luminance.
+    // The depth gradient uses the flatter side in each direction, which is the pixel's
+    // own surface at a silhouette.
+    forEachRow([&](std::size_t y) {
+        for (std::size_t x = 0; x < width; x++) {
+            const std::size_t p = y * width + x;
+            float weightSum = 0.0f, varianceSum = 0.0f, varianceWeight = 0.0f, luminanceSum = 0.0f, luminanceSquaredSum = 0.0f;
+
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    std::ptrdiff_t xq = (std::ptrdiff_t) x + dx, yq = (std::ptrdiff_t) y + dy;
+                    if (xq < 0 || yq < 0 || xq >= (std::ptrdiff_t) width || yq >= (std::ptrdiff_t) height) continue;
+
+                    std::size_t q = (std::size_t) yq * width + (std::size_t) xq;
+                    float weight = (float) ((2 - std::abs(dx)) * (2 - std::abs(dy)));
+                    float luminance = Luminance(glm::vec3(color.r[q], color.g[q], color.b[q]));
+
+                    weightSum += weight;
+                    luminanceSum += weight * luminance;
+                    luminanceSquaredSum += weight * luminance * luminance;
+
+                    if (sampleVariance[q] >= 0.0f) {
+                        varianceSum += weight * sampleVariance[q];
+                        varianceWeight += weight;
+                    }
+                }
+            }
+
+            float luminanceMean = luminanceSum / weightSum;
+            color.variance[p] = sampleVariance[p] >= 0.0f ? varianceSum / varianceWeight : std::max(luminanceSquaredSum / weightSum - luminanceMean * luminanceMean, 0.0f);
+
+            const float z = features.depth[p];
+            float gradientX = std::numeric_limits<float>::infinity(), gradientY = std::numeric_limits<float>::infinity();
+            if (x > 0) gradientX = std::abs(z - features.depth[p - 1]);
+            if (x + 1 < width) gradientX = std::min(gradientX, std::abs(features.depth[p + 1] - z));
+            if (y > 0) gradientY = std::abs(z - features.depth[p - width]);
+            if (y + 1 < height) gradientY = std::min(gradientY, std::abs(features.depth[p + width] - z));
+            features.depthGradient[p] = (std::isinf(gradientX) ? 0.0f : gradientX) + (std::isinf(gradientY) ? 0.0f : gradientY);
+        }
+    });
+
+    for (int iteration = 0; iteration < settings.iterations; iteration++) {
+        const int step = 1 << iteration;
+        const std::size_t reach = 2 * (std::size_t) step;
+
+        // Pixels closer than two steps to the left or right edge lose taps, the scalar
+        // path checks every one of them
+        const std::size_t interiorBegin = std::min(reach, width);
+        const std::size_t interiorEnd = std::max(interiorBegin, width > reach ? width - reach : 0);
+
+        forEachRow([&](std::size_t y) {
+            for (std::size_t x = 0; x < interiorBegin; x++) ATrousPixel(features, color, filtered, x, y, step, settings);
+
+            if (simdKernels.aTrousSpan) {
+                simdKernels.aTrousSpan(features, color, filtered, y, interiorBegin, interiorEnd - interiorBegin, step, settings);
+            } else {
+                for (std::size_t x = interiorBegin; x < interiorEnd; x++) ATrousPixel(features, color, filtered, x, y, step, settings);
+            }
+
+            for (std::size_t x = interiorEnd; x < width; x++) ATrousPixel(features, color, filtered, x, y, step, settings);
+        });
+
+        std::swap(color, filtered);
+    }
+
+    forEachRow([&](std::size_t y) {
+        for (std::size_t i = y * width; i < (y + 1) * width; i++) {
+            const glm::vec3& albedo = film.albedo[i];
+            result.mean[i] = glm::vec3(remodulate(color.r[i], albedo.r), remodulate(color.g[i], albedo.g), remodulate(color.b[i], albedo.b));
+        }
+    });
+
+    return result;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+// Running per-pixel estimate of the linear image, or of the band of rows [y0, y0 + height)
+// of it. Every pixel keeps its own sample count, so passes may cover any subset of the
+// tiles and can be cut short at any point.
+class Film {
+public:
+    std::size_t width, height;
+    std::size_t y0;
+    std::vector<glm::vec3> mean;
+    std::vector<float> luminanceM2;  // Welford's sum of squared deviations of the luminance
+    std::vector<std::uint32_t> sampleCount;
+
+    // First-hit features for the denoiser and the AOV outputs, empty unless enabled. The
+    // camera does not jitter, so the first pass over a pixel sets them for good.
+    std::vector<glm::vec3> albedo;
+    std::vector<glm::vec3> normal;  // facing the camera, 0 on a miss
+    std::vector<float> depth;       // distance along the camera ray, 0 on a miss
+
+    Film(const std::size_t& width, const std::size_t& height, const std::size_t& y0 = 0)
+        : width(width), height(height), y0(y0), mean(width * height, glm::vec3(0.0f)), luminanceM2(width * height, 0.0f), sampleCount(width * height, 0) {}
+
+    std::size_t size() const { return mean.size(); }
+
+    void EnableFeatures() {
+        albedo.assign(size(), glm::vec3(0.0f));
+        normal.assign(size(), glm::vec3(0.0f));
+        depth.assign(size(), 0.0f);
+    }
+
+    bool HasFeatures() const { return !depth.empty(); }
+
+    // x and y in image coordinates
+    std::size_t Index(const std::size_t& x, const std::size_t& y) const {
+        return (y - y0) * width + x;
+    }
+
+    void AddSample(const std::size_t& pixel, const glm::vec3& color) {
+        std::uint32_t n = ++sampleCount[pixel];
+        float luminanceDelta = Luminance(color) - Luminance(mean[pixel]);
+
+        mean[pixel] += (color - mean[pixel]) / (float) n;
+        luminanceM2[pixel] += luminanceDelta * (Luminance(color) - Luminance(mean[pixel]));
+    }
+
+    // Standard error of the mean luminance relative to the mean itself. Dark pixels are
+    // measured against ADAPTIVE_ERROR_FLOOR instead so they are not chased forever.
+    float RelativeError(const std::size_t& pixel) const {
+        std::uint32_t n = sampleCount[pixel];
+        if (n < 2) return std::numeric_limits<float>::infinity();
+
+        float variance = luminanceM2[pixel] / (float) (n - 1);
+        float standardError = std::sqrt(variance / (float) n);
+        return standardError / std::max(Luminance(mean[pixel]), ADAPTIVE_ERROR_FLOOR);
+    }
+};
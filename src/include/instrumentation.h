@@ -0,0 +1,242 @@
+#pragma once
+
+// Hot path counters and tile timings. Configure with -DPRISMATICA_INSTRUMENTATION=ON to
+// compile them in, otherwise the PROFILE_* macros expand to nothing and the reports
+// below only ever see empty data.
+
+#define PROFILE_HINT "[\e[0;35mPROFILE\033[0m]\t"
+
+enum class ProfileCounter {
+    CameraRays,
+    BounceRays,
+    ShadowRays,
+    PrimitiveTests,        // scalar ray against one primitive
+    PacketPrimitiveTests,  // whole packet against one primitive
+    BVHNodes,              // nodes visited by single rays and packets
+    HitsDiffuse,
+    HitsMetal,
+    HitsRefractive,
+    HitsEmissive,
+    Misses
+};
+
+constexpr int PROFILE_COUNTER_COUNT = (int) ProfileCounter::Misses + 1;
+
+const char* ProfileCounterName(const int& counter) {
+    static const char* names[PROFILE_COUNTER_COUNT] = {
+        "camera rays", "bounce rays", "shadow rays", "primitive tests", "packet primitive tests", "bvh nodes",
+        "hits diffuse", "hits metal", "hits refractive", "hits emissive", "misses"
+    };
+    return names[counter];
+}
+
+constexpr int PROFILE_DEPTH_BINS = 32;
+
+class TileEvent {
+public:
+    std::size_t x0, y0, x1, y1;
+    std::size_t pass;
+    std::size_t worker;
+    std::int64_t startNs;
+    std::int64_t durationNs;
+};
+
+// Padded so two threads never share a cache line while counting
+class alignas(64) ThreadProfile {
+public:
+    std::uint64_t counters[PROFILE_COUNTER_COUNT]{};
+    std::uint64_t pathDepth[PROFILE_DEPTH_BINS]{};  // paths by the bounce they ended at
+    std::vector<TileEvent> tiles;
+};
+
+// Every thread registers its own ThreadProfile the first time it counts something and
+// from then on updates it without synchronization. Only read once the pool is idle.
+class Profiler {
+public:
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    ThreadProfile& Local() {
+        thread_local ThreadProfile* local = nullptr;
+
+        if (!local) {
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.push_back(std::make_unique<ThreadProfile>());
+            local = threads.back().get();
+        }
+
+        return *local;
+    }
+
+    void RecordTile(const std::size_t& x0, const std::size_t& y0, const std::size_t& x1, const std::size_t& y1,
+                    const std::size_t& pass, const std::size_t& worker, const std::chrono::steady_clock::time_point& start) {
+        auto now = std::chrono::steady_clock::now();
+        std::int64_t startNs = std::chrono::duration_cast<std::chrono::nanoseconds>(start - epoch).count();
+        std::int64_t durationNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+        Local().tiles.push_back(TileEvent{x0, y0, x1, y1, pass, worker, startNs, durationNs});
+    }
+
+    // Threads keep their registration, only the data is cleared
+    void Reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& thread : threads) {
+            std::fill(std::begin(thread->counters), std::end(thread->counters), 0);
+            std::fill(std::begin(thread->pathDepth), std::end(thread->pathDepth), 0);
+            thread->tiles.clear();
+        }
+        epoch = std::chrono::steady_clock::now();
+    }
+
+    std::vector<const ThreadProfile*> Threads() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<const ThreadProfile*> result;
+        for (auto& thread : threads) result.push_back(thread.get());
+        return result;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadProfile>> threads;
+};
+
+Profiler profiler{};
+
+#ifdef PRISMATICA_INSTRUMENTATION
+    constexpr bool INSTRUMENTATION_ENABLED = true;
+
+    #define PROFILE_COUNT(counter) (profiler.Local().counters[(int) (counter)]++)
+    #define PROFILE_ADD(counter, n) (profiler.Local().counters[(int) (counter)] += (n))
+    #define PROFILE_PATH_DEPTH(depth) (profiler.Local().pathDepth[std::min<int>((depth), PROFILE_DEPTH_BINS - 1)]++)
+    #define PROFILE_TILE_BEGIN() const auto profileTileStart = std::chrono::steady_clock::now()
+    #define PROFILE_TILE_END(tile, pass, worker) profiler.RecordTile((tile).x0, (tile).y0, (tile).x1, (tile).y1, (pass), (worker), profileTileStart)
+#else
+    constexpr bool INSTRUMENTATION_ENABLED = false;
+
+    #define PROFILE_COUNT(counter) ((void) 0)
+    #define PROFILE_ADD(counter, n) ((void) 0)
+    #define PROFILE_PATH_DEPTH(depth) ((void) 0)
+    #define PROFILE_TILE_BEGIN() ((void) 0)
+    #define PROFILE_TILE_END(tile, pass, worker) ((void) (worker))  // the worker index is only passed on for the profile
+#endif
+
+// Totals, per worker load and the path length distribution
+void PrintProfileSummary() {
+    std::vector<const ThreadProfile*> threads = profiler.Threads();
+    std::uint64_t totals[PROFILE_COUNTER_COUNT]{};
+    std::uint64_t depths[PROFILE_DEPTH_BINS]{};
+    std::map<std::size_t, std::pair<std::size_t, double>> workers;  // tiles and milliseconds
+
+    for (const ThreadProfile* thread : threads) {
+        for (int i = 0; i < PROFILE_COUNTER_COUNT; i++) totals[i] += thread->counters[i];
+        for (int i = 0; i < PROFILE_DEPTH_BINS; i++) depths[i] += thread->pathDepth[i];
+
+        for (const TileEvent& tile : thread->tiles) {
+            workers[tile.worker].first++;
+            workers[tile.worker].second += tile.durationNs * 1e-6;
+        }
+    }
+
+    std::printf("%s%-24s %16s\n", PROFILE_HINT, "counter", "total");
+    for (int i = 0; i < PROFILE_COUNTER_COUNT; i++) {
+        std::printf("%s%-24s %16llu\n", PROFILE_HINT, ProfileCounterName(i), (unsigned long long) totals[i]);
+    }
+
+    double busiest = 0.0, total = 0.0;
+    for (const auto& worker : workers) {
+        busiest = std::max(busiest, worker.second.second);
+        total += worker.second.second;
+    }
+
+    std::printf("%s%-8s %8s %12s %10s\n", PROFILE_HINT, "worker", "tiles", "busy", "share");
+    for (const auto& worker : workers) {
+        std::printf("%s%-8zu %8zu %10.2fms %9.1f%%\n", PROFILE_HINT, worker.first, worker.second.first, worker.second.second,
+                    total > 0.0 ? 100.0 * worker.second.second / total : 0.0);
+    }
+
+    // Busiest worker against the average, 1.0 is a perfect balance
+    if (!workers.empty() && total > 0.0) {
+        std::printf("%sload imbalance %.3f\n", PROFILE_HINT, busiest / (total / workers.size()));
+    }
+
+    std::uint64_t paths = 0;
+    for (int i = 0; i < PROFILE_DEPTH_BINS; i++) paths += depths[i];
+
+    std::printf("%s%-8s %16s %10s\n", PROFILE_HINT, "depth", "paths", "share");
+    for (int i = 0; i < PROFILE_DEPTH_BINS; i++) {
+        if (depths[i] == 0) continue;
+        std::printf("%s%-8d %16llu %9.1f%%\n", PROFILE_HINT, i, (unsigned long long) depths[i], 100.0 * depths[i] / paths);
+    }
+}
+
+// Chrome trace_event timeline, one row per worker and one slice per tile pass.
+// Open it in chrome://tracing or https://ui.perfetto.dev.
+bool WriteChromeTrace(const std::string& path) {
+    std::ofstream file(path);
+    std::set<std::size_t> workers;
+    bool first = true;
+
+    file << "{\"traceEvents\": [\n";
+
+    for (const ThreadProfile* thread : profiler.Threads()) {
+        for (const TileEvent& tile : thread->tiles) {
+            workers.insert(tile.worker);
+            file << (first ? "" : ",\n") << "{\"name\": \"tile " << tile.x0 << "," << tile.y0 << "\", \"cat\": \"tile\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << tile.worker
+                 << ", \"ts\": " << tile.startNs / 1000.0 << ", \"dur\": " << tile.durationNs / 1000.0
+                 << ", \"args\": {\"pass\": " << tile.pass << ", \"pixels\": " << (tile.x1 - tile.x0) * (tile.y1 - tile.y0) << "}}";
+            first = false;
+        }
+    }
+
+    for (std::size_t worker : workers) {
+        file << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << worker << ", \"args\": {\"name\": \"worker " << worker << "\"}}";
+        first = false;
+    }
+
+    file << "\n]}\n";
+
+    if (!file) {
+        std::cerr << PROFILE_HINT << "Could not write " << path << '\n';
+        return false;
+    }
+
+    return true;
+}
+
+// Time per pixel summed over all passes, as an 8 bit RGB image with the top row first.
+// Large renders are scaled down so the longer side has at most PROFILE_HEATMAP_SIZE pixels.
+constexpr std::size_t PROFILE_HEATMAP_SIZE = 1024;
+
+std::vector<unsigned char> TileCostHeatmap(const std::size_t& width, const std::size_t& height, std::size_t& mapWidth, std::size_t& mapHeight) {
+    std::size_t scale = std::max<std::size_t>(1, (std::max(width, height) + PROFILE_HEATMAP_SIZE - 1) / PROFILE_HEATMAP_SIZE);
+    mapWidth = (width + scale - 1) / scale;
+    mapHeight = (height + scale - 1) / scale;
+
+    std::vector<double> cost(mapWidth * mapHeight, 0.0);
+
+    for (const ThreadProfile* thread : profiler.Threads()) {
+        for (const TileEvent& tile : thread->tiles) {
+            double perPixel = (double) tile.durationNs / ((tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+
+            for (std::size_t y = tile.y0 / scale; y <= (tile.y1 - 1) / scale; y++) {
+                for (std::size_t x = tile.x0 / scale; x <= (tile.x1 - 1) / scale; x++) cost[y * mapWidth + x] += perPixel;
+            }
+        }
+    }
+
+    double maximum = *std::max_element(cost.begin(), cost.end());
+    std::vector<unsigned char> rgb(3 * cost.size());
+
+    for (std::size_t y = 0; y < mapHeight; y++) {
+        for (std::size_t x = 0; x < mapWidth; x++) {
+            // Black, red, yellow, white
+            float v = maximum > 0.0 ? (float) (cost[y * mapWidth + x] / maximum) : 0.0f;
+            glm::vec3 color = glm::clamp(glm::vec3(3.0f * v, 3.0f * v - 1.0f, 3.0f * v - 2.0f), glm::vec3(0.0f), glm::vec3(1.0f));
+
+            unsigned char* pixel = &rgb[3 * ((mapHeight - 1 - y) * mapWidth + x)];
+            pixel[0] = (unsigned char) (color.r * 255.0f);
+            pixel[1] = (unsigned char) (color.g * 255.0f);
+            pixel[2] = (unsigned char) (color.b * 255.0f);
+        }
+    }
+
+    return rgb;
+}
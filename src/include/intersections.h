@@ -1,188 +1,330 @@
 #pragma once
 
-class Material {
-public:
-    glm::vec3 albedo;
-    bool isEmissive;
-    bool isMetal;
-    bool isRefractive;
-    float emissivity;
-    float roughness;
-
-    Material() {
-        albedo = glm::vec3(0.0f);
-        isEmissive = false;
-        emissivity = 0.0f;
-        isMetal = false;
-        isRefractive = false;
-        roughness = 0.5f;
-    }
-};
-
+// Kept small, the material is looked up in Scene::materials when the hit is shaded
 class HitData {
 public:
     glm::vec3 hitPos;
-    glm::vec3 hitNormal;
-    Material material;
+    glm::vec3 hitNormal;  // geometric, facing out of spheres and along the winding of triangles
     float t;
+    std::uint32_t ref;  // primitive that was hit, 0 on a miss
+    MaterialId material;
     bool rayHit;
 
     HitData() {
         hitPos = glm::vec3(0.0f);
         hitNormal = glm::vec3(0.0f);
-        material = Material();
         t = std::numeric_limits<float>::max(); // absurdly large value
+        ref = 0;
+        material = 0;
         rayHit = false;
     }
 };
 
-void IntersectSphere(HitData& hitData, const Material& material, const glm::vec3& sphereOrigin, const float& radius, const glm::vec3& rayOrigin, const glm::vec3& direction) {
+// The primitive tests only report the distance along the ray. Positions, normals and
+// material IDs are resolved once for the closest hit in RayTraceScene().
+
+bool IntersectSphere(float& t, const glm::vec3& sphereOrigin, const float& radius, const glm::vec3& rayOrigin, const glm::vec3& direction) {
     // Analytical Sphere Intersection
     glm::vec3 originsDelta = sphereOrigin - rayOrigin;
     float tca = glm::dot(originsDelta, direction);
     float d2 = glm::dot(originsDelta, originsDelta) - tca * tca;
-    if (d2 > radius * radius) return; 
+    if (d2 > radius * radius) return false;
 
     float thc = sqrt(radius * radius - d2);
     float t0 = tca - thc;
     float t1 = tca + thc;
 
     // Intersections are behind the ray origin
-    if (t0 < 0.0f && t1 < 0.0f) return;
+    if (t0 < 0.0f && t1 < 0.0f) return false;
 
-    float t = (t0 < t1) ? t0 : t1;
-          t = (t0 < 0.0f) ? t1 : t;
-
-    hitData.hitPos = rayOrigin + direction * t;
-    hitData.hitNormal = glm::normalize(hitData.hitPos - sphereOrigin);
-    hitData.t = t;
-    hitData.rayHit = true;
-    hitData.material = material;
+    t = (t0 < t1) ? t0 : t1;
+    t = (t0 < 0.0f) ? t1 : t;
+    return true;
 }
 
-void IntersectPlane(HitData& hitData, const Material& material, const glm::vec3& planeOrigin, const glm::vec3& planeNormal, const glm::vec3& rayOrigin, const glm::vec3& rayDirection) {
+bool IntersectPlane(float& t, const glm::vec3& planeOrigin, const glm::vec3& planeNormal, const glm::vec3& rayOrigin, const glm::vec3& rayDirection) {
     // https://www.scratchapixel.com/lessons/3d-basic-rendering/minimal-ray-tracer-rendering-simple-shapes/ray-plane-and-ray-disk-intersection.html
     // Equation 5
-    hitData.hitNormal = planeNormal;
-    float denom = glm::dot(hitData.hitNormal, rayDirection);
+    float denom = glm::dot(planeNormal, rayDirection);
 
-    if (std::abs(denom) < 1e-6) return;
+    if (std::abs(denom) < 1e-6) return false;
 
     glm::vec3 originsDelta = planeOrigin - rayOrigin;
-    hitData.t = glm::dot(originsDelta, hitData.hitNormal) / denom;
+    t = glm::dot(originsDelta, planeNormal) / denom;
 
-    if (hitData.t >= 0) {
-        hitData.hitPos = hitData.t * rayDirection + rayOrigin;
-        hitData.rayHit = true;
-        hitData.material = material;
-    }
+    return t >= 0.0f;
 }
 
-void IntersectDisk(
-    HitData& hitData, 
-    const Material& material, 
+bool IntersectDisk(
+    float& t,
     const glm::vec3& origin,
-    const float& radius, 
-    const glm::vec3& normal, 
-    const glm::vec3& rayOrigin, 
+    const float& radius,
+    const glm::vec3& normal,
+    const glm::vec3& rayOrigin,
+    const glm::vec3& rayDirection
+) {
+    if (!IntersectPlane(t, origin, normal, rayOrigin, rayDirection)) return false;
+
+    glm::vec3 hitPos = t * rayDirection + rayOrigin;
+    return glm::distance(hitPos, origin) < radius;
+}
+
+bool IntersectTriangle(
+    float& t,
+    const glm::vec3& v0,
+    const glm::vec3& edge1,
+    const glm::vec3& edge2,
+    const glm::vec3& rayOrigin,
     const glm::vec3& rayDirection
 ) {
-    IntersectPlane(hitData, material, origin, normal, rayOrigin, rayDirection);
+    // Moeller-Trumbore
+    glm::vec3 p = glm::cross(rayDirection, edge2);
+    float det = glm::dot(edge1, p);
+
+    if (std::abs(det) < 1e-9f) return false;
+
+    float invDet = 1.0f / det;
+    glm::vec3 s = rayOrigin - v0;
+    float u = glm::dot(s, p) * invDet;
+    if (u < 0.0f || u > 1.0f) return false;
+
+    glm::vec3 q = glm::cross(s, edge1);
+    float v = glm::dot(rayDirection, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    t = glm::dot(edge2, q) * invDet;
+    return t >= 0.0f;
+}
 
-    if (hitData.rayHit) {
-        float dist = glm::distance(hitData.hitPos, origin);
-        hitData.rayHit = dist < radius ? true : false;
+bool IntersectPrimitive(const Scene& scene, float& t, const std::uint32_t& ref, const glm::vec3& rayOrigin, const glm::vec3& rayDirection) {
+    std::uint32_t i = PrimitiveIndexOf(ref);
+    PROFILE_COUNT(ProfileCounter::PrimitiveTests);
+
+    switch (PrimitiveTypeOf(ref)) {
+        case PrimitiveType::Sphere:
+            return IntersectSphere(t, scene.spheres.Center(i), scene.spheres.radius[i], rayOrigin, rayDirection);
+        case PrimitiveType::Disk:
+            return IntersectDisk(t, scene.disks.Origin(i), scene.disks.radius[i], scene.disks.Normal(i), rayOrigin, rayDirection);
+        case PrimitiveType::Triangle:
+            return IntersectTriangle(t, scene.triangles.Vertex0(i), scene.triangles.Edge1(i), scene.triangles.Edge2(i), rayOrigin, rayDirection);
+        default:
+            return false;
     }
 }
 
-bool CompareHitData(const HitData& a, const HitData& b) {
-    return a.t < b.t;
+// Front-to-back BVH traversal. Children are visited nearest first and any node that
+// starts beyond the closest hit found so far is skipped.
+void TraverseBVH(const Scene& scene, float& closestT, std::uint32_t& closestRef, const glm::vec3& rayOrigin, const glm::vec3& rayDirection) {
+    const BVH& bvh = scene.bvh;
+    if (bvh.empty()) return;
+
+    const glm::vec3 invDirection = SafeInverse(rayDirection);
+    const float miss = std::numeric_limits<float>::max();
+
+    // Far children are pushed together with their entry distance so popping them
+    // only needs a compare against the current closest hit
+    std::uint32_t stack[BVH_STACK_SIZE];
+    float stackT[BVH_STACK_SIZE];
+    int stackSize = 0;
+    float t;
+
+    if (IntersectAABB(bvh.nodes[0], rayOrigin, invDirection, closestT) == miss) return;
+
+    const BVHNode* node = &bvh.nodes[0];
+
+    while (true) {
+        PROFILE_COUNT(ProfileCounter::BVHNodes);
+
+        if (node->IsLeaf()) {
+            for (std::uint32_t i = node->leftOrFirst; i < node->leftOrFirst + node->count; i++) {
+                std::uint32_t ref = bvh.primitives[i];
+                if (IntersectPrimitive(scene, t, ref, rayOrigin, rayDirection) && t < closestT) {
+                    closestT = t;
+                    closestRef = ref;
+                }
+            }
+        } else {
+            std::uint32_t nearIndex = node->leftOrFirst;
+            std::uint32_t farIndex = nearIndex + 1;
+            float tNear = IntersectAABB(bvh.nodes[nearIndex], rayOrigin, invDirection, closestT);
+            float tFar = IntersectAABB(bvh.nodes[farIndex], rayOrigin, invDirection, closestT);
+
+            if (tFar < tNear) {
+                std::swap(nearIndex, farIndex);
+                std::swap(tNear, tFar);
+            }
+
+            if (tNear != miss) {
+                if (tFar != miss) {
+                    stack[stackSize] = farIndex;
+                    stackT[stackSize++] = tFar;
+                }
+                node = &bvh.nodes[nearIndex];
+                continue;
+            }
+        }
+
+        // Pop until we find a node that can still contain something closer
+        while (stackSize > 0 && stackT[stackSize - 1] >= closestT) stackSize--;
+        if (stackSize == 0) return;
+        node = &bvh.nodes[stack[--stackSize]];
+    }
 }
 
-HitData SortIntersections(std::vector<HitData>& hitData) {
-    std::sort(hitData.begin(), hitData.end(), CompareHitData);
+// Any-hit BVH traversal. Nodes are visited in no particular order and the search stops
+// at the first primitive in front of tMax.
+bool OccludedBVH(const Scene& scene, const glm::vec3& rayOrigin, const glm::vec3& rayDirection, const float& tMax) {
+    const BVH& bvh = scene.bvh;
+    if (bvh.empty()) return false;
 
-    HitData closestHit{};
-    bool anyRayHit = false;
+    const glm::vec3 invDirection = SafeInverse(rayDirection);
+    const float miss = std::numeric_limits<float>::max();
+
+    std::uint32_t stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    float t;
 
-    for (const auto& hit : hitData) {
-        if (hit.rayHit) {
-            closestHit = hit;
-            anyRayHit = true;
+    if (IntersectAABB(bvh.nodes[0], rayOrigin, invDirection, tMax) == miss) return false;
+
+    const BVHNode* node = &bvh.nodes[0];
+
+    while (true) {
+        PROFILE_COUNT(ProfileCounter::BVHNodes);
+
+        if (node->IsLeaf()) {
+            for (std::uint32_t i = node->leftOrFirst; i < node->leftOrFirst + node->count; i++) {
+                if (IntersectPrimitive(scene, t, bvh.primitives[i], rayOrigin, rayDirection) && t < tMax) return true;
+            }
+        } else {
+            std::uint32_t first = node->leftOrFirst;
+            bool hitFirst = IntersectAABB(bvh.nodes[first], rayOrigin, invDirection, tMax) != miss;
+            bool hitSecond = IntersectAABB(bvh.nodes[first + 1], rayOrigin, invDirection, tMax) != miss;
+
+            if (hitFirst || hitSecond) {
+                if (hitFirst && hitSecond) stack[stackSize++] = first + 1;
+                node = &bvh.nodes[hitFirst ? first : first + 1];
+                continue;
+            }
+        }
+
+        if (stackSize == 0) return false;
+        node = &bvh.nodes[stack[--stackSize]];
+    }
+}
+
+// Fills in position, normal and material ID for the closest primitive
+void ResolveHit(const Scene& scene, HitData& hitData, const float& closestT, const std::uint32_t& closestRef, const glm::vec3& rayOrigin, const glm::vec3& rayDirection) {
+    hitData = HitData();
+    if (closestRef == 0) return;
+
+    std::uint32_t index = PrimitiveIndexOf(closestRef);
+
+    hitData.t = closestT;
+    hitData.ref = closestRef;
+    hitData.hitPos = rayOrigin + rayDirection * closestT;
+    hitData.rayHit = true;
+
+    switch (PrimitiveTypeOf(closestRef)) {
+        case PrimitiveType::Plane:
+            hitData.hitNormal = scene.planes.Normal(index);
+            hitData.material = scene.planes.material[index];
+            break;
+        case PrimitiveType::Sphere:
+            hitData.hitNormal = glm::normalize(hitData.hitPos - scene.spheres.Center(index));
+            hitData.material = scene.spheres.material[index];
+            break;
+        case PrimitiveType::Disk:
+            hitData.hitNormal = scene.disks.Normal(index);
+            hitData.material = scene.disks.material[index];
+            break;
+        case PrimitiveType::Triangle:
+            // Triangles are two-sided for shading, the winding only tells dielectrics inside from outside
+            hitData.hitNormal = scene.triangles.Normal(index);
+            hitData.material = scene.triangles.material[index];
+            break;
+        default:
             break;
+    }
+}
+
+// Closest primitive along the ray without resolving the hit. closestRef stays 0 on a miss.
+void ClosestHit(const Scene& scene, float& closestT, std::uint32_t& closestRef, const glm::vec3& rayOrigin, const glm::vec3& rayDirection) {
+    const PlaneBuffer& planes = scene.planes;
+    float t;
+
+    PROFILE_ADD(ProfileCounter::PrimitiveTests, planes.size());
+
+    if (simdKernels.closestPlane && planes.size() >= SIMD_PLANE_THRESHOLD) {
+        simdKernels.closestPlane(scene, rayOrigin, rayDirection, closestT, closestRef);
+    } else {
+        for (std::size_t i = 0; i < planes.size(); i++) {
+            if (IntersectPlane(t, planes.Origin(i), planes.Normal(i), rayOrigin, rayDirection) && t < closestT) {
+                closestT = t;
+                closestRef = PackPrimitive(PrimitiveType::Plane, i);
+            }
         }
     }
 
-    // Anyhit
-    closestHit.rayHit = anyRayHit;
+    TraverseBVH(scene, closestT, closestRef, rayOrigin, rayDirection);
+}
+
+void RayTraceScene(const Scene& scene, HitData& hitData, const glm::vec3& rayOrigin, const glm::vec3& rayDirection) {
+    // Keep a running minimum instead of collecting and sorting every intersection
+    float closestT = std::numeric_limits<float>::max();
+    std::uint32_t closestRef = 0;
+
+    ClosestHit(scene, closestT, closestRef, rayOrigin, rayDirection);
+    ResolveHit(scene, hitData, closestT, closestRef, rayOrigin, rayDirection);
+}
+
+// Traces the first simdKernels.packetSize rays of the packet together and resolves their hits
+void TracePacket(const Scene& scene, RayPacket& packet, HitData* hitData) {
+    simdKernels.tracePacket(scene, packet);
+
+    for (int lane = 0; lane < simdKernels.packetSize; lane++) {
+        glm::vec3 origin = glm::vec3(packet.originX[lane], packet.originY[lane], packet.originZ[lane]);
+        glm::vec3 direction = glm::vec3(packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane]);
+        ResolveHit(scene, hitData[lane], packet.t[lane], packet.ref[lane], origin, direction);
+    }
+}
+
+// True if any primitive lies along the ray before tMax. Returns at the first occluder
+// and never looks at normals or materials, for shadow and visibility rays.
+bool Occluded(const Scene& scene, const glm::vec3& rayOrigin, const glm::vec3& rayDirection, const float& tMax) {
+    const PlaneBuffer& planes = scene.planes;
+    float t;
+
+    PROFILE_ADD(ProfileCounter::PrimitiveTests, planes.size());
 
-    return closestHit;
+    if (simdKernels.anyPlane && planes.size() >= SIMD_PLANE_THRESHOLD) {
+        if (simdKernels.anyPlane(scene, rayOrigin, rayDirection, tMax)) return true;
+    } else {
+        for (std::size_t i = 0; i < planes.size(); i++) {
+            if (IntersectPlane(t, planes.Origin(i), planes.Normal(i), rayOrigin, rayDirection) && t < tMax) return true;
+        }
+    }
+
+    return OccludedBVH(scene, rayOrigin, rayDirection, tMax);
 }
 
-void RayTraceScene(HitData& hitData, const glm::vec3& rayOrigin, const glm::vec3& rayDirection, const int recursion = 0) {
-    if (recursion > MAX_RECURSIONS) return;
-    std::vector<HitData> hitDataTotal{};
-
-    Material planeMaterial{};
-    planeMaterial.albedo = glm::vec3(1.0f, 1.0f, 1.0f);
-    planeMaterial.emissivity = 0.0f;
-    planeMaterial.isEmissive = false;
-
-    Material emitterMaterial{};
-    emitterMaterial.albedo = glm::vec3(1.0f, 1.0f, 1.0f);
-    emitterMaterial.emissivity = 5.0f;
-    emitterMaterial.isEmissive = true;
-
-    HitData hitDataTemp;
-    IntersectPlane(hitDataTemp, planeMaterial, glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), rayOrigin, rayDirection);
-    hitDataTotal.push_back(hitDataTemp);
-
-    hitDataTemp = HitData();
-    IntersectPlane(hitDataTemp, planeMaterial, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), rayOrigin, rayDirection);
-    hitDataTotal.push_back(hitDataTemp);
-
-    hitDataTemp = HitData();
-    planeMaterial.albedo = glm::vec3(1.0f, 0.0f, 0.0f);
-    IntersectPlane(hitDataTemp, planeMaterial, glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), rayOrigin, rayDirection);
-    hitDataTotal.push_back(hitDataTemp);
-
-    hitDataTemp = HitData();
-    planeMaterial.albedo = glm::vec3(0.0f, 1.0f, 0.0f);
-    IntersectPlane(hitDataTemp, planeMaterial, glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), rayOrigin, rayDirection);
-    hitDataTotal.push_back(hitDataTemp);
-
-    hitDataTemp = HitData();
-    planeMaterial.albedo = glm::vec3(1.0f);
-    IntersectPlane(hitDataTemp, planeMaterial, glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 0.0f, 1.0f), rayOrigin, rayDirection);
-    hitDataTotal.push_back(hitDataTemp);
-
-    hitDataTemp = HitData();
-    planeMaterial.albedo = glm::vec3(1.0f);
-    IntersectSphere(hitDataTemp, planeMaterial, glm::vec3(-0.5f, -0.66f, 0.5f), 0.33f, rayOrigin, rayDirection);
-    hitDataTotal.push_back(hitDataTemp);
-
-    hitDataTemp = HitData();
-    planeMaterial.albedo = glm::vec3(1.0f);
-    planeMaterial.isMetal = true;
-    IntersectSphere(hitDataTemp, planeMaterial, glm::vec3(0.00f, -0.66f, 0.0f), 0.33f, rayOrigin, rayDirection);
-    hitDataTotal.push_back(hitDataTemp);
-
-    hitDataTemp = HitData();
-    planeMaterial.albedo = glm::vec3(1.0f);
-    planeMaterial.isMetal = false;
-    IntersectSphere(hitDataTemp, planeMaterial, glm::vec3(0.5f, -0.66f, 0.5f), 0.33f, rayOrigin, rayDirection);
-    hitDataTotal.push_back(hitDataTemp);
-
-    hitDataTemp = HitData();
-    IntersectDisk(hitDataTemp, emitterMaterial, glm::vec3(0.0f, 0.99f, 0.0f), 0.5f, glm::vec3(0.0f, -1.0f, 0.0f), rayOrigin, rayDirection);
-    hitDataTotal.push_back(hitDataTemp);
-    
-    // Choose the closest intersection
-    // using std::sort might not be the fastest solution. needs investigation
-    hitData = SortIntersections(hitDataTotal);
-
-    // Hacky way to add reflections. It would be more intuitive to add reflections via 
-    if (hitData.material.isMetal) {
-        RayTraceScene(hitData, hitData.hitPos + hitData.hitNormal * glm::vec3(0.001f), glm::reflect(rayDirection, hitData.hitNormal), recursion + 1);
+// Occlusion of the first simdKernels.packetSize rays of the packet, each up to its own t
+void OccludedPacket(const Scene& scene, RayPacket& packet, bool* occluded) {
+    if (simdKernels.occludedPacket) {
+        simdKernels.occludedPacket(scene, packet);
+        for (int lane = 0; lane < simdKernels.packetSize; lane++) occluded[lane] = packet.t[lane] < 0.0f;
+        return;
     }
-}
\ No newline at end of file
+
+    glm::vec3 origin = glm::vec3(packet.originX[0], packet.originY[0], packet.originZ[0]);
+    glm::vec3 direction = glm::vec3(packet.directionX[0], packet.directionY[0], packet.directionZ[0]);
+    occluded[0] = Occluded(scene, origin, direction, packet.t[0]);
+}
+
+// Shadow ray between two points, true if nothing lies in between. The end point itself
+// is excluded so the emitter that was sampled does not occlude itself.
+bool Visible(const Scene& scene, const glm::vec3& from, const glm::vec3& to) {
+    glm::vec3 delta = to - from;
+    float distance = glm::length(delta);
+
+    return !Occluded(scene, from, delta / distance, distance * (1.0f - 1e-3f));
+}
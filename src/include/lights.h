@@ -0,0 +1,83 @@
+#pragma once
+
+// Area light sampling for next-event estimation. Emitters shine from both sides, the same
+// way a BSDF ray that hits one picks up its emission regardless of the side.
+
+class LightSample {
+public:
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec3 radiance;
+    float pdf;  // solid angle density as seen from the shading point
+};
+
+// Area density to solid angle density
+float AreaToSolidAngle(const float& pdfArea, const glm::vec3& from, const glm::vec3& to, const glm::vec3& lightNormal) {
+    glm::vec3 delta = to - from;
+    float distanceSquared = glm::dot(delta, delta);
+    float cosTheta = std::abs(glm::dot(lightNormal, delta)) / std::sqrt(distanceSquared);
+
+    if (cosTheta < 1e-6f) return 0.0f;
+    return pdfArea * distanceSquared / cosTheta;
+}
+
+// Picks an emitter in proportion to its power, then a uniformly distributed point on it
+bool SampleEmitter(const Scene& scene, const glm::vec3& shadingPos, const float& randSelect, const glm::vec2& rand, LightSample& sample) {
+    if (scene.emitters.empty()) return false;
+
+    float target = randSelect * scene.emitterPower;
+    std::size_t emitter = std::upper_bound(scene.emitterCdf.begin(), scene.emitterCdf.end(), target) - scene.emitterCdf.begin();
+    emitter = std::min(emitter, scene.emitters.size() - 1);
+
+    std::uint32_t ref = scene.emitters[emitter];
+    std::uint32_t i = PrimitiveIndexOf(ref);
+
+    switch (PrimitiveTypeOf(ref)) {
+        case PrimitiveType::Sphere: {
+            float z = 1.0f - 2.0f * rand.x;
+            float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+            float phi = TAU * rand.y;
+            sample.normal = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+            sample.position = scene.spheres.Center(i) + scene.spheres.radius[i] * sample.normal;
+            break;
+        }
+        case PrimitiveType::Disk: {
+            glm::vec3 tangent, bitangent;
+            sample.normal = scene.disks.Normal(i);
+            OrthonormalBasis(sample.normal, tangent, bitangent);
+
+            glm::vec2 d = scene.disks.radius[i] * ConcentricSampleDisk(rand);
+            sample.position = scene.disks.Origin(i) + tangent * d.x + bitangent * d.y;
+            break;
+        }
+        default: {
+            float su = std::sqrt(rand.x);
+            sample.normal = scene.triangles.Normal(i);
+            sample.position = scene.triangles.Vertex0(i) + scene.triangles.Edge1(i) * (su * (1.0f - rand.y)) + scene.triangles.Edge2(i) * (su * rand.y);
+            break;
+        }
+    }
+
+    float pdfSelect = EmitterPower(scene, ref) / scene.emitterPower;
+    sample.pdf = AreaToSolidAngle(pdfSelect / PrimitiveArea(scene, ref), shadingPos, sample.position, sample.normal);
+    sample.radiance = PrimitiveMaterial(scene, ref).Emission();
+
+    return sample.pdf > 0.0f;
+}
+
+// Density with which SampleEmitter() would have produced a point that was found by BSDF sampling
+float EmitterPdf(const Scene& scene, const std::uint32_t& ref, const glm::vec3& shadingPos, const glm::vec3& lightPos, const glm::vec3& lightNormal) {
+    if (scene.emitterPower <= 0.0f) return 0.0f;
+
+    float power = EmitterPower(scene, ref);
+    if (power <= 0.0f) return 0.0f;
+
+    return AreaToSolidAngle(power / scene.emitterPower / PrimitiveArea(scene, ref), shadingPos, lightPos, lightNormal);
+}
+
+// Veach's power heuristic with beta = 2
+float PowerHeuristic(const float& pdf, const float& otherPdf) {
+    float a = pdf * pdf;
+    float b = otherPdf * otherPdf;
+    return a + b > 0.0f ? a / (a + b) : 0.0f;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+// Contiguous array of scene data. It either owns its elements, while a scene is being
+// built, or views elements that live in a memory-mapped scene cache (see
+// scenecache.h), in which case it is read-only and the mapping must outlive it.
+// Element access goes through a single pointer either way, so the intersection code
+// can't tell the two apart.
+template <typename T>
+class MappedArray {
+public:
+    MappedArray() = default;
+
+    MappedArray(const MappedArray& other) : storage(other.storage), view(other.view), count(other.count), mapped(other.mapped) {
+        if (!mapped) Sync();
+    }
+
+    MappedArray(MappedArray&& other) noexcept : storage(std::move(other.storage)), view(other.view), count(other.count), mapped(other.mapped) {
+        if (!mapped) Sync();
+        other.Sync();
+    }
+
+    MappedArray& operator=(const MappedArray& other) {
+        if (this == &other) return *this;
+        storage = other.storage;
+        view = other.view;
+        count = other.count;
+        mapped = other.mapped;
+        if (!mapped) Sync();
+        return *this;
+    }
+
+    MappedArray& operator=(MappedArray&& other) noexcept {
+        if (this == &other) return *this;
+        storage = std::move(other.storage);
+        view = other.view;
+        count = other.count;
+        mapped = other.mapped;
+        if (!mapped) Sync();
+        other.mapped = false;
+        other.Sync();
+        return *this;
+    }
+
+    MappedArray& operator=(std::vector<T>&& elements) {
+        storage = std::move(elements);
+        mapped = false;
+        Sync();
+        return *this;
+    }
+
+    // Views count elements at data, which stay owned by the caller
+    void Map(const T* data, const std::size_t& elementCount) {
+        storage.clear();
+        storage.shrink_to_fit();
+        view = data;
+        count = elementCount;
+        mapped = true;
+    }
+
+    bool IsMapped() const { return mapped; }
+
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T* data() const { return view; }
+    const T* begin() const { return view; }
+    const T* end() const { return view + count; }
+
+    // Writes through a mapped array fault, the mapping is read-only
+    const T& operator[](const std::size_t& i) const { return view[i]; }
+    T& operator[](const std::size_t& i) { return const_cast<T*>(view)[i]; }
+
+    // Building, only for arrays that own their elements
+    void push_back(const T& value) { storage.push_back(value); Sync(); }
+    void clear() { storage.clear(); mapped = false; Sync(); }
+    void resize(const std::size_t& n) { storage.resize(n); Sync(); }
+    void assign(const std::size_t& n, const T& value) { storage.assign(n, value); mapped = false; Sync(); }
+    void reserve(const std::size_t& n) { storage.reserve(n); Sync(); }
+
+private:
+    std::vector<T> storage;
+    const T* view = nullptr;
+    std::size_t count = 0;
+    bool mapped = false;
+
+    void Sync() {
+        view = storage.data();
+        count = storage.size();
+    }
+};
@@ -0,0 +1,665 @@
+#pragma once
+
+#ifdef PRISMATICA_HAVE_ZLIB
+    #include <zlib.h>
+#endif
+
+#define OUTPUT_HINT "[\e[0;34mOUTPUT\033[0m]\t"
+
+enum class ImageFormat {
+    PNG,
+    PPM,
+    PFM,  // linear 32 bit float
+    EXR   // linear half or float, uncompressed scanlines
+};
+
+bool ImageFormatFromPath(const std::string& path, ImageFormat& format) {
+    std::string extension = path.substr(path.find_last_of('.') + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    if (extension == "png") format = ImageFormat::PNG;
+    else if (extension == "ppm") format = ImageFormat::PPM;
+    else if (extension == "pfm") format = ImageFormat::PFM;
+    else if (extension == "exr") format = ImageFormat::EXR;
+    else return false;
+
+    return true;
+}
+
+// Linear formats take the film as is, the others the post-processed 8 bit image
+bool IsLinearFormat(const ImageFormat& format) {
+    return format == ImageFormat::PFM || format == ImageFormat::EXR;
+}
+
+class EncodeSettings {
+public:
+    int compressionLevel = PNG_COMPRESSION_LEVEL;
+    bool halfFloat = true;  // EXR channels as half instead of float
+};
+
+// Giesen, "float->half variants", round to nearest even
+std::uint16_t FloatToHalf(const float& value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    std::uint32_t sign = bits & 0x80000000u;
+    bits ^= sign;
+    std::uint16_t half;
+
+    if (bits >= 0x47800000u) {
+        half = bits > 0x7f800000u ? 0x7e00 : 0x7c00;  // NaN or too large for half
+    } else if (bits < 0x38800000u) {
+        // Subnormal or zero, adding 0.5 lets the FPU do the rounding shift
+        float shifted;
+        std::memcpy(&shifted, &bits, sizeof(shifted));
+        shifted += 0.5f;
+        std::memcpy(&bits, &shifted, sizeof(bits));
+        half = (std::uint16_t) (bits - 0x3f000000u);
+    } else {
+        std::uint32_t odd = (bits >> 13) & 1;
+        bits += ((std::uint32_t) (15 - 127) << 23) + 0xfff + odd;
+        half = (std::uint16_t) (bits >> 13);
+    }
+
+    return half | (std::uint16_t) (sign >> 16);
+}
+
+// Runs encode jobs on a background thread so the next band or frame renders meanwhile.
+// At most OUTPUT_QUEUE_DEPTH jobs wait, Submit blocks beyond that so finished images
+// can't pile up in memory when the disk is slower than the renderer.
+class OutputThread {
+public:
+    OutputThread() {
+        thread = std::thread(&OutputThread::Loop, this);
+    }
+
+    ~OutputThread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        wake.notify_all();
+        thread.join();
+    }
+
+    OutputThread(const OutputThread&) = delete;
+    OutputThread& operator=(const OutputThread&) = delete;
+
+    // False once any job has failed, the job is dropped then. If a job fails while this
+    // one is queued, dropped runs in its place.
+    bool Submit(std::function<bool()> job, std::function<void()> dropped = nullptr) {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [&]() { return jobs.size() < OUTPUT_QUEUE_DEPTH; });
+        if (!ok) return false;
+
+        jobs.push_back({std::move(job), std::move(dropped)});
+        wake.notify_all();
+        return true;
+    }
+
+    // Blocks until every submitted job is done
+    bool Wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [&]() { return jobs.empty() && !busy; });
+        return ok;
+    }
+
+    bool Ok() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return ok;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::deque<std::pair<std::function<bool()>, std::function<void()>>> jobs;
+    bool busy = false;
+    bool stopping = false;
+    bool ok = true;
+    std::thread thread;
+
+    void Loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true) {
+            wake.wait(lock, [&]() { return stopping || !jobs.empty(); });
+            if (jobs.empty()) return;
+
+            std::function<bool()> job = std::move(jobs.front().first);
+            std::function<void()> dropped = std::move(jobs.front().second);
+            jobs.pop_front();
+            busy = true;
+
+            // After a failure the remaining jobs are only drained
+            bool run = ok;
+            lock.unlock();
+            bool succeeded = !run || job();
+            if (!run && dropped) dropped();
+            lock.lock();
+
+            ok = ok && succeeded;
+            busy = false;
+            idle.notify_all();
+        }
+    }
+};
+
+// Display transform of one image row into 8 bit RGB. Every channel is transformed the
+// same way, so the row is processed as one flat array of floats.
+void PostProcessRow(const Film& film, const std::size_t& y, const DisplaySettings& display, unsigned char* rgb) {
+    static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "film rows are read as flat float arrays");
+
+    const float* linear = &film.mean[film.Index(0, y)].x;
+    const std::size_t count = 3 * film.width;
+
+    if (simdKernels.postProcessSpan) {
+        simdKernels.postProcessSpan(linear, rgb, count, 0, y, display);
+        return;
+    }
+
+    const float* lut = SrgbLut();
+    const float scale = std::exp2(display.exposure);
+
+    for (std::size_t i = 0; i < count; i++) {
+        float noise = display.dither ? InterleavedGradientNoise((float) i, (float) y) : 0.5f;
+        rgb[i] = DisplayValue(linear[i], noise, scale, display.toneMapper, lut);
+    }
+}
+
+// Display transform of the whole film on the pool, POSTPROCESS_ROWS rows per task.
+// rgb receives the rows top row first.
+void PostProcess(const Film& film, ThreadPool& pool, const DisplaySettings& display, unsigned char* rgb) {
+    std::size_t tasks = (film.height + POSTPROCESS_ROWS - 1) / POSTPROCESS_ROWS;
+
+    pool.Run(tasks, [&](std::size_t task, std::size_t) {
+        std::size_t last = std::min(film.height, (task + 1) * POSTPROCESS_ROWS);
+
+        for (std::size_t row = task * POSTPROCESS_ROWS; row < last; row++) {
+            PostProcessRow(film, film.y0 + film.height - 1 - row, display, rgb + 3 * film.width * row);
+        }
+    });
+}
+
+// Auxiliary outputs from the film's first-hit features
+enum class Aov {
+    Albedo,
+    Normal,
+    Depth
+};
+
+constexpr Aov AOVS[] = {Aov::Albedo, Aov::Normal, Aov::Depth};
+
+const char* AovName(const Aov& aov) {
+    switch (aov) {
+        case Aov::Normal: return "normal";
+        case Aov::Depth: return "depth";
+        default: return "albedo";
+    }
+}
+
+// Inserts the AOV name before the extension, render.png gives render.albedo.png
+std::string AovPath(const std::string& path, const Aov& aov) {
+    std::size_t dot = path.find_last_of('.');
+    std::size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return path + "." + AovName(aov);
+    return path.substr(0, dot) + "." + AovName(aov) + path.substr(dot);
+}
+
+// RGB rows of an AOV, top row first. Linear formats get the values as they are, the
+// depth in all three channels. For 8 bit formats they are brought into [0, 1]: the
+// albedo sRGB encoded, normals mapped from [-1, 1] and the depth as 1 / (1 + depth),
+// which needs no range and so works band by band.
+std::vector<float> AovRows(const Film& film, const Aov& aov, const bool& linear) {
+    std::vector<float> rows(3 * film.size());
+
+    for (std::size_t row = 0; row < film.height; row++) {
+        std::size_t y = film.y0 + film.height - 1 - row;
+
+        for (std::size_t x = 0; x < film.width; x++) {
+            std::size_t pixel = film.Index(x, y);
+            glm::vec3 value;
+
+            if (aov == Aov::Albedo) {
+                value = film.albedo[pixel];
+                if (!linear) value = LinearToSrgb(value);
+            } else if (aov == Aov::Normal) {
+                value = linear ? film.normal[pixel] : 0.5f * film.normal[pixel] + glm::vec3(0.5f);
+            } else {
+                float depth = film.depth[pixel];
+                value = glm::vec3(linear || depth <= 0.0f ? depth : 1.0f / (1.0f + depth));
+            }
+
+            std::memcpy(&rows[3 * (row * film.width + x)], &value, sizeof(value));
+        }
+    }
+
+    return rows;
+}
+
+std::uint32_t Crc32(std::uint32_t crc, const unsigned char* data, const std::size_t& size) {
+    static const std::array<std::uint32_t, 256> table = []() {
+        std::array<std::uint32_t, 256> entries{};
+        for (std::uint32_t i = 0; i < 256; i++) {
+            std::uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320U ^ (c >> 1) : c >> 1;
+            entries[i] = c;
+        }
+        return entries;
+    }();
+
+    crc = ~crc;
+    for (std::size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Writes an image row by row, top row first, without ever holding more than a row of it.
+// PNG rows are deflated with zlib when it is available and stored uncompressed otherwise.
+// PFM and EXR take linear float rows, PNG and PPM 8 bit ones.
+class ImageStreamWriter {
+public:
+    ImageStreamWriter() = default;
+    ImageStreamWriter(const ImageStreamWriter&) = delete;
+    ImageStreamWriter& operator=(const ImageStreamWriter&) = delete;
+
+    ~ImageStreamWriter() {
+#ifdef PRISMATICA_HAVE_ZLIB
+        if (deflating) deflateEnd(&stream);
+#endif
+    }
+
+    bool Open(const std::string& path, const ImageFormat& imageFormat, const std::size_t& imageWidth, const std::size_t& imageHeight, const EncodeSettings& encodeSettings = EncodeSettings{}) {
+        file.open(path, std::ios::binary);
+
+        if (!file) {
+            std::cerr << OUTPUT_HINT << "Could not open " << path << " for writing\n";
+            return false;
+        }
+
+        format = imageFormat;
+        encode = encodeSettings;
+        width = imageWidth;
+        height = imageHeight;
+        rowsWritten = 0;
+
+        if (format == ImageFormat::PPM) {
+            file << "P6\n" << width << ' ' << height << "\n255\n";
+            return Check();
+        }
+
+        // A negative scale marks little endian data
+        if (format == ImageFormat::PFM) {
+            file << "PF\n" << width << ' ' << height << "\n-1.0\n";
+            headerSize = (std::size_t) file.tellp();
+            linearRow.resize(4 * 3 * width);
+            return Check();
+        }
+
+        if (format == ImageFormat::EXR) return WriteExrHeader();
+
+        static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        file.write((const char*) signature, sizeof(signature));
+
+        unsigned char header[13];
+        PutBigEndian(header, (std::uint32_t) width);
+        PutBigEndian(header + 4, (std::uint32_t) height);
+        header[8] = 8;   // bit depth
+        header[9] = 2;   // truecolor
+        header[10] = 0;  // deflate
+        header[11] = 0;  // adaptive filtering
+        header[12] = 0;  // no interlacing
+        WriteChunk("IHDR", header, sizeof(header));
+
+        previousRow.assign(3 * width, 0);
+        filteredRow.resize(1 + 3 * width);
+        candidateRow.resize(1 + 3 * width);
+
+#ifdef PRISMATICA_HAVE_ZLIB
+        stream = z_stream{};
+        if (deflateInit(&stream, std::min(std::max(encode.compressionLevel, 0), 9)) != Z_OK) {
+            std::cerr << OUTPUT_HINT << "Could not initialize zlib\n";
+            return false;
+        }
+        deflating = true;
+        compressed.resize(1 << 16);
+#else
+        // zlib header for a stream of stored blocks
+        const unsigned char zlibHeader[2] = {0x78, 0x01};
+        pending.assign(zlibHeader, zlibHeader + 2);
+        adler = 1;
+#endif
+
+        return Check();
+    }
+
+    bool WriteRow(const unsigned char* rgb) {
+        if (IsLinearFormat(format)) {
+            std::cerr << OUTPUT_HINT << "Linear formats need float rows\n";
+            return false;
+        }
+
+        if (rowsWritten++ >= height) return false;
+
+        if (format == ImageFormat::PPM) {
+            file.write((const char*) rgb, 3 * width);
+            return Check();
+        }
+
+        FilterRow(rgb);
+        previousRow.assign(rgb, rgb + 3 * width);
+
+#ifdef PRISMATICA_HAVE_ZLIB
+        return Deflate(filteredRow.data(), filteredRow.size(), Z_NO_FLUSH);
+#else
+        Store(filteredRow.data(), filteredRow.size(), false);
+        return Check();
+#endif
+    }
+
+    bool WriteRow(const float* rgb) {
+        if (!IsLinearFormat(format)) {
+            std::cerr << OUTPUT_HINT << "8 bit formats need post-processed rows\n";
+            return false;
+        }
+
+        if (rowsWritten >= height) return false;
+        std::size_t row = rowsWritten++;
+
+        // PFM stores the bottom row first, its rows have a fixed size so seek there
+        if (format == ImageFormat::PFM) {
+            for (std::size_t i = 0; i < 3 * width; i++) PutLittleEndian(&linearRow[4 * i], FloatBits(rgb[i]));
+
+            file.seekp((std::streamoff) (headerSize + (height - 1 - row) * linearRow.size()));
+            file.write((const char*) linearRow.data(), linearRow.size());
+            return Check();
+        }
+
+        // EXR scanline block: y, data size, then the B, G and R channels one after another
+        const std::size_t channelBytes = encode.halfFloat ? 2 : 4;
+        unsigned char* out = linearRow.data();
+        PutLittleEndian(out, (std::uint32_t) row);
+        PutLittleEndian(out + 4, (std::uint32_t) (3 * width * channelBytes));
+        out += 8;
+
+        for (int channel = 2; channel >= 0; channel--) {
+            for (std::size_t x = 0; x < width; x++, out += channelBytes) {
+                float value = rgb[3 * x + channel];
+                if (encode.halfFloat) PutLittleEndian(out, FloatToHalf(value));
+                else PutLittleEndian(out, FloatBits(value));
+            }
+        }
+
+        file.write((const char*) linearRow.data(), linearRow.size());
+        return Check();
+    }
+
+    bool Close() {
+        if (rowsWritten != height) {
+            std::cerr << OUTPUT_HINT << "Image ended after " << rowsWritten << " of " << height << " rows\n";
+        }
+
+        if (format == ImageFormat::PNG) {
+#ifdef PRISMATICA_HAVE_ZLIB
+            if (!Deflate(nullptr, 0, Z_FINISH)) return false;
+            deflateEnd(&stream);
+            deflating = false;
+#else
+            Store(nullptr, 0, true);
+#endif
+            WriteChunk("IEND", nullptr, 0);
+        }
+
+        file.close();
+        return !file.fail();
+    }
+
+private:
+    std::ofstream file;
+    ImageFormat format = ImageFormat::PNG;
+    EncodeSettings encode{};
+    std::size_t width = 0, height = 0;
+    std::size_t rowsWritten = 0;
+    std::size_t headerSize = 0;
+    std::vector<unsigned char> linearRow;  // encoded PFM row or EXR scanline block
+
+    std::vector<unsigned char> previousRow;
+    std::vector<unsigned char> filteredRow;   // filter type byte followed by the row
+    std::vector<unsigned char> candidateRow;
+
+#ifdef PRISMATICA_HAVE_ZLIB
+    z_stream stream{};
+    bool deflating = false;
+    std::vector<unsigned char> compressed;
+#else
+    std::vector<unsigned char> pending;
+    std::uint32_t adler = 1;
+#endif
+
+    bool Check() {
+        if (file.fail()) std::cerr << OUTPUT_HINT << "Writing the image failed\n";
+        return !file.fail();
+    }
+
+    static void PutBigEndian(unsigned char* out, const std::uint32_t& value) {
+        out[0] = (unsigned char) (value >> 24);
+        out[1] = (unsigned char) (value >> 16);
+        out[2] = (unsigned char) (value >> 8);
+        out[3] = (unsigned char) value;
+    }
+
+    template <typename T>
+    static void PutLittleEndian(unsigned char* out, const T& value) {
+        for (std::size_t i = 0; i < sizeof(T); i++) out[i] = (unsigned char) ((std::uint64_t) value >> (8 * i));
+    }
+
+    static std::uint32_t FloatBits(const float& value) {
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    // Single part scanline file without compression. Every block has the same size, so
+    // the offset table is known up front and the rows can be streamed.
+    bool WriteExrHeader() {
+        std::vector<unsigned char> header;
+
+        auto Bytes = [&](const void* data, const std::size_t& size) {
+            header.insert(header.end(), (const unsigned char*) data, (const unsigned char*) data + size);
+        };
+        auto Int = [&](const std::uint32_t& value) {
+            unsigned char bytes[4];
+            PutLittleEndian(bytes, value);
+            Bytes(bytes, 4);
+        };
+        auto Attribute = [&](const char* name, const char* type, const std::uint32_t& size) {
+            Bytes(name, std::strlen(name) + 1);
+            Bytes(type, std::strlen(type) + 1);
+            Int(size);
+        };
+
+        const unsigned char magic[4] = {0x76, 0x2f, 0x31, 0x01};
+        Bytes(magic, 4);
+        Int(2);  // version 2, single part scanline
+
+        // Channels are listed in alphabetical order
+        Attribute("channels", "chlist", 3 * 18 + 1);
+        for (const char* channel : {"B", "G", "R"}) {
+            Bytes(channel, 2);
+            Int(encode.halfFloat ? 1 : 2);  // HALF or FLOAT
+            Int(0);                         // pLinear and reserved
+            Int(1);                         // x sampling
+            Int(1);                         // y sampling
+        }
+        header.push_back(0);
+
+        Attribute("compression", "compression", 1);
+        header.push_back(0);  // none
+
+        for (const char* window : {"dataWindow", "displayWindow"}) {
+            Attribute(window, "box2i", 16);
+            Int(0);
+            Int(0);
+            Int((std::uint32_t) width - 1);
+            Int((std::uint32_t) height - 1);
+        }
+
+        Attribute("lineOrder", "lineOrder", 1);
+        header.push_back(0);  // increasing y, top row first
+
+        Attribute("pixelAspectRatio", "float", 4);
+        Int(FloatBits(1.0f));
+
+        Attribute("screenWindowCenter", "v2f", 8);
+        Int(FloatBits(0.0f));
+        Int(FloatBits(0.0f));
+
+        Attribute("screenWindowWidth", "float", 4);
+        Int(FloatBits(1.0f));
+
+        header.push_back(0);  // end of the header
+
+        const std::size_t blockSize = 8 + 3 * width * (encode.halfFloat ? 2 : 4);
+        const std::uint64_t firstBlock = header.size() + 8 * height;
+
+        for (std::size_t y = 0; y < height; y++) {
+            unsigned char offset[8];
+            PutLittleEndian(offset, (std::uint64_t) (firstBlock + y * blockSize));
+            Bytes(offset, 8);
+        }
+
+        file.write((const char*) header.data(), header.size());
+        linearRow.resize(blockSize);
+        return Check();
+    }
+
+    void WriteChunk(const char* type, const unsigned char* data, const std::size_t& size) {
+        unsigned char length[4];
+        PutBigEndian(length, (std::uint32_t) size);
+        file.write((const char*) length, 4);
+        file.write(type, 4);
+        if (size > 0) file.write((const char*) data, size);
+
+        unsigned char crc[4];
+        PutBigEndian(crc, Crc32(Crc32(0, (const unsigned char*) type, 4), data, size));
+        file.write((const char*) crc, 4);
+    }
+
+    // Picks the filter with the smallest sum of absolute residuals, like libpng does.
+    // Stored blocks do not compress, so without zlib the row is left unfiltered.
+    void FilterRow(const unsigned char* row) {
+        filteredRow[0] = 0;
+        std::memcpy(filteredRow.data() + 1, row, 3 * width);
+
+#ifdef PRISMATICA_HAVE_ZLIB
+        // Level 0 only stores, filtering would not pay off
+        if (encode.compressionLevel <= 0) return;
+
+        auto Cost = [&](const std::vector<unsigned char>& candidate) {
+            std::size_t cost = 0;
+            for (std::size_t i = 1; i < candidate.size(); i++) cost += std::abs((int) (signed char) candidate[i]);
+            return cost;
+        };
+
+        std::size_t bestCost = Cost(filteredRow);
+        const unsigned char* up = previousRow.data();
+
+        for (unsigned char filter = 1; filter <= 4; filter++) {
+            candidateRow[0] = filter;
+
+            for (std::size_t i = 0; i < 3 * width; i++) {
+                int a = i >= 3 ? row[i - 3] : 0;
+                int b = up[i];
+                int c = i >= 3 ? up[i - 3] : 0;
+                int predictor;
+
+                switch (filter) {
+                    case 1: predictor = a; break;
+                    case 2: predictor = b; break;
+                    case 3: predictor = (a + b) / 2; break;
+                    default: {
+                        int p = a + b - c;
+                        int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                        predictor = pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+                        break;
+                    }
+                }
+
+                candidateRow[i + 1] = (unsigned char) (row[i] - predictor);
+            }
+
+            std::size_t cost = Cost(candidateRow);
+            if (cost < bestCost) {
+                bestCost = cost;
+                filteredRow.swap(candidateRow);
+            }
+        }
+#endif
+    }
+
+#ifdef PRISMATICA_HAVE_ZLIB
+    // Every filled output buffer becomes one IDAT chunk
+    bool Deflate(const unsigned char* data, const std::size_t& size, const int& flush) {
+        stream.next_in = (Bytef*) data;
+        stream.avail_in = (uInt) size;
+
+        int status;
+        do {
+            stream.next_out = compressed.data();
+            stream.avail_out = (uInt) compressed.size();
+            status = deflate(&stream, flush);
+
+            if (status == Z_STREAM_ERROR) {
+                std::cerr << OUTPUT_HINT << "zlib failed to compress the image\n";
+                return false;
+            }
+
+            std::size_t produced = compressed.size() - stream.avail_out;
+            if (produced > 0) WriteChunk("IDAT", compressed.data(), produced);
+        } while (stream.avail_out == 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+
+        return Check();
+    }
+#else
+    // Deflate stored blocks hold at most 65535 bytes each
+    void Store(const unsigned char* data, const std::size_t& size, const bool& last) {
+        const std::size_t MAX_BLOCK = 65535;
+
+        std::uint32_t s1 = adler & 0xffff, s2 = adler >> 16;
+        for (std::size_t i = 0; i < size; i++) {
+            s1 = (s1 + data[i]) % 65521;
+            s2 = (s2 + s1) % 65521;
+        }
+        adler = (s2 << 16) | s1;
+
+        std::vector<unsigned char> block;
+        std::size_t consumed = 0;
+
+        while (consumed < size || last) {
+            std::size_t length = std::min(MAX_BLOCK, size - consumed);
+            bool final = last && consumed + length == size;
+
+            block.clear();
+            block.push_back(final ? 1 : 0);
+            block.push_back((unsigned char) length);
+            block.push_back((unsigned char) (length >> 8));
+            block.push_back((unsigned char) ~length);
+            block.push_back((unsigned char) (~length >> 8));
+            block.insert(block.end(), data + consumed, data + consumed + length);
+            consumed += length;
+
+            if (final) {
+                unsigned char checksum[4];
+                PutBigEndian(checksum, adler);
+                block.insert(block.end(), checksum, checksum + 4);
+            }
+
+            pending.insert(pending.end(), block.begin(), block.end());
+            if (final) break;
+        }
+
+        WriteChunk("IDAT", pending.data(), pending.size());
+        pending.clear();
+    }
+#endif
+};
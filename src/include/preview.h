@@ -0,0 +1,598 @@
+#pragma once
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <arpa/inet.h>
+    #include <cerrno>
+    #include <csignal>
+    #include <netinet/in.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+    #define PRISMATICA_HAVE_SOCKETS 1
+#else
+    #define PRISMATICA_HAVE_SOCKETS 0
+#endif
+
+#define PREVIEW_HINT "[\e[0;32mPREVIEW\033[0m]\t"
+
+// Interactive preview. A view is first traced at 1/16 and 1/4 of the pixels with one
+// sample each, then at full resolution in passes that accumulate into one film until
+// the sample count is reached. Every step is published to a sink, which is either
+//   file:<path>              a .png, .ppm or .jpg that is rewritten in place
+//   stdout                   a stream of binary PPM frames, e.g. for ffplay -f image2pipe
+//   http://127.0.0.1:<port>  an MJPEG stream (multipart/x-mixed-replace) for a browser
+// A camera update from the control source cancels the tiles in flight and starts over.
+class PreviewSettings {
+public:
+    std::string sink;
+    std::string control;  // control file, - for stdin, empty for a single view
+    double interval = PREVIEW_INTERVAL_MS / 1000.0;  // seconds
+    int jpegQuality = PREVIEW_JPEG_QUALITY;
+};
+
+// Resolutions of the first steps, as divisors of the width and height
+constexpr std::size_t PREVIEW_SCALES[] = {4, 2};
+
+// Encodes 8 bit RGB, top row first. stb is compiled into the executable, so it hands one in.
+using JpegEncoder = std::function<bool(const unsigned char* rgb, const std::size_t& width, const std::size_t& height, const int& quality, std::vector<unsigned char>& jpeg)>;
+
+class PreviewSink {
+public:
+    PreviewSink() = default;
+    PreviewSink(const PreviewSink&) = delete;
+    PreviewSink& operator=(const PreviewSink&) = delete;
+
+    ~PreviewSink() {
+        Close();
+    }
+
+    bool Open(const PreviewSettings& settings, const JpegEncoder& jpegEncoder) {
+        const std::string filePrefix = "file:";
+        const std::string httpPrefix = "http://";
+
+        encoder = jpegEncoder;
+        quality = settings.jpegQuality;
+
+#if PRISMATICA_HAVE_SOCKETS
+        // A viewer that goes away must not kill the renderer, the write fails instead
+        std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+        if (settings.sink == "stdout") {
+            kind = Kind::Stdout;
+            return true;
+        }
+
+        if (settings.sink.compare(0, filePrefix.size(), filePrefix) == 0) {
+            kind = Kind::File;
+            path = settings.sink.substr(filePrefix.size());
+
+            std::string extension = path.substr(path.find_last_of('.') + 1);
+            std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+            jpegFile = extension == "jpg" || extension == "jpeg";
+
+            if (!jpegFile && (!ImageFormatFromPath(path, format) || IsLinearFormat(format))) {
+                std::cerr << PREVIEW_HINT << "Unknown preview format " << path << ", use .png, .ppm or .jpg\n";
+                return false;
+            }
+
+            if (jpegFile && !encoder) {
+                std::cerr << PREVIEW_HINT << "Built without a JPEG encoder, use .png or .ppm\n";
+                return false;
+            }
+
+            return true;
+        }
+
+        if (settings.sink.compare(0, httpPrefix.size(), httpPrefix) == 0) {
+            kind = Kind::Http;
+            return Listen(settings.sink.substr(httpPrefix.size()));
+        }
+
+        std::cerr << PREVIEW_HINT << "Unknown preview sink " << settings.sink << ", use file:<path>, stdout or http://127.0.0.1:<port>\n";
+        return false;
+    }
+
+    // Publishes one image, rgb rows top row first
+    bool Publish(const unsigned char* rgb, const std::size_t& width, const std::size_t& height) {
+        if (kind == Kind::Stdout) {
+            std::fprintf(stdout, "P6\n%zu %zu\n255\n", width, height);
+            bool ok = std::fwrite(rgb, 3, width * height, stdout) == width * height && std::fflush(stdout) == 0;
+            if (!ok) std::cerr << PREVIEW_HINT << "Could not write to stdout\n";
+            return ok;
+        }
+
+        if (kind == Kind::File) return WriteFile(rgb, width, height);
+
+#if PRISMATICA_HAVE_SOCKETS
+        if (kind == Kind::Http) {
+            std::vector<unsigned char> jpeg;
+            if (!encoder(rgb, width, height, quality, jpeg)) {
+                std::cerr << PREVIEW_HINT << "Could not encode a frame\n";
+                return false;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            frame = std::make_shared<const std::vector<unsigned char>>(std::move(jpeg));
+            frameId++;
+            changed.notify_all();
+            return true;
+        }
+#endif
+
+        return false;
+    }
+
+    // Viewers of the stream get the last frame before they are disconnected
+    void Close() {
+#if PRISMATICA_HAVE_SOCKETS
+        if (listenFd < 0) return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        changed.notify_all();
+        acceptThread.join();
+        for (Client& client : clients) client.thread.join();
+        clients.clear();
+
+        close(listenFd);
+        listenFd = -1;
+#endif
+    }
+
+private:
+    enum class Kind {
+        File,
+        Stdout,
+        Http
+    };
+
+    Kind kind = Kind::File;
+    JpegEncoder encoder;
+    int quality = PREVIEW_JPEG_QUALITY;
+
+    std::string path;
+    ImageFormat format = ImageFormat::PNG;
+    bool jpegFile = false;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::shared_ptr<const std::vector<unsigned char>> frame;
+    std::uint64_t frameId = 0;
+    bool stopping = false;
+    int listenFd = -1;
+    std::thread acceptThread;
+
+    // One thread per viewer. Only the accept thread adds and removes entries.
+    class Client {
+    public:
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+
+    std::list<Client> clients;
+
+    // Viewers that poll the file never see it half written, it is replaced by a rename
+    bool WriteFile(const unsigned char* rgb, const std::size_t& width, const std::size_t& height) {
+        const std::string temporary = path + ".tmp";
+        bool ok;
+
+        if (jpegFile) {
+            std::vector<unsigned char> jpeg;
+            std::ofstream file(temporary, std::ios::binary);
+            ok = encoder(rgb, width, height, quality, jpeg) && file.write((const char*) jpeg.data(), (std::streamsize) jpeg.size());
+        } else {
+            EncodeSettings encode{};
+            encode.compressionLevel = PREVIEW_PNG_LEVEL;
+
+            ImageStreamWriter writer;
+            ok = writer.Open(temporary, format, width, height, encode);
+            for (std::size_t row = 0; row < height && ok; row++) ok = writer.WriteRow(rgb + 3 * width * row);
+            ok = ok && writer.Close();
+        }
+
+        if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+            std::cerr << PREVIEW_HINT << "Could not write " << path << '\n';
+            return false;
+        }
+
+        return true;
+    }
+
+#if PRISMATICA_HAVE_SOCKETS
+    // address is host:port, only IPv4 literals and localhost are accepted
+    bool Listen(const std::string& address) {
+        std::size_t colon = address.find(':');
+        std::string host = address.substr(0, colon);
+        int port = colon == std::string::npos ? 0 : std::atoi(address.c_str() + colon + 1);
+        if (host == "localhost") host = "127.0.0.1";
+
+        sockaddr_in socketAddress{};
+        socketAddress.sin_family = AF_INET;
+        socketAddress.sin_port = htons((std::uint16_t) port);
+
+        if (port <= 0 || port > 65535 || inet_pton(AF_INET, host.c_str(), &socketAddress.sin_addr) != 1) {
+            std::cerr << PREVIEW_HINT << "Expected http://<ipv4 address>:<port>, got http://" << address << '\n';
+            return false;
+        }
+
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+
+        if (listenFd < 0 || setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0
+            || bind(listenFd, (const sockaddr*) &socketAddress, sizeof(socketAddress)) != 0 || listen(listenFd, 8) != 0) {
+            std::cerr << PREVIEW_HINT << "Could not listen on " << host << ":" << port << ": " << std::strerror(errno) << '\n';
+            if (listenFd >= 0) close(listenFd);
+            listenFd = -1;
+            return false;
+        }
+
+        acceptThread = std::thread(&PreviewSink::AcceptLoop, this);
+        std::cout << PREVIEW_HINT << "Streaming MJPEG on http://" << host << ":" << port << "/\n";
+        return true;
+    }
+
+    void AcceptLoop() {
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping) return;
+            }
+
+            // Viewers that went away are joined here, reconnecting ones don't pile up threads
+            for (auto i = clients.begin(); i != clients.end(); ) {
+                if (!i->done) {
+                    ++i;
+                    continue;
+                }
+
+                i->thread.join();
+                i = clients.erase(i);
+            }
+
+            pollfd listening{listenFd, POLLIN, 0};
+            if (poll(&listening, 1, PREVIEW_POLL_MS) <= 0) continue;
+
+            int client = accept(listenFd, nullptr, nullptr);
+            if (client < 0) continue;
+
+            // A stalled viewer gets dropped instead of holding up Close()
+            timeval timeout{1, 0};
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            clients.emplace_back();
+            clients.back().thread = std::thread(&PreviewSink::ServeClient, this, client, std::ref(clients.back().done));
+        }
+    }
+
+    static bool SendAll(const int& fd, const void* data, const std::size_t& size) {
+        const char* bytes = (const char*) data;
+
+        for (std::size_t sent = 0; sent < size; ) {
+            ssize_t count = send(fd, bytes + sent, size - sent, 0);
+            if (count <= 0) return false;
+            sent += (std::size_t) count;
+        }
+
+        return true;
+    }
+
+    // A viewer that disconnected shows up as a readable socket with nothing left to read
+    static bool Connected(const int& fd) {
+        pollfd peer{fd, POLLIN, 0};
+        if (poll(&peer, 1, 0) <= 0) return true;
+        if (peer.revents & (POLLHUP | POLLERR)) return false;
+
+        char byte;
+        return recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+    }
+
+    // Every path gets the stream, so the request is read and ignored. Frames published
+    // while one is being sent are skipped, a slow viewer only ever gets the latest.
+    void ServeClient(int fd, std::atomic<bool>& done) {
+        const std::string boundary = "prismaticaframe";
+        char request[1024];
+        pollfd reading{fd, POLLIN, 0};
+        if (poll(&reading, 1, 1000) > 0) recv(fd, request, sizeof(request), 0);
+
+        std::string header = "HTTP/1.0 200 OK\r\nCache-Control: no-cache\r\nConnection: close\r\n"
+                             "Content-Type: multipart/x-mixed-replace; boundary=" + boundary + "\r\n\r\n";
+        bool ok = SendAll(fd, header.data(), header.size());
+        std::uint64_t sentId = 0;
+
+        while (ok) {
+            std::shared_ptr<const std::vector<unsigned char>> jpeg;
+
+            // While the view is idle no frames come, so the connection is checked meanwhile
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (!changed.wait_for(lock, std::chrono::milliseconds(PREVIEW_POLL_MS), [&]() { return stopping || frameId != sentId; })) {
+                    lock.unlock();
+                    ok = Connected(fd);
+                    continue;
+                }
+
+                if (frameId == sentId) break;
+                jpeg = frame;
+                sentId = frameId;
+            }
+
+            std::string part = "--" + boundary + "\r\nContent-Type: image/jpeg\r\nContent-Length: " + std::to_string(jpeg->size()) + "\r\n\r\n";
+            ok = SendAll(fd, part.data(), part.size()) && SendAll(fd, jpeg->data(), jpeg->size()) && SendAll(fd, "\r\n", 2);
+        }
+
+        close(fd);
+        done = true;
+    }
+#else
+    bool Listen(const std::string& address) {
+        std::cerr << PREVIEW_HINT << "The MJPEG stream needs POSIX sockets, use file:<path> or stdout\n";
+        return false;
+    }
+#endif
+};
+
+// Camera updates for the preview, one statement per line:
+//   camera <eye xyz> <target xyz> [fov degrees]
+//   fov <degrees>
+//   quit
+// Lines come from stdin (-) or from a file that is polled and re-read as a whole when
+// its contents change, so writers should replace it by a rename. Every update sets
+// cancel, which stops the tiles in flight.
+class PreviewControl {
+public:
+    PreviewControl() : state(std::make_shared<State>()) {}
+    PreviewControl(const PreviewControl&) = delete;
+    PreviewControl& operator=(const PreviewControl&) = delete;
+
+    ~PreviewControl() {
+        Stop();
+    }
+
+    // The contents of a control file apply right away
+    bool Start(const std::string& source, const Camera& camera) {
+        state->camera = camera;
+
+        if (source == "-") {
+            // A blocking read can't be interrupted, so the thread is left to the process
+            // and only holds on to the shared state
+            std::thread([state = state]() {
+                std::string line;
+                while (std::getline(std::cin, line)) Apply(*state, line, "stdin");
+
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->ended = true;
+                state->changed.notify_all();
+            }).detach();
+            return true;
+        }
+
+        std::string contents;
+        if (!ReadFile(source, contents)) {
+            std::cerr << PREVIEW_HINT << "Could not open " << source << '\n';
+            return false;
+        }
+
+        ApplyAll(*state, contents, source);
+        poller = std::thread([state = state, source, contents]() mutable {
+            std::string current;
+
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(state->mutex);
+                    if (state->changed.wait_for(lock, std::chrono::milliseconds(PREVIEW_POLL_MS), [&]() { return state->stopping; })) return;
+                }
+
+                if (ReadFile(source, current) && current != contents) {
+                    contents = current;
+                    ApplyAll(*state, contents, source);
+                }
+            }
+        });
+
+        return true;
+    }
+
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->stopping = true;
+        }
+
+        state->changed.notify_all();
+        if (poller.joinable()) poller.join();
+    }
+
+    const std::atomic<bool>* Cancel() const {
+        return &state->cancel;
+    }
+
+    // The latest camera and its version, clears cancel
+    std::uint64_t Current(Camera& camera) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->cancel = false;
+        camera.position = state->camera.position;
+        camera.orientation = state->camera.orientation;
+        camera.fov = state->camera.fov;
+        return state->version;
+    }
+
+    bool Quit() {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        return state->quit;
+    }
+
+    // Blocks until the camera moves past version. False on quit or when stdin ends.
+    bool WaitForChange(const std::uint64_t& version) {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->changed.wait(lock, [&]() { return state->quit || state->ended || state->version != version; });
+        return !state->quit && state->version != version;
+    }
+
+private:
+    class State {
+    public:
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::atomic<bool> cancel{false};
+        Camera camera;
+        std::uint64_t version = 0;
+        bool quit = false;
+        bool ended = false;
+        bool stopping = false;
+    };
+
+    std::shared_ptr<State> state;
+    std::thread poller;
+
+    static bool ReadFile(const std::string& path, std::string& contents) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+
+        std::ostringstream buffer;
+        buffer << file.rdbuf();
+        contents = buffer.str();
+        return true;
+    }
+
+    static void ApplyAll(State& state, const std::string& contents, const std::string& source) {
+        std::istringstream lines(contents);
+        std::string line;
+        while (std::getline(lines, line)) Apply(state, line, source);
+    }
+
+    // Malformed lines are reported and skipped, the preview keeps the last good camera
+    static void Apply(State& state, std::string line, const std::string& source) {
+        std::size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+
+        std::istringstream stream(line);
+        std::string keyword;
+        if (!(stream >> keyword)) return;
+
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        if (keyword == "camera") {
+            glm::vec3 eye, target;
+            if (!(stream >> eye.x >> eye.y >> eye.z >> target.x >> target.y >> target.z)) {
+                std::cerr << PREVIEW_HINT << source << ": camera needs an eye and a target\n";
+                return;
+            }
+
+            if (!state.camera.LookAt(eye, target)) {
+                std::cerr << PREVIEW_HINT << source << ": camera needs a target apart from the eye\n";
+                return;
+            }
+
+            float degrees;
+            if (stream >> degrees) state.camera.fov = glm::radians(degrees);
+        } else if (keyword == "fov") {
+            float degrees;
+            if (!(stream >> degrees)) {
+                std::cerr << PREVIEW_HINT << source << ": fov needs an angle in degrees\n";
+                return;
+            }
+
+            state.camera.fov = glm::radians(degrees);
+        } else if (keyword == "quit") {
+            state.quit = true;
+        } else {
+            std::cerr << PREVIEW_HINT << source << ": unknown statement " << keyword << '\n';
+            return;
+        }
+
+        if (!state.quit) state.version++;
+        state.cancel = true;
+        state.changed.notify_all();
+    }
+};
+
+// Display transform of the film, scaled up to width x height by repeating pixels
+std::vector<unsigned char> PreviewImage(const Film& film, ThreadPool& pool, const DisplaySettings& display, const std::size_t& width, const std::size_t& height) {
+    std::vector<unsigned char> rgb(3 * film.width * film.height);
+    PostProcess(film, pool, display, rgb.data());
+    if (film.width == width && film.height == height) return rgb;
+
+    std::vector<unsigned char> scaled(3 * width * height);
+    for (std::size_t y = 0; y < height; y++) {
+        const unsigned char* row = &rgb[3 * film.width * (y * film.height / height)];
+        for (std::size_t x = 0; x < width; x++) std::memcpy(&scaled[3 * (y * width + x)], row + 3 * (x * film.width / width), 3);
+    }
+
+    return scaled;
+}
+
+// Runs the preview of settings.camera, or of the control's camera, until the sample
+// count is reached. With a control source it then waits for the next camera and only
+// returns on quit or when stdin ends. False if the sink fails.
+bool RunPreview(const Scene& scene, ThreadPool& pool, const RenderSettings& settings, const std::size_t& tileSize, const DisplaySettings& display,
+                const PreviewSettings& preview, PreviewSink& sink, PreviewControl* control) {
+    using Clock = std::chrono::steady_clock;
+    const std::size_t width = settings.camera.width, height = settings.camera.height;
+
+    RenderSettings viewSettings = settings;
+    viewSettings.targetError = 0.0f;
+    viewSettings.timeBudget = 0.0;
+    viewSettings.features = false;
+    viewSettings.cancel = control ? control->Cancel() : nullptr;
+
+    auto Cancelled = [&]() { return control && control->Cancel()->load(); };
+    auto Milliseconds = [](const Clock::time_point& since) { return std::chrono::duration<double, std::milli>(Clock::now() - since).count(); };
+
+    while (true) {
+        Camera camera = settings.camera;
+        std::uint64_t version = control ? control->Current(camera) : 0;
+        const Clock::time_point start = Clock::now();
+
+        // Coarse steps, one sample per pixel each
+        for (const std::size_t& scale : PREVIEW_SCALES) {
+            if (Cancelled()) break;
+
+            RenderSettings coarse = viewSettings;
+            coarse.camera = camera;
+            coarse.camera.width = std::max<std::size_t>(1, width / scale);
+            coarse.camera.height = std::max<std::size_t>(1, height / scale);
+            coarse.samplesPerPixel = 1;
+
+            Film film(coarse.camera.width, coarse.camera.height);
+            RenderProgressive(scene, film, MakeTiles(film.width, film.height, tileSize), pool, coarse);
+            if (Cancelled()) break;
+
+            if (!sink.Publish(PreviewImage(film, pool, display, width, height).data(), width, height)) return false;
+            std::cout << PREVIEW_HINT << "1/" << scale * scale << " resolution after " << Milliseconds(start) << "ms\n";
+        }
+
+        // Full resolution passes into one film. A pass grows while it takes less than
+        // half the publish interval, so short passes don't cost a publish each.
+        Film film(width, height);
+        const std::vector<Tile> tiles = MakeTiles(width, height, tileSize);
+        std::uint32_t samples = 0, passSamples = 1;
+        Clock::time_point published = Clock::now();
+
+        while (samples < settings.samplesPerPixel && !Cancelled()) {
+            RenderSettings pass = viewSettings;
+            pass.camera = camera;
+            pass.firstSample = samples;
+            pass.samplesPerPixel = samples + std::min(passSamples, settings.samplesPerPixel - samples);
+
+            const Clock::time_point passStart = Clock::now();
+            RenderProgressive(scene, film, tiles, pool, pass);
+            if (Cancelled()) break;
+
+            samples = pass.samplesPerPixel;
+            if (Milliseconds(passStart) < 500.0 * preview.interval) passSamples *= 2;
+
+            if (samples == settings.samplesPerPixel || Milliseconds(published) >= 1000.0 * preview.interval) {
+                if (!sink.Publish(PreviewImage(film, pool, display, width, height).data(), width, height)) return false;
+                published = Clock::now();
+            }
+        }
+
+        if (!Cancelled()) std::cout << PREVIEW_HINT << samples << " spp after " << Milliseconds(start) << "ms\n";
+
+        if (!control || control->Quit()) return true;
+        if (!Cancelled() && !control->WaitForChange(version)) return true;
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+// Everything a Prismatica translation unit needs. The renderer is header-only, every
+// executable is a single translation unit that includes this once.
+
+#include <iostream>
+#include <cmath>
+#include <array>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <deque>
+#include <list>
+#include <condition_variable>
+#include <map>
+#include <set>
+#include <memory>
+
+#ifdef __linux__
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+// GLM since I don't want to implement MAD myself lol suck it arduino
+#define GLM_FORCE_INTRINSICS
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "constants.h"
+#include "utils.h"
+#include "instrumentation.h"
+#include "mappedarray.h"
+#include "bvh.h"
+#include "scene.h"
+#include "scenecache.h"
+#include "atrous.h"
+#include "simd.h"
+#include "intersections.h"
+#include "lights.h"
+#include "bsdf.h"
+#include "threadpool.h"
+#include "sampler.h"
+#include "film.h"
+#include "denoise.h"
+#include "renderer.h"
+#include "wavefront.h"
+#include "animation.h"
+#include "output.h"
+#include "preview.h"
+#include "publish.h"
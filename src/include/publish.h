@@ -0,0 +1,98 @@
+#pragma once
+
+#ifdef MQTT_BENCHMARK_MODE
+    #include <mqtt/client.h>
+#endif
+
+// Where render times and benchmark results are published to. The URL is either
+//   file:<path>          appends "<topic> <payload>" lines to a file, a stand-in for a
+//                        broker that works offline and in CI
+//   tcp://host:port      an MQTT broker, needs a build with -DBUILD_MQTT=TRUE
+// Credentials are taken from PRISMATICA_MQTT_USER and PRISMATICA_MQTT_PASSWORD so they
+// never end up in the source or on the command line.
+class PublishSettings {
+public:
+    std::string url;
+    std::string topic = "prismatica/rendertime";
+    std::string clientId = "prismatica";
+    int qos = 0;
+
+    bool Enabled() const { return !url.empty(); }
+};
+
+#ifdef MQTT_BENCHMARK_MODE
+    class callback : public virtual mqtt::callback {
+        void connected(const std::string& cause) override {
+            std::cout << MQTT_HINT << "Connection successful" << std::endl;
+        }
+
+        void connection_lost(const std::string& cause) override {
+            std::cout << "\nConnection lost" << std::endl;
+            if (!cause.empty())
+                std::cout << "\tcause: " << cause << std::endl;
+        }
+
+        void message_arrived(mqtt::const_message_ptr msg) override {
+            std::cout << "\nMessage arrived" << std::endl;
+            std::cout << "topic: '" << msg->get_topic() << "'" << std::endl;
+            std::cout << "payload: '" << msg->to_string() << "'" << std::endl;
+        }
+
+        void delivery_complete(mqtt::delivery_token_ptr token) override {}
+    };
+#endif
+
+bool Publish(const PublishSettings& settings, const std::string& payload) {
+    const std::string filePrefix = "file:";
+
+    if (settings.url.compare(0, filePrefix.size(), filePrefix) == 0) {
+        std::string path = settings.url.substr(filePrefix.size());
+        std::ofstream file(path, std::ios::app);
+        file << settings.topic << ' ' << payload << '\n';
+
+        if (!file) {
+            std::cerr << MQTT_HINT << "Could not append to " << path << '\n';
+            return false;
+        }
+
+        std::cout << MQTT_HINT << "Appended to " << path << '\n';
+        return true;
+    }
+
+#ifdef MQTT_BENCHMARK_MODE
+    mqtt::async_client client(settings.url, settings.clientId);
+    callback cb;
+    client.set_callback(cb);
+
+    mqtt::connect_options connOpts;
+    connOpts.set_clean_session(true);
+
+    if (const char* user = std::getenv("PRISMATICA_MQTT_USER")) connOpts.set_user_name(user);
+    if (const char* password = std::getenv("PRISMATICA_MQTT_PASSWORD")) connOpts.set_password(password);
+
+    try {
+        std::cout << MQTT_HINT << "Connecting to " << settings.url << std::endl;
+        client.connect(connOpts)->wait();
+
+        mqtt::message_ptr pubmsg = mqtt::make_message(settings.topic, payload);
+        pubmsg->set_qos(settings.qos);
+        bool delivered = client.publish(pubmsg)->wait_for(std::chrono::seconds(10));
+
+        client.disconnect()->wait();
+        std::cout << MQTT_HINT << "Disconnected" << std::endl;
+
+        if (!delivered) {
+            std::cerr << MQTT_HINT << "Timed out publishing to " << settings.topic << std::endl;
+            return false;
+        }
+    } catch (const mqtt::exception& exc) {
+        std::cerr << MQTT_HINT << "Error: " << exc.what() << std::endl;
+        return false;
+    }
+
+    return true;
+#else
+    std::cerr << MQTT_HINT << "Built without MQTT support, configure with -DBUILD_MQTT=TRUE or publish to file:<path>\n";
+    return false;
+#endif
+}
@@ -1,93 +1,467 @@
 #pragma once
 
-glm::vec3 CalculatePointLightContribution(const glm::vec3& illuminance, const glm::vec3& worldPos, const glm::vec3& pointLightPos, const glm::vec3& normal) {
-    glm::vec3 rayDirection = glm::normalize(pointLightPos - worldPos);
-    
-    float nDotL = glm::dot(normal, rayDirection);
-          nDotL = glm::clamp(nDotL, 0.0f, 1.0f);
-    float attenuation = 1.0f / std::pow(glm::distance(worldPos, pointLightPos), 2.0f);
+// Cylindrical projection: the horizontal angle grows linearly across the image
+class Camera {
+public:
+    std::size_t width = VIEWPORT_WIDTH;
+    std::size_t height = VIEWPORT_HEIGHT;
+    glm::vec3 position = glm::vec3(0.0f, 0.0f, 4.0f);
+    glm::mat3 orientation = glm::mat3(1.0f);  // camera to world, the camera looks down -z
+    float fov = 1.0f;                         // horizontal, in radians
 
-    HitData hitData{};
+    // Up is +y unless the view is nearly vertical, then +z. False if eye and target
+    // coincide, which gives no direction, the camera is left as it is then.
+    bool LookAt(const glm::vec3& eye, const glm::vec3& target) {
+        glm::vec3 view = target - eye;
+        if (glm::dot(view, view) <= 1e-12f) return false;
 
-    // Shadow ray
-    RayTraceScene(hitData, worldPos + normal * glm::vec3(0.001f), rayDirection);
+        glm::vec3 up = std::abs(glm::normalize(view).y) > 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        position = eye;
+        orientation = glm::transpose(glm::mat3(glm::lookAt(eye, target, up)));
+        return true;
+    }
+};
 
-    return illuminance * nDotL * attenuation * (float) !hitData.rayHit;
+void GenerateCameraRay(const Camera& camera, const std::size_t& x, const std::size_t& y, glm::vec3& rayOrigin, glm::vec3& rayDirWorld) {
+    glm::vec2 nCoord = glm::vec2{(float) x / camera.width, (float) y / camera.height};
+    glm::vec2 screenPos = nCoord * glm::vec2(2.0f) - glm::vec2(1.0f);
+    float halfFov = camera.fov * 0.5f;
+    glm::vec3 rayTarget = glm::vec3(std::sin(screenPos.x * halfFov), screenPos.y * halfFov * ((float) camera.height / (float) camera.width), -std::cos(screenPos.x * halfFov));
+    glm::vec3 rayDir = normalize(rayTarget);
+    rayDirWorld = camera.orientation * rayDir;
+    rayOrigin = camera.position;
 }
 
-glm::vec3 Render(const std::size_t& x, const std::size_t& y, const glm::mat4& viewMatrix, const std::size_t& sample) {
-    glm::vec3 sceneColor{0.0f};
+enum class Integrator {
+    Megakernel,  // one path at a time, start to end, see Render()
+    Wavefront    // all paths of a tile one bounce at a time, see wavefront.h
+};
 
-    glm::vec2 nCoord = glm::vec2{(float) x / VIEWPORT_WIDTH, (float) y / VIEWPORT_HEIGHT};
-    glm::vec2 screenPos = nCoord * glm::vec2(2.0f) - glm::vec2(1.0f);
-    glm::vec3 rayTarget = glm::vec3(std::sin(screenPos.x * 0.5f), screenPos.y * 0.5f * ((float) VIEWPORT_HEIGHT / (float) VIEWPORT_WIDTH), -std::cos(screenPos.x * 0.5f));
-    glm::vec3 rayDir = normalize(rayTarget);
-    glm::vec3 rayDirWorld = glm::mat3(viewMatrix) * rayDir;
-    glm::vec3 rayOrigin = glm::vec3(0.0f, 0.0f, 4.0f);
+const char* IntegratorName(const Integrator& integrator) {
+    return integrator == Integrator::Megakernel ? "megakernel" : "wavefront";
+}
+
+bool ParseIntegrator(const std::string& name, Integrator& integrator) {
+    for (Integrator candidate : {Integrator::Megakernel, Integrator::Wavefront}) {
+        if (name == IntegratorName(candidate)) {
+            integrator = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+class RenderSettings {
+public:
+    Camera camera{};
+    Sampler sampler{};
+    Integrator integrator = Integrator::Megakernel;
+    int maxDepth = MAX_DEPTH;
+    int rouletteDepth = ROULETTE_DEPTH;
+    bool features = false;  // keep first-hit features in the film, see Film::EnableFeatures()
+
+    // Progressive rendering, see RenderProgressive()
+    std::uint32_t samplesPerPixel = SAMPLES;  // upper bound per pixel
+    std::uint32_t firstSample = 0;            // continues a film that already holds this many samples
+    std::uint32_t passSamples = ADAPTIVE_PASS_SAMPLES;
+    std::uint32_t minSamples = ADAPTIVE_MIN_SAMPLES;
+    float targetError = 0.0f;  // relative standard error, 0 renders every pixel to samplesPerPixel
+    double timeBudget = 0.0;   // seconds, 0 means unlimited
+    const std::atomic<bool>* cancel = nullptr;  // no new tiles start once it is set
+};
+
+// Everything a path carries from one vertex to the next
+class PathState {
+public:
+    glm::vec3 color{0.0f};
+    glm::vec3 throughput{1.0f};
+    glm::vec3 origin{0.0f};     // of the next ray
+    glm::vec3 direction{0.0f};  // of the ray that found the current hit, then of the next one
+    glm::vec3 previousPos{0.0f};
+    float bsdfPdf = 0.0f;
+    bool specularBounce = true;  // the camera ray sees emitters directly, no MIS
+};
+
+// Next-event estimation at a vertex, contributes if nothing lies between origin and target
+class ShadowRay {
+public:
+    glm::vec3 origin;
+    glm::vec3 target;
+    glm::vec3 contribution;  // already weighted by the path throughput
+    bool traced = false;
+};
+
+// One vertex of a path, shared by both integrators. Adds the emission of an emitter that
+// was hit, otherwise samples a light into shadow and the next direction into path.
+// Returns false once the path ends; the shadow ray still has to be traced in that case.
+// Diffuse and rough metal vertices combine the emitter sample and the BSDF sample with
+// the power heuristic, mirrors and dielectrics are followed as delta bounces.
+bool ShadeVertex(const Scene& scene, const HitData& hit, const int& depth, const RenderSettings& settings, Sampler& sampler, PathState& path, ShadowRay& shadow) {
+    const Material& material = scene.materials[hit.material];
+
+    PROFILE_COUNT(material.isEmissive ? ProfileCounter::HitsEmissive
+                  : material.isMetal ? ProfileCounter::HitsMetal
+                  : material.isRefractive ? ProfileCounter::HitsRefractive : ProfileCounter::HitsDiffuse);
+
+    if (material.isEmissive) {
+        float weight = path.specularBounce ? 1.0f : PowerHeuristic(path.bsdfPdf, EmitterPdf(scene, hit.ref, path.previousPos, hit.hitPos, hit.hitNormal));
+        path.color += path.throughput * material.Emission() * weight;
+        return false;
+    }
+
+    if (depth >= settings.maxDepth) return false;
+
+    // Every bounce consumes the same dimensions so the sequences stay aligned across paths.
+    // Delta bounces have no use for an emitter sample and pick their lobe with randLight.
+    float randLight = sampler.Get1D();
+    glm::vec2 randLightPos = sampler.Get2D();
+    glm::vec2 randBsdf = sampler.Get2D();
+    float randRoulette = sampler.Get1D();
+
+    glm::vec3 wo = -path.direction;
+    glm::vec3 normal = glm::dot(hit.hitNormal, path.direction) > 0.0f ? -hit.hitNormal : hit.hitNormal;
+    glm::vec3 offsetPos = hit.hitPos + normal * 0.001f;
+    bool glossy = material.isMetal && material.roughness >= GGX_MIN_ROUGHNESS;
+
+    path.origin = offsetPos;
+
+    if (material.isRefractive) {
+        BsdfSample sample;
+        SampleDielectric(material, hit.hitNormal, wo, randLight, sample);
 
-    std::random_device randDevice;
-    std::default_random_engine rngGen{randDevice()};
-    std::uniform_real_distribution<float> distribution{0.0f, 1.0f};
+        if (sample.transmitted) path.origin = hit.hitPos - normal * 0.001f;
+        path.throughput *= sample.weight;
+        path.direction = sample.direction;
+        path.specularBounce = true;
+    } else if (material.isMetal && !glossy) {
+        path.throughput *= FresnelSchlick(material.albedo, glm::dot(normal, wo));
+        path.direction = glm::reflect(path.direction, normal);
+        path.specularBounce = true;
+    } else {
+        LightSample light;
 
-    auto RNG = std::bind(distribution, rngGen);
+        if (SampleEmitter(scene, hit.hitPos, randLight, randLightPos, light)) {
+            glm::vec3 lightDir = glm::normalize(light.position - hit.hitPos);
+            float cosTheta = glm::dot(normal, lightDir);
 
-    glm::vec2 rand = glm::vec2(0.0f);
+            // Lambert: f = albedo / pi, pdf = cos / pi
+            float lightBsdfPdf = cosTheta * rPI;
+            glm::vec3 f = glossy ? EvaluateConductor(material, normal, wo, lightDir, lightBsdfPdf) : material.albedo * rPI;
 
-    HitData hitData{};
+            if (cosTheta > 0.0f && lightBsdfPdf > 0.0f) {
+                float weight = PowerHeuristic(light.pdf, lightBsdfPdf);
+                shadow.origin = offsetPos;
+                shadow.target = light.position;
+                shadow.contribution = path.throughput * f * light.radiance * (cosTheta * weight / light.pdf);
+                shadow.traced = true;
+            }
+        }
+
+        if (glossy) {
+            BsdfSample sample;
+            if (!SampleConductor(material, normal, wo, randBsdf, sample)) return false;
+
+            path.direction = sample.direction;
+            path.bsdfPdf = sample.pdf;
+            path.throughput *= sample.weight;
+        } else {
+            path.direction = CosineSampleHemisphere(normal, randBsdf);
+            path.bsdfPdf = glm::dot(normal, path.direction) * rPI;
+            if (path.bsdfPdf <= 0.0f) return false;
+
+            // f * cos / pdf
+            path.throughput *= material.albedo;
+        }
+
+        path.specularBounce = false;
+    }
+
+    if (depth + 1 >= settings.rouletteDepth) {
+        float survival = std::min(std::max(path.throughput.x, std::max(path.throughput.y, path.throughput.z)), 0.95f);
+        if (randRoulette >= survival) return false;
+        path.throughput /= survival;
+    }
+
+    path.previousPos = hit.hitPos;
+    return true;
+}
 
-    // Camera Ray
-    RayTraceScene(hitData, rayOrigin, rayDirWorld);
-    sceneColor = hitData.material.emissivity * hitData.material.albedo;
+// Shades a pixel sample depth first, starting from the already traced camera ray hit.
+// Every ray traced is counted in rays.
+glm::vec3 Render(const Scene& scene, const HitData& cameraHit, const glm::vec3& cameraDirection, Sampler& sampler, const RenderSettings& settings, std::uint64_t& rays) {
+    PathState path{};
+    path.direction = cameraDirection;
+    HitData hit = cameraHit;
+    int depth = 0;
 
-    rand.x = RNG();
-    rand.y = RNG();
-    glm::vec3 randomDir = UniformSampleHemisphere(hitData.hitNormal, rand);
+    for (; hit.rayHit; depth++) {
+        ShadowRay shadow;
+        bool alive = ShadeVertex(scene, hit, depth, settings, sampler, path, shadow);
+
+        if (shadow.traced) {
+            rays++;
+            PROFILE_COUNT(ProfileCounter::ShadowRays);
+            if (Visible(scene, shadow.origin, shadow.target)) path.color += shadow.contribution;
+        }
+
+        if (!alive) break;
+
+        RayTraceScene(scene, hit, path.origin, path.direction);
+        rays++;
+        PROFILE_COUNT(ProfileCounter::BounceRays);
+    }
+
+    if (!hit.rayHit) PROFILE_COUNT(ProfileCounter::Misses);
+    PROFILE_PATH_DEPTH(depth);
+
+    return path.color;
+}
+
+class Tile {
+public:
+    std::size_t x0, y0;  // inclusive
+    std::size_t x1, y1;  // exclusive
+};
+
+// Interleaves the bits of x and y
+std::uint32_t MortonCode(std::uint32_t x, std::uint32_t y) {
+    auto Spread = [](std::uint32_t v) {
+        v &= 0x0000FFFF;
+        v = (v | (v << 8)) & 0x00FF00FF;
+        v = (v | (v << 4)) & 0x0F0F0F0F;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+
+    return Spread(x) | (Spread(y) << 1);
+}
 
-    // TODO: Path trace recursively, manually adding bounces isn't the cleanest approach
-    HitData randomHit{};
-    RayTraceScene(randomHit, hitData.hitPos + hitData.hitNormal * 0.001f, randomDir);
+// Square tiles in Morton order, so consecutive tiles (and therefore the tiles a single
+// worker starts with) are close to each other on screen. Covers rows [y0, y0 + height).
+std::vector<Tile> MakeTiles(const std::size_t& width, const std::size_t& height, const std::size_t& tileSize, const std::size_t& y0 = 0) {
+    std::vector<Tile> tiles;
+    std::vector<std::uint32_t> codes;
 
-    if (hitData.rayHit && !hitData.material.isEmissive) {
-        if (randomHit.rayHit && randomHit.material.isEmissive) {
-            sceneColor += hitData.material.albedo * randomHit.material.emissivity * randomHit.material.albedo * glm::dot(hitData.hitNormal, randomDir) * 2.0f; 
-            return sceneColor;
+    for (std::size_t y = 0; y < height; y += tileSize) {
+        for (std::size_t x = 0; x < width; x += tileSize) {
+            tiles.push_back(Tile{x, y0 + y, std::min(x + tileSize, width), y0 + std::min(y + tileSize, height)});
+            codes.push_back(MortonCode((std::uint32_t) (x / tileSize), (std::uint32_t) (y / tileSize)));
         }
+    }
+
+    std::vector<std::size_t> order(tiles.size());
+    for (std::size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return codes[a] < codes[b]; });
+
+    std::vector<Tile> sorted;
+    for (std::size_t i : order) sorted.push_back(tiles[i]);
+    return sorted;
+}
 
-        rand.x = RNG();
-        rand.y = RNG();
-        glm::vec3 randomDir2 = UniformSampleHemisphere(randomHit.hitNormal, rand);
+// Traces the camera rays of count pixels starting at (x0, y), as a packet when the
+// kernels have one. hits and rayDirs need room for a whole packet.
+void TraceCameraRays(const Scene& scene, const Camera& camera, const std::size_t& x0, const std::size_t& y, const std::size_t& count, HitData* hits, glm::vec3* rayDirs) {
+    const std::size_t packetSize = simdKernels.packetSize;
+    glm::vec3 rayOrigin;
 
-        HitData randomHit2{};
-        RayTraceScene(randomHit2, randomHit.hitPos + randomHit.hitNormal * 0.001f, randomDir2);
+    if (packetSize > 1) {
+        RayPacket packet;
 
-        if (randomHit.rayHit && !randomHit.material.isEmissive) {
-            glm::vec3 contrib = randomHit.material.albedo * randomHit2.material.emissivity * randomHit2.material.albedo * glm::dot(randomHit.hitNormal, randomDir2) * 2.0f; 
-            sceneColor += hitData.material.albedo * 2.0f * contrib * glm::dot(hitData.hitNormal, randomDir); 
+        // Lanes past the edge of the image duplicate the last pixel
+        for (std::size_t lane = 0; lane < packetSize; lane++) {
+            GenerateCameraRay(camera, x0 + std::min(lane, count - 1), y, rayOrigin, rayDirs[lane]);
+            packet.Set(lane, rayOrigin, rayDirs[lane]);
         }
+
+        TracePacket(scene, packet, hits);
+    } else {
+        GenerateCameraRay(camera, x0, y, rayOrigin, rayDirs[0]);
+        RayTraceScene(scene, hits[0], rayOrigin, rayDirs[0]);
     }
 
-    return sceneColor;
+    PROFILE_ADD(ProfileCounter::CameraRays, count);
+}
+
+// Stores the first-hit features of count camera rays starting at (x0, y) in the film
+void RecordFeatures(const Scene& scene, Film& film, const std::size_t& x0, const std::size_t& y, const std::size_t& count, const HitData* hits, const glm::vec3* rayDirs) {
+    for (std::size_t lane = 0; lane < count; lane++) {
+        const HitData& hit = hits[lane];
+        if (!hit.rayHit) continue;
+
+        std::size_t pixel = film.Index(x0 + lane, y);
+        film.albedo[pixel] = scene.materials[hit.material].albedo;
+        film.normal[pixel] = glm::dot(hit.hitNormal, rayDirs[lane]) > 0.0f ? -hit.hitNormal : hit.hitNormal;
+        film.depth[pixel] = hit.t;
+    }
 }
 
-void DispatchTile(std::array<glm::vec3, VIEWPORT_WIDTH * VIEWPORT_HEIGHT>& frameBuffer, std::size_t tileID, const glm::mat4 cameraViewMatrix) {
-    std::cout << RENDERER_HINT << "Dispatching tile with ID: " << tileID << '\n';
-    std::size_t startY = tileID * VIEWPORT_HEIGHT / THREADS;
-    std::size_t endY = (tileID + 1) * VIEWPORT_HEIGHT / THREADS;
+// Adds sampleCount samples, starting at sample index firstSample, to every pixel of the
+// tile. Returns the number of rays traced.
+std::uint64_t RenderTile(const Scene& scene, Film& film, const Tile& tile, const RenderSettings& settings, const std::uint32_t& firstSample, const std::uint32_t& sampleCount) {
+    // Camera rays of neighbouring pixels in a row are coherent, trace them as packets
+    const std::size_t packetSize = simdKernels.packetSize;
+    HitData hits[MAX_PACKET_SIZE];
+    glm::vec3 rayDirs[MAX_PACKET_SIZE];
+    Sampler sampler = settings.sampler;
+    std::uint64_t rays = 0;
+
+    for (std::size_t y = tile.y0; y < tile.y1; y++) {
+        for (std::size_t x0 = tile.x0; x0 < tile.x1; x0 += packetSize) {
+            std::size_t count = std::min(packetSize, tile.x1 - x0);
+
+            // The camera does not jitter, its hits are shared by all samples of the pass
+            TraceCameraRays(scene, settings.camera, x0, y, count, hits, rayDirs);
+            rays += count;
+            if (firstSample == 0 && film.HasFeatures()) RecordFeatures(scene, film, x0, y, count, hits, rayDirs);
 
-    for (std::size_t x = 0; x < VIEWPORT_WIDTH; x++) {
-        for (std::size_t y = startY; y < endY; y++) {
             // Invoke the meat of the implementation
-            glm::vec3 sceneColor = glm::vec3(0.0);
+            for (std::size_t lane = 0; lane < count; lane++) {
+                for (std::uint32_t sample = firstSample; sample < firstSample + sampleCount; sample++) {
+                    sampler.StartPixelSample(x0 + lane, y, sample);
+                    film.AddSample(film.Index(x0 + lane, y), Render(scene, hits[lane], rayDirs[lane], sampler, settings, rays));
+                }
+            }
+        }
+    }
+
+    return rays;
+}
+
+// The stream alternative to RenderTile(), defined in wavefront.h
+std::uint64_t RenderTileWavefront(const Scene& scene, Film& film, const Tile& tile, const RenderSettings& settings, const std::uint32_t& firstSample, const std::uint32_t& sampleCount);
+
+// RMS of the relative pixel errors. The maximum would let the one pixel with the
+// unluckiest variance estimate hold the whole tile back.
+float TileError(const Film& film, const Tile& tile) {
+    float sumSquared = 0.0f;
+
+    for (std::size_t y = tile.y0; y < tile.y1; y++) {
+        for (std::size_t x = tile.x0; x < tile.x1; x++) {
+            float error = film.RelativeError(film.Index(x, y));
+            sumSquared += error * error;
+        }
+    }
+
+    return std::sqrt(sumSquared / (float) ((tile.x1 - tile.x0) * (tile.y1 - tile.y0)));
+}
+
+class RenderStats {
+public:
+    std::size_t passes = 0;
+    std::size_t tiles = 0;
+    std::size_t convergedTiles = 0;
+    std::uint64_t samples = 0;
+    std::uint64_t rays = 0;
+    bool outOfTime = false;
 
-            for (std::size_t sample = 0; sample < SAMPLES; sample++) {
-                sceneColor += Render(x, y, cameraViewMatrix, sample);
+    // Bands and frames render their passes one after another, so passes is the most
+    // any of them needed
+    void Merge(const RenderStats& other) {
+        passes = std::max(passes, other.passes);
+        tiles += other.tiles;
+        convergedTiles += other.convergedTiles;
+        samples += other.samples;
+        rays += other.rays;
+        outOfTime |= other.outOfTime;
+    }
+};
+
+// Renders in passes of settings.passSamples samples per pixel. After every pass a tile
+// is retired once it reaches settings.samplesPerPixel or its error drops below
+// settings.targetError. With a time budget, tiles that have not started when the
+// deadline passes are skipped and rendering stops after that pass, but every tile gets
+// its first pass however short the budget is. Setting settings.cancel skips tiles right away.
+RenderStats RenderProgressive(const Scene& scene, Film& film, const std::vector<Tile>& tiles, ThreadPool& pool, const RenderSettings& settings) {
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(settings.timeBudget));
+    const bool hasDeadline = settings.timeBudget > 0.0;
+    const bool adaptive = settings.targetError > 0.0f;
+    const std::uint32_t passSamples = adaptive || hasDeadline ? std::max<std::uint32_t>(1, settings.passSamples) : settings.samplesPerPixel;
+
+    RenderStats stats{};
+    std::vector<std::size_t> active(tiles.size());
+    std::vector<std::uint32_t> tileSamples(tiles.size(), settings.firstSample);
+    std::vector<float> tileError(tiles.size(), std::numeric_limits<float>::infinity());
+    std::atomic<bool> outOfTime{false};
+    std::atomic<std::uint64_t> rays{0};
+
+    for (std::size_t i = 0; i < tiles.size(); i++) active[i] = i;
+
+    auto Cancelled = [&]() { return settings.cancel && settings.cancel->load(std::memory_order_relaxed); };
+
+    while (!active.empty() && !outOfTime && !Cancelled()) {
+        pool.Run(active.size(), [&](std::size_t task, std::size_t worker) {
+            std::size_t tile = active[task];
+
+            if (hasDeadline && tileSamples[tile] > settings.firstSample && Clock::now() >= deadline) {
+                outOfTime = true;
+                return;
             }
 
-            sceneColor /= (float) SAMPLES;
-            sceneColor = ACESFilm(sceneColor);
-            sceneColor = LinearToSrgb(sceneColor);
+            if (Cancelled()) return;
+
+            std::uint32_t count = std::min(passSamples, settings.samplesPerPixel - tileSamples[tile]);
+
+            PROFILE_TILE_BEGIN();
+            rays += settings.integrator == Integrator::Wavefront ? RenderTileWavefront(scene, film, tiles[tile], settings, tileSamples[tile], count)
+                                                                 : RenderTile(scene, film, tiles[tile], settings, tileSamples[tile], count);
+            PROFILE_TILE_END(tiles[tile], stats.passes, worker);
+            tileSamples[tile] += count;
+            if (adaptive) tileError[tile] = TileError(film, tiles[tile]);
+        });
+
+        stats.passes++;
+
+        std::vector<std::size_t> remaining;
+        for (std::size_t tile : active) {
+            bool converged = adaptive && tileSamples[tile] >= settings.minSamples && tileError[tile] <= settings.targetError;
+            if (converged) stats.convergedTiles++;
+            if (!converged && tileSamples[tile] < settings.samplesPerPixel) remaining.push_back(tile);
+        }
+
+        active.swap(remaining);
+        if (hasDeadline && !active.empty() && Clock::now() >= deadline) outOfTime = true;
+    }
+
+    for (std::size_t i = 0; i < tiles.size(); i++) {
+        const Tile& tile = tiles[i];
+        stats.samples += (std::uint64_t) (tileSamples[i] - settings.firstSample) * (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+    }
+
+    stats.tiles = tiles.size();
+    stats.rays = rays;
+    stats.outOfTime = outOfTime;
+    return stats;
+}
+
+// Renders the image in horizontal bands of bandHeight rows, top band first, and hands
+// every finished band to onBand. Only one band is held in memory at a time, so a band
+// height of a few tiles keeps huge images bounded. The time budget is shared out
+// between the bands by their number of rows. Stops early if onBand returns false.
+RenderStats RenderBands(const Scene& scene, ThreadPool& pool, const RenderSettings& settings, const std::size_t& tileSize, const std::size_t& bandHeight, const std::function<bool(const Film&)>& onBand) {
+    const Camera& camera = settings.camera;
+    const auto start = std::chrono::steady_clock::now();
+    RenderStats stats{};
+
+    for (std::size_t y1 = camera.height; y1 > 0; ) {
+        std::size_t y0 = y1 > bandHeight ? y1 - bandHeight : 0;
+        RenderSettings bandSettings = settings;
 
-            frameBuffer.at(y * VIEWPORT_WIDTH + x) = sceneColor;
+        if (settings.timeBudget > 0.0) {
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            bandSettings.timeBudget = std::max(1e-6, (settings.timeBudget - elapsed) * (double) (y1 - y0) / (double) y1);
         }
+
+        Film film(camera.width, y1 - y0, y0);
+        if (settings.features) film.EnableFeatures();
+        std::vector<Tile> tiles = MakeTiles(camera.width, y1 - y0, tileSize, y0);
+        stats.Merge(RenderProgressive(scene, film, tiles, pool, bandSettings));
+
+        if (!onBand(film)) break;
+        y1 = y0;
     }
-}
\ No newline at end of file
+
+    return stats;
+}
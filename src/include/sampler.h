@@ -0,0 +1,254 @@
+#pragma once
+
+// Every sample value is a pure function of (seed, pixel, sample index, dimension), so a
+// render is reproducible no matter how tiles end up distributed over the threads.
+
+enum class SamplerType {
+    Random,      // PCG32 seeded per pixel sample
+    Stratified,  // jittered strata, permuted per pixel and dimension
+    Sobol,       // Owen-scrambled Sobol, scrambled per pixel
+    BlueNoise    // one Owen-scrambled Sobol sequence, shifted per pixel by an R2 dither mask
+};
+
+const char* SamplerTypeName(const SamplerType& type) {
+    switch (type) {
+        case SamplerType::Random: return "random";
+        case SamplerType::Stratified: return "stratified";
+        case SamplerType::Sobol: return "sobol";
+        default: return "bluenoise";
+    }
+}
+
+bool ParseSamplerType(const std::string& name, SamplerType& type) {
+    for (SamplerType candidate : {SamplerType::Random, SamplerType::Stratified, SamplerType::Sobol, SamplerType::BlueNoise}) {
+        if (name == SamplerTypeName(candidate)) {
+            type = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// lowbias32 by Chris Wellons
+std::uint32_t Hash32(std::uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+std::uint32_t HashCombine(const std::uint32_t& seed, const std::uint32_t& value) {
+    return Hash32(seed ^ (value + 0x9e3779b9U + (seed << 6) + (seed >> 2)));
+}
+
+// [0, 1) from the upper 24 bits
+float UintToFloat(const std::uint32_t& x) {
+    return (x >> 8) * 0x1p-24f;
+}
+
+// https://www.pcg-random.org, 64 bit state, 32 bit output
+class PCG32 {
+public:
+    std::uint64_t state;
+    std::uint64_t increment;
+
+    PCG32(const std::uint64_t& seed = 0x853c49e6748fea9bULL, const std::uint64_t& stream = 0xda3e39cb94b95bdbULL) {
+        state = 0;
+        increment = (stream << 1u) | 1u;
+        NextUInt();
+        state += seed;
+        NextUInt();
+    }
+
+    std::uint32_t NextUInt() {
+        std::uint64_t old = state;
+        state = old * 6364136223846793005ULL + increment;
+        std::uint32_t xorShifted = (std::uint32_t) (((old >> 18u) ^ old) >> 27u);
+        std::uint32_t rot = (std::uint32_t) (old >> 59u);
+        return (xorShifted >> rot) | (xorShifted << ((-rot) & 31));
+    }
+
+    float NextFloat() {
+        return UintToFloat(NextUInt());
+    }
+};
+
+std::uint32_t ReverseBits(std::uint32_t x) {
+    x = ((x >> 1) & 0x55555555U) | ((x & 0x55555555U) << 1);
+    x = ((x >> 2) & 0x33333333U) | ((x & 0x33333333U) << 2);
+    x = ((x >> 4) & 0x0F0F0F0FU) | ((x & 0x0F0F0F0FU) << 4);
+    x = ((x >> 8) & 0x00FF00FFU) | ((x & 0x00FF00FFU) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Burley, "Practical Hash-based Owen Scrambling", JCGT 2020
+std::uint32_t LaineKarrasPermutation(std::uint32_t x, const std::uint32_t& seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cU;
+    x ^= x * 0xb82f1e52U;
+    x ^= x * 0xc7afe638U;
+    x ^= x * 0x8d22f6e6U;
+    return x;
+}
+
+std::uint32_t NestedUniformScramble(std::uint32_t x, const std::uint32_t& seed) {
+    return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+}
+
+constexpr int SOBOL_DIMENSIONS = 4;
+
+// Direction numbers for the first four Sobol dimensions, generated from the primitive
+// polynomials and initial values of Joe and Kuo
+class SobolMatrices {
+public:
+    std::uint32_t directions[SOBOL_DIMENSIONS][32];
+
+    SobolMatrices() {
+        for (int bit = 0; bit < 32; bit++) directions[0][bit] = 1U << (31 - bit);
+
+        const int degree[SOBOL_DIMENSIONS] = {0, 1, 2, 3};
+        const std::uint32_t coefficients[SOBOL_DIMENSIONS] = {0, 0, 1, 1};
+        const std::uint32_t initial[SOBOL_DIMENSIONS][3] = {{}, {1}, {1, 3}, {1, 3, 1}};
+
+        for (int dim = 1; dim < SOBOL_DIMENSIONS; dim++) {
+            const int s = degree[dim];
+            std::uint32_t* v = directions[dim];
+
+            for (int i = 0; i < s; i++) v[i] = initial[dim][i] << (31 - i);
+
+            for (int i = s; i < 32; i++) {
+                v[i] = v[i - s] ^ (v[i - s] >> s);
+                for (int k = 1; k < s; k++) {
+                    v[i] ^= ((coefficients[dim] >> (s - 1 - k)) & 1U) * v[i - k];
+                }
+            }
+        }
+    }
+};
+
+const SobolMatrices SOBOL_MATRICES{};
+
+// The index is scrambled and therefore random, branching on its bits mispredicts half the time
+std::uint32_t Sobol(const std::uint32_t& index, const int& dim) {
+    std::uint32_t x = 0;
+    for (int bit = 0; bit < 32; bit++) {
+        x ^= SOBOL_MATRICES.directions[dim][bit] & (0U - ((index >> bit) & 1U));
+    }
+    return x;
+}
+
+// Owen-scrambled Sobol point. Dimensions are used in groups of four; every group gets
+// its own index shuffle so the groups are decorrelated (Burley 2020, section 4).
+float OwenSobol(const std::uint32_t& index, const std::uint32_t& dimension, const std::uint32_t& seed) {
+    std::uint32_t group = dimension / SOBOL_DIMENSIONS;
+    std::uint32_t shuffled = NestedUniformScramble(index, HashCombine(seed, group));
+    std::uint32_t x = Sobol(shuffled, dimension % SOBOL_DIMENSIONS);
+    return UintToFloat(NestedUniformScramble(x, HashCombine(seed, dimension + 0x1000U)));
+}
+
+// Kensler, "Correlated Multi-Jittered Sampling": a random permutation of [0, length)
+std::uint32_t Permute(std::uint32_t i, const std::uint32_t& length, const std::uint32_t& seed) {
+    std::uint32_t w = length - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+
+    do {
+        i ^= seed;
+        i *= 0xe170893dU;
+        i ^= seed >> 16;
+        i ^= (i & w) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3fU;
+        i ^= seed >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935fa69U;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303U;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3U;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfU;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= length);
+
+    return (i + seed) % length;
+}
+
+// Copied per tile, so the per-sample state lives on the worker's stack
+class Sampler {
+public:
+    SamplerType type = SamplerType::Sobol;
+    std::uint32_t seed = 0;
+    std::uint32_t samplesPerPixel = 1;
+
+    void StartPixelSample(const std::size_t& x, const std::size_t& y, const std::size_t& sample) {
+        pixelX = (std::uint32_t) x;
+        pixelY = (std::uint32_t) y;
+        pixelSeed = HashCombine(HashCombine(seed, pixelX), pixelY);
+        sampleIndex = (std::uint32_t) sample;
+        dimension = 0;
+
+        if (type == SamplerType::Random) rng = PCG32(HashCombine(pixelSeed, sampleIndex), pixelSeed);
+    }
+
+    float Get1D() {
+        switch (type) {
+            case SamplerType::Random:
+                return rng.NextFloat();
+            case SamplerType::Stratified: {
+                std::uint32_t dimSeed = HashCombine(pixelSeed, dimension++);
+                std::uint32_t stratum = Permute(sampleIndex % samplesPerPixel, samplesPerPixel, dimSeed);
+                return (stratum + UintToFloat(HashCombine(dimSeed, sampleIndex))) / samplesPerPixel;
+            }
+            case SamplerType::Sobol:
+                return OwenSobol(sampleIndex, dimension++, pixelSeed);
+            default: {
+                const std::uint32_t d = dimension++;
+                return BlueNoiseShift(OwenSobol(sampleIndex, d, seed), d);
+            }
+        }
+    }
+
+    glm::vec2 Get2D() {
+        if (type == SamplerType::Stratified) {
+            // n x n jittered grid, n * n >= samplesPerPixel
+            std::uint32_t n = (std::uint32_t) std::ceil(std::sqrt((float) samplesPerPixel));
+            std::uint32_t dimSeed = HashCombine(pixelSeed, dimension);
+            std::uint32_t stratum = Permute(sampleIndex % (n * n), n * n, dimSeed);
+            dimension += 2;
+
+            glm::vec2 jitter = glm::vec2(UintToFloat(HashCombine(dimSeed, sampleIndex)), UintToFloat(HashCombine(dimSeed ^ 0x5bd1e995U, sampleIndex)));
+            return (glm::vec2((float) (stratum % n), (float) (stratum / n)) + jitter) / (float) n;
+        }
+
+        float a = Get1D();
+        float b = Get1D();
+        return glm::vec2(a, b);
+    }
+
+private:
+    std::uint32_t pixelX = 0, pixelY = 0;
+    std::uint32_t pixelSeed = 0;
+    std::uint32_t sampleIndex = 0;
+    std::uint32_t dimension = 0;
+    PCG32 rng{};
+
+    // Cranley-Patterson rotation by the R2 sequence evaluated at the pixel. Neighbouring
+    // pixels get maximally different offsets, which pushes the error towards high
+    // frequencies (Roberts, "The Unreasonable Effectiveness of Quasirandom Sequences").
+    float BlueNoiseShift(const float& value, const std::uint32_t& dim) const {
+        const float a1 = 0.7548776662466927f;  // 1 / plastic number
+        const float a2 = 0.5698402909980532f;  // 1 / plastic number^2
+        float offset = a1 * pixelX + a2 * pixelY + UintToFloat(Hash32(dim + seed));
+        float shifted = value + offset - std::floor(offset);
+        return shifted >= 1.0f ? shifted - 1.0f : shifted;
+    }
+};
@@ -0,0 +1,583 @@
+#pragma once
+
+#define SCENE_HINT "[\e[0;33mSCENE\033[0m]\t\t"
+
+// Metals are GGX conductors with the albedo as their reflectance at normal incidence,
+// refractive materials are smooth dielectrics that tint transmitted light by the albedo.
+class Material {
+public:
+    glm::vec3 albedo;
+    bool isEmissive;
+    bool isMetal;
+    bool isRefractive;
+    float emissivity;
+    float roughness;  // perceptual, GGX alpha = roughness^2. 0 is a perfect mirror
+    float ior;        // index of refraction of refractive materials
+
+    Material() {
+        albedo = glm::vec3(0.0f);
+        isEmissive = false;
+        emissivity = 0.0f;
+        isMetal = false;
+        isRefractive = false;
+        roughness = 0.0f;
+        ior = 1.5f;
+    }
+
+    glm::vec3 Emission() const {
+        return isEmissive ? emissivity * albedo : glm::vec3(0.0f);
+    }
+};
+
+// Primitives and hits refer to materials by their index into Scene::materials
+using MaterialId = std::uint16_t;
+
+constexpr std::size_t MAX_MATERIALS = (std::size_t) std::numeric_limits<MaterialId>::max() + 1;
+
+enum class PrimitiveType {
+    None,
+    Plane,
+    Sphere,
+    Disk,
+    Triangle
+};
+
+// BVH leaves store primitives as a single 32 bit reference: the type in the upper
+// bits and the index into the matching buffer in the lower ones.
+constexpr std::uint32_t PRIMITIVE_INDEX_BITS = 29;
+constexpr std::uint32_t PRIMITIVE_INDEX_MASK = (1u << PRIMITIVE_INDEX_BITS) - 1u;
+
+std::uint32_t PackPrimitive(const PrimitiveType& type, const std::size_t& index) {
+    return ((std::uint32_t) type << PRIMITIVE_INDEX_BITS) | (std::uint32_t) index;
+}
+
+PrimitiveType PrimitiveTypeOf(const std::uint32_t& ref) {
+    return (PrimitiveType) (ref >> PRIMITIVE_INDEX_BITS);
+}
+
+std::uint32_t PrimitiveIndexOf(const std::uint32_t& ref) {
+    return ref & PRIMITIVE_INDEX_MASK;
+}
+
+// Lane count of the padded plane blocks, the widest SIMD kernel
+constexpr std::size_t PLANE_BLOCK_SIZE = 16;
+
+// Primitives are stored as flat structure-of-arrays buffers. Every component lives in
+// its own contiguous array so the intersection loops only touch the data they need.
+
+class SphereBuffer {
+public:
+    MappedArray<float> centerX, centerY, centerZ;
+    MappedArray<float> radius;
+    MappedArray<MaterialId> material;
+
+    std::size_t size() const { return radius.size(); }
+
+    glm::vec3 Center(const std::size_t& i) const {
+        return glm::vec3(centerX[i], centerY[i], centerZ[i]);
+    }
+
+    void Add(const glm::vec3& center, const float& r, const MaterialId& mat) {
+        centerX.push_back(center.x);
+        centerY.push_back(center.y);
+        centerZ.push_back(center.z);
+        radius.push_back(r);
+        material.push_back(mat);
+    }
+};
+
+class PlaneBuffer {
+public:
+    MappedArray<float> originX, originY, originZ;
+    MappedArray<float> normalX, normalY, normalZ;
+    MappedArray<MaterialId> material;
+
+    std::size_t size() const { return originX.size(); }
+
+    glm::vec3 Origin(const std::size_t& i) const {
+        return glm::vec3(originX[i], originY[i], originZ[i]);
+    }
+
+    glm::vec3 Normal(const std::size_t& i) const {
+        return glm::vec3(normalX[i], normalY[i], normalZ[i]);
+    }
+
+    void Add(const glm::vec3& origin, const glm::vec3& normal, const MaterialId& mat) {
+        glm::vec3 n = glm::normalize(normal);
+        originX.push_back(origin.x);
+        originY.push_back(origin.y);
+        originZ.push_back(origin.z);
+        normalX.push_back(n.x);
+        normalY.push_back(n.y);
+        normalZ.push_back(n.z);
+        material.push_back(mat);
+    }
+};
+
+class DiskBuffer {
+public:
+    MappedArray<float> originX, originY, originZ;
+    MappedArray<float> normalX, normalY, normalZ;
+    MappedArray<float> radius;
+    MappedArray<MaterialId> material;
+
+    std::size_t size() const { return radius.size(); }
+
+    glm::vec3 Origin(const std::size_t& i) const {
+        return glm::vec3(originX[i], originY[i], originZ[i]);
+    }
+
+    glm::vec3 Normal(const std::size_t& i) const {
+        return glm::vec3(normalX[i], normalY[i], normalZ[i]);
+    }
+
+    void Add(const glm::vec3& origin, const glm::vec3& normal, const float& r, const MaterialId& mat) {
+        glm::vec3 n = glm::normalize(normal);
+        originX.push_back(origin.x);
+        originY.push_back(origin.y);
+        originZ.push_back(origin.z);
+        normalX.push_back(n.x);
+        normalY.push_back(n.y);
+        normalZ.push_back(n.z);
+        radius.push_back(r);
+        material.push_back(mat);
+    }
+};
+
+// Triangles keep their first vertex and two edges, which is what Moeller-Trumbore wants
+class TriangleBuffer {
+public:
+    MappedArray<float> v0X, v0Y, v0Z;
+    MappedArray<float> edge1X, edge1Y, edge1Z;
+    MappedArray<float> edge2X, edge2Y, edge2Z;
+    MappedArray<MaterialId> material;
+
+    std::size_t size() const { return v0X.size(); }
+
+    glm::vec3 Vertex0(const std::size_t& i) const {
+        return glm::vec3(v0X[i], v0Y[i], v0Z[i]);
+    }
+
+    glm::vec3 Edge1(const std::size_t& i) const {
+        return glm::vec3(edge1X[i], edge1Y[i], edge1Z[i]);
+    }
+
+    glm::vec3 Edge2(const std::size_t& i) const {
+        return glm::vec3(edge2X[i], edge2Y[i], edge2Z[i]);
+    }
+
+    glm::vec3 Normal(const std::size_t& i) const {
+        return glm::normalize(glm::cross(Edge1(i), Edge2(i)));
+    }
+
+    void Add(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const MaterialId& mat) {
+        glm::vec3 e1 = b - a;
+        glm::vec3 e2 = c - a;
+        v0X.push_back(a.x);
+        v0Y.push_back(a.y);
+        v0Z.push_back(a.z);
+        edge1X.push_back(e1.x);
+        edge1Y.push_back(e1.y);
+        edge1Z.push_back(e1.z);
+        edge2X.push_back(e2.x);
+        edge2Y.push_back(e2.y);
+        edge2Z.push_back(e2.z);
+        material.push_back(mat);
+    }
+};
+
+// Backing store of a scene mapped from a cache, see scenecache.h
+class SceneMapping;
+
+// Built once at startup and shared read-only between all render threads.
+// Planes are unbounded and are tested linearly, everything else goes through the BVH.
+class Scene {
+public:
+    SphereBuffer spheres;
+    PlaneBuffer planes;
+    DiskBuffer disks;
+    TriangleBuffer triangles;
+    BVH bvh;
+
+    MappedArray<Material> materials;
+
+    // Planes repacked into blocks of PLANE_BLOCK_SIZE lanes for the SIMD kernels:
+    // originX, originY, originZ, normalX, normalY, normalZ, each PLANE_BLOCK_SIZE wide.
+    // Padding lanes have a zero normal so they never report a hit.
+    MappedArray<float> planeBlocks;
+
+    // Emissive spheres, disks and triangles for next-event estimation, picked in
+    // proportion to their power. Emissive planes are unbounded and only found by chance.
+    MappedArray<std::uint32_t> emitters;
+    MappedArray<float> emitterCdf;
+    float emitterPower = 0.0f;
+
+    std::vector<std::string> sources;  // files the scene was loaded from, for the cache
+    std::shared_ptr<const SceneMapping> mapping;  // set when the arrays view a cache file
+
+    std::size_t PrimitiveCount() const {
+        return spheres.size() + planes.size() + disks.size() + triangles.size();
+    }
+
+    // The caller makes sure there is room, see MAX_MATERIALS
+    MaterialId AddMaterial(const Material& material) {
+        materials.push_back(material);
+        return (MaterialId) (materials.size() - 1);
+    }
+};
+
+float PrimitiveArea(const Scene& scene, const std::uint32_t& ref) {
+    std::uint32_t i = PrimitiveIndexOf(ref);
+
+    switch (PrimitiveTypeOf(ref)) {
+        case PrimitiveType::Sphere:
+            return 4.0f * PI * scene.spheres.radius[i] * scene.spheres.radius[i];
+        case PrimitiveType::Disk:
+            return PI * scene.disks.radius[i] * scene.disks.radius[i];
+        case PrimitiveType::Triangle:
+            return 0.5f * glm::length(glm::cross(scene.triangles.Edge1(i), scene.triangles.Edge2(i)));
+        default:
+            return std::numeric_limits<float>::infinity();
+    }
+}
+
+MaterialId PrimitiveMaterialId(const Scene& scene, const std::uint32_t& ref) {
+    std::uint32_t i = PrimitiveIndexOf(ref);
+
+    switch (PrimitiveTypeOf(ref)) {
+        case PrimitiveType::Plane: return scene.planes.material[i];
+        case PrimitiveType::Sphere: return scene.spheres.material[i];
+        case PrimitiveType::Disk: return scene.disks.material[i];
+        default: return scene.triangles.material[i];
+    }
+}
+
+const Material& PrimitiveMaterial(const Scene& scene, const std::uint32_t& ref) {
+    return scene.materials[PrimitiveMaterialId(scene, ref)];
+}
+
+// Total emitted flux up to a constant factor, zero for anything we can not sample
+float EmitterPower(const Scene& scene, const std::uint32_t& ref) {
+    if (PrimitiveTypeOf(ref) == PrimitiveType::Plane) return 0.0f;
+    return Luminance(PrimitiveMaterial(scene, ref).Emission()) * PrimitiveArea(scene, ref);
+}
+
+void BuildEmitterTable(Scene& scene) {
+    scene.emitters.clear();
+    scene.emitterCdf.clear();
+    scene.emitterPower = 0.0f;
+
+    auto Add = [&](PrimitiveType type, std::size_t count, const MappedArray<MaterialId>& materials) {
+        for (std::size_t i = 0; i < count; i++) {
+            if (!scene.materials[materials[i]].isEmissive) continue;
+
+            std::uint32_t ref = PackPrimitive(type, i);
+            float power = EmitterPower(scene, ref);
+            if (power <= 0.0f) continue;
+
+            scene.emitterPower += power;
+            scene.emitters.push_back(ref);
+            scene.emitterCdf.push_back(scene.emitterPower);
+        }
+    };
+
+    Add(PrimitiveType::Sphere, scene.spheres.size(), scene.spheres.material);
+    Add(PrimitiveType::Disk, scene.disks.size(), scene.disks.material);
+    Add(PrimitiveType::Triangle, scene.triangles.size(), scene.triangles.material);
+}
+
+// Has to be called once all primitives are in place
+void BuildAccelerationStructure(Scene& scene) {
+    BuildEmitterTable(scene);
+
+    const PlaneBuffer& planes = scene.planes;
+    std::size_t blocks = (planes.size() + PLANE_BLOCK_SIZE - 1) / PLANE_BLOCK_SIZE;
+    scene.planeBlocks.assign(blocks * 6 * PLANE_BLOCK_SIZE, 0.0f);
+
+    for (std::size_t i = 0; i < planes.size(); i++) {
+        float* block = &scene.planeBlocks[(i / PLANE_BLOCK_SIZE) * 6 * PLANE_BLOCK_SIZE + i % PLANE_BLOCK_SIZE];
+        block[0 * PLANE_BLOCK_SIZE] = planes.originX[i];
+        block[1 * PLANE_BLOCK_SIZE] = planes.originY[i];
+        block[2 * PLANE_BLOCK_SIZE] = planes.originZ[i];
+        block[3 * PLANE_BLOCK_SIZE] = planes.normalX[i];
+        block[4 * PLANE_BLOCK_SIZE] = planes.normalY[i];
+        block[5 * PLANE_BLOCK_SIZE] = planes.normalZ[i];
+    }
+
+    std::vector<AABB> bounds;
+    std::vector<std::uint32_t> refs;
+
+    std::size_t bounded = scene.spheres.size() + scene.disks.size() + scene.triangles.size();
+    bounds.reserve(bounded);
+    refs.reserve(bounded);
+
+    for (std::size_t i = 0; i < scene.spheres.size(); i++) {
+        glm::vec3 center = scene.spheres.Center(i);
+        glm::vec3 r = glm::vec3(scene.spheres.radius[i]);
+        bounds.emplace_back(center - r, center + r);
+        refs.push_back(PackPrimitive(PrimitiveType::Sphere, i));
+    }
+
+    for (std::size_t i = 0; i < scene.disks.size(); i++) {
+        // A disk extends r * sin(angle between the axis and the normal) along every axis
+        glm::vec3 n = scene.disks.Normal(i);
+        glm::vec3 e = scene.disks.radius[i] * glm::sqrt(glm::max(glm::vec3(1.0f) - n * n, glm::vec3(0.0f)));
+        glm::vec3 origin = scene.disks.Origin(i);
+        bounds.emplace_back(origin - e, origin + e);
+        refs.push_back(PackPrimitive(PrimitiveType::Disk, i));
+    }
+
+    for (std::size_t i = 0; i < scene.triangles.size(); i++) {
+        glm::vec3 a = scene.triangles.Vertex0(i);
+        AABB box{};
+        box.Grow(a);
+        box.Grow(a + scene.triangles.Edge1(i));
+        box.Grow(a + scene.triangles.Edge2(i));
+        bounds.push_back(box);
+        refs.push_back(PackPrimitive(PrimitiveType::Triangle, i));
+    }
+
+    BuildBVH(scene.bvh, bounds, refs);
+}
+
+// Minimal Wavefront OBJ reader. Only positions and faces are used, polygons are
+// triangulated as fans. Vertices are scaled and then translated.
+bool LoadOBJ(Scene& scene, const std::string& path, const MaterialId& material, const glm::vec3& translation, const float& scale) {
+    std::ifstream file(path);
+
+    if (!file) {
+        std::cerr << SCENE_HINT << "Could not open " << path << '\n';
+        return false;
+    }
+
+    scene.sources.push_back(path);
+
+    std::vector<glm::vec3> positions;
+    std::vector<std::size_t> face;
+    std::string line, keyword, vertex;
+    std::size_t lineNumber = 0;
+    std::size_t triangleCount = scene.triangles.size();
+
+    auto Fail = [&](const std::string& message) {
+        std::cerr << SCENE_HINT << path << ":" << lineNumber << ": " << message << '\n';
+        return false;
+    };
+
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::istringstream stream(line);
+        if (!(stream >> keyword)) continue;
+
+        if (keyword == "v") {
+            glm::vec3 p;
+            if (!(stream >> p.x >> p.y >> p.z)) return Fail("malformed vertex");
+            positions.push_back(p * scale + translation);
+        } else if (keyword == "f") {
+            face.clear();
+
+            while (stream >> vertex) {
+                // v, v/vt, v//vn or v/vt/vn. Negative indices count from the end.
+                long index = std::strtol(vertex.c_str(), nullptr, 10);
+                if (index < 0) index += (long) positions.size() + 1;
+
+                if (index < 1 || index > (long) positions.size()) return Fail("face references missing vertex " + vertex);
+
+                face.push_back((std::size_t) index - 1);
+            }
+
+            for (std::size_t i = 2; i < face.size(); i++) {
+                if (scene.triangles.size() > PRIMITIVE_INDEX_MASK) return Fail("more triangles than a primitive reference can index");
+                scene.triangles.Add(positions[face[0]], positions[face[i - 1]], positions[face[i]], material);
+            }
+        }
+    }
+
+    std::cout << SCENE_HINT << "Loaded " << scene.triangles.size() - triangleCount << " triangles from " << path << '\n';
+    return true;
+}
+
+// The Cornell box that used to be compiled into RayTraceScene()
+Scene CornellBoxScene() {
+    Scene scene{};
+
+    Material white{};
+    white.albedo = glm::vec3(1.0f);
+
+    Material red = white;
+    red.albedo = glm::vec3(1.0f, 0.0f, 0.0f);
+
+    Material green = white;
+    green.albedo = glm::vec3(0.0f, 1.0f, 0.0f);
+
+    Material metal = white;
+    metal.isMetal = true;
+
+    Material emitter{};
+    emitter.albedo = glm::vec3(1.0f);
+    emitter.emissivity = 5.0f;
+    emitter.isEmissive = true;
+
+    MaterialId whiteId = scene.AddMaterial(white);
+    MaterialId redId = scene.AddMaterial(red);
+    MaterialId greenId = scene.AddMaterial(green);
+    MaterialId metalId = scene.AddMaterial(metal);
+    MaterialId emitterId = scene.AddMaterial(emitter);
+
+    scene.planes.Add(glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), whiteId);
+    scene.planes.Add(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), whiteId);
+    scene.planes.Add(glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), redId);
+    scene.planes.Add(glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), greenId);
+    scene.planes.Add(glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 0.0f, 1.0f), whiteId);
+
+    scene.spheres.Add(glm::vec3(-0.5f, -0.66f, 0.5f), 0.33f, whiteId);
+    scene.spheres.Add(glm::vec3(0.00f, -0.66f, 0.0f), 0.33f, metalId);
+    scene.spheres.Add(glm::vec3(0.5f, -0.66f, 0.5f), 0.33f, whiteId);
+
+    scene.disks.Add(glm::vec3(0.0f, 0.99f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), 0.5f, emitterId);
+
+    return scene;
+}
+
+// Scene files are plain text, one statement per line. '#' starts a comment.
+//
+//   material <name> [albedo r g b] [emissivity e] [metal] [refractive] [roughness r] [ior n]
+//   plane    <ox oy oz> <nx ny nz> <material>
+//   sphere   <cx cy cz> <radius> <material>
+//   disk     <ox oy oz> <nx ny nz> <radius> <material>
+//   triangle <ax ay az> <bx by bz> <cx cy cz> <material>
+//   mesh     <file.obj> <material> [translate x y z] [scale s]
+//
+// Materials have to be declared before they are referenced. Declaring a name again adds
+// a new material for the statements that follow. Mesh paths are relative
+// to the scene file.
+bool LoadScene(Scene& scene, const std::string& path) {
+    std::ifstream file(path);
+
+    if (!file) {
+        std::cerr << SCENE_HINT << "Could not open " << path << '\n';
+        return false;
+    }
+
+    scene.sources.push_back(path);
+
+    std::unordered_map<std::string, MaterialId> materials;
+    std::string line;
+    std::size_t lineNumber = 0;
+
+    auto Fail = [&](const std::string& message) {
+        std::cerr << SCENE_HINT << path << ":" << lineNumber << ": " << message << '\n';
+        return false;
+    };
+
+    while (std::getline(file, line)) {
+        lineNumber++;
+
+        std::size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+
+        std::istringstream stream(line);
+        std::string keyword;
+        if (!(stream >> keyword)) continue;
+
+        if (keyword == "material") {
+            std::string name, attribute;
+            Material material{};
+
+            if (!(stream >> name)) return Fail("material without a name");
+
+            while (stream >> attribute) {
+                if (attribute == "albedo") {
+                    stream >> material.albedo.x >> material.albedo.y >> material.albedo.z;
+                } else if (attribute == "emissivity") {
+                    stream >> material.emissivity;
+                    material.isEmissive = material.emissivity > 0.0f;
+                } else if (attribute == "roughness") {
+                    stream >> material.roughness;
+                    if (material.roughness < 0.0f || material.roughness > 1.0f) return Fail("roughness must be between 0 and 1");
+                } else if (attribute == "ior") {
+                    stream >> material.ior;
+                    if (material.ior < 1.0f) return Fail("ior must be at least 1");
+                } else if (attribute == "metal") {
+                    material.isMetal = true;
+                } else if (attribute == "refractive") {
+                    material.isRefractive = true;
+                } else {
+                    return Fail("unknown material attribute '" + attribute + "'");
+                }
+
+                if (stream.fail()) return Fail("malformed material attribute '" + attribute + "'");
+            }
+
+            if (scene.materials.size() >= MAX_MATERIALS) return Fail("too many materials");
+            materials[name] = scene.AddMaterial(material);
+            continue;
+        }
+
+        if (keyword == "mesh") {
+            std::string meshPath, materialName, attribute;
+            glm::vec3 translation{0.0f};
+            float scale = 1.0f;
+
+            if (!(stream >> meshPath >> materialName)) return Fail("malformed mesh");
+
+            while (stream >> attribute) {
+                if (attribute == "translate") {
+                    stream >> translation.x >> translation.y >> translation.z;
+                } else if (attribute == "scale") {
+                    stream >> scale;
+                } else {
+                    return Fail("unknown mesh attribute '" + attribute + "'");
+                }
+
+                if (stream.fail()) return Fail("malformed mesh attribute '" + attribute + "'");
+            }
+
+            auto material = materials.find(materialName);
+            if (material == materials.end()) return Fail("undeclared material '" + materialName + "'");
+
+            std::size_t slash = path.find_last_of("/\\");
+            if (slash != std::string::npos && meshPath.front() != '/') meshPath = path.substr(0, slash + 1) + meshPath;
+
+            if (!LoadOBJ(scene, meshPath, material->second, translation, scale)) return false;
+            continue;
+        }
+
+        glm::vec3 origin, normal, c;
+        float radius = 0.0f;
+        std::string materialName;
+
+        if (keyword == "triangle") {
+            stream >> origin.x >> origin.y >> origin.z >> normal.x >> normal.y >> normal.z >> c.x >> c.y >> c.z >> materialName;
+        } else if (keyword == "plane") {
+            stream >> origin.x >> origin.y >> origin.z >> normal.x >> normal.y >> normal.z >> materialName;
+        } else if (keyword == "sphere") {
+            stream >> origin.x >> origin.y >> origin.z >> radius >> materialName;
+        } else if (keyword == "disk") {
+            stream >> origin.x >> origin.y >> origin.z >> normal.x >> normal.y >> normal.z >> radius >> materialName;
+        } else {
+            return Fail("unknown statement '" + keyword + "'");
+        }
+
+        if (stream.fail()) return Fail("malformed " + keyword);
+
+        auto material = materials.find(materialName);
+        if (material == materials.end()) return Fail("undeclared material '" + materialName + "'");
+
+        // The index has to fit the lower bits of a primitive reference
+        std::size_t count = keyword == "plane" ? scene.planes.size() : keyword == "sphere" ? scene.spheres.size() : keyword == "triangle" ? scene.triangles.size() : scene.disks.size();
+        if (count > PRIMITIVE_INDEX_MASK) return Fail("more " + keyword + "s than a primitive reference can index");
+
+        if (keyword == "plane") {
+            scene.planes.Add(origin, normal, material->second);
+        } else if (keyword == "sphere") {
+            scene.spheres.Add(origin, radius, material->second);
+        } else if (keyword == "triangle") {
+            scene.triangles.Add(origin, normal, c, material->second);
+        } else {
+            scene.disks.Add(origin, normal, radius, material->second);
+        }
+    }
+
+    std::cout << SCENE_HINT << "Loaded " << scene.PrimitiveCount() << " primitives from " << path << '\n';
+    return true;
+}
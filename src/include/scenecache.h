@@ -0,0 +1,464 @@
+#pragma once
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define PRISMATICA_HAVE_MMAP 1
+#else
+    #define PRISMATICA_HAVE_MMAP 0
+#endif
+
+#include <filesystem>
+
+// Binary scene cache. The file holds every array of a built Scene, BVH included, in the
+// layout the renderer traces from, so loading it is a single mmap and the arrays view
+// the mapping directly. Render processes on one host share the pages.
+//
+//   SceneCacheHeader
+//   SceneCacheArray  per array, in VisitSceneArrays() order
+//   SceneCacheSource per file the scene was loaded from, the scene file first
+//   source paths
+//   array data, every array aligned to SCENE_CACHE_ALIGNMENT
+//
+// The sources are stored with a hash of their content, a cache is only used while all of
+// them still hash the same. The layout word guards against caches written by a build
+// whose types differ in size or byte order.
+
+constexpr char SCENE_CACHE_MAGIC[8] = {'P', 'R', 'S', 'M', 'S', 'C', 'N', '\0'};
+constexpr std::uint32_t SCENE_CACHE_VERSION = 1;
+constexpr std::size_t SCENE_CACHE_ALIGNMENT = 64;
+
+class SceneCacheHeader {
+public:
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t layout;
+    std::uint32_t arrayCount;
+    std::uint32_t sourceCount;
+    float emitterPower;
+    std::uint32_t reserved;
+};
+
+class SceneCacheArray {
+public:
+    std::uint64_t offset;
+    std::uint64_t count;  // elements
+};
+
+class SceneCacheSource {
+public:
+    std::uint64_t hash;
+    std::uint64_t pathOffset;
+    std::uint64_t pathLength;
+};
+
+// Every array of the scene, in the order they are stored. SceneType is Scene or const Scene.
+template <typename SceneType, typename Visitor>
+void VisitSceneArrays(SceneType& scene, Visitor&& visit) {
+    visit(scene.spheres.centerX); visit(scene.spheres.centerY); visit(scene.spheres.centerZ);
+    visit(scene.spheres.radius); visit(scene.spheres.material);
+
+    visit(scene.planes.originX); visit(scene.planes.originY); visit(scene.planes.originZ);
+    visit(scene.planes.normalX); visit(scene.planes.normalY); visit(scene.planes.normalZ);
+    visit(scene.planes.material);
+
+    visit(scene.disks.originX); visit(scene.disks.originY); visit(scene.disks.originZ);
+    visit(scene.disks.normalX); visit(scene.disks.normalY); visit(scene.disks.normalZ);
+    visit(scene.disks.radius); visit(scene.disks.material);
+
+    visit(scene.triangles.v0X); visit(scene.triangles.v0Y); visit(scene.triangles.v0Z);
+    visit(scene.triangles.edge1X); visit(scene.triangles.edge1Y); visit(scene.triangles.edge1Z);
+    visit(scene.triangles.edge2X); visit(scene.triangles.edge2Y); visit(scene.triangles.edge2Z);
+    visit(scene.triangles.material);
+
+    visit(scene.bvh.nodes); visit(scene.bvh.primitives);
+    visit(scene.materials);
+    visit(scene.planeBlocks);
+    visit(scene.emitters); visit(scene.emitterCdf);
+}
+
+// Sizes of everything stored raw, and the byte order
+std::uint32_t SceneCacheLayout() {
+    const std::uint32_t one = 1;
+    unsigned char littleEndian;
+    std::memcpy(&littleEndian, &one, 1);
+
+    std::uint32_t layout = (std::uint32_t) sizeof(Material);
+    layout = layout * 31 + (std::uint32_t) sizeof(BVHNode);
+    layout = layout * 31 + (std::uint32_t) sizeof(MaterialId);
+    layout = layout * 31 + (std::uint32_t) PLANE_BLOCK_SIZE;
+    layout = layout * 31 + PRIMITIVE_INDEX_BITS;
+    return layout * 2 + littleEndian;
+}
+
+// FNV-1a over 64 bit words. Not cryptographic, it only has to notice edits. size has
+// to be a multiple of 8 except for the last call on a stream.
+std::uint64_t HashBytes(std::uint64_t hash, const unsigned char* data, const std::size_t& size) {
+    constexpr std::uint64_t PRIME = 0x100000001b3ull;
+    std::size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * PRIME;
+    }
+
+    for (; i < size; i++) hash = (hash ^ data[i]) * PRIME;
+    return hash;
+}
+
+bool HashFile(const std::string& path, std::uint64_t& hash) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+
+    std::vector<unsigned char> chunk(1 << 20);
+    std::uint64_t size = 0;
+    hash = 0xcbf29ce484222325ull;
+
+    while (file) {
+        file.read((char*) chunk.data(), (std::streamsize) chunk.size());
+        std::size_t got = (std::size_t) file.gcount();
+        hash = HashBytes(hash, chunk.data(), got);
+        size += got;
+    }
+
+    hash = HashBytes(hash, (const unsigned char*) &size, sizeof(size));
+    return true;
+}
+
+// A read-only view of a whole cache file. Scenes mapped from it hold a reference, so it
+// stays mapped as long as any of them is around.
+class SceneMapping {
+public:
+    const unsigned char* data = nullptr;
+    std::size_t size = 0;
+
+    SceneMapping() = default;
+    SceneMapping(const SceneMapping&) = delete;
+    SceneMapping& operator=(const SceneMapping&) = delete;
+
+    ~SceneMapping() {
+#if PRISMATICA_HAVE_MMAP
+        if (data) munmap((void*) data, size);
+#endif
+    }
+
+    bool Open(const std::string& path) {
+#if PRISMATICA_HAVE_MMAP
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat status;
+        if (fstat(fd, &status) != 0 || status.st_size <= 0) {
+            close(fd);
+            return false;
+        }
+
+        void* mapping = mmap(nullptr, (std::size_t) status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) return false;
+
+        data = (const unsigned char*) mapping;
+        size = (std::size_t) status.st_size;
+        return true;
+#else
+        // Without mmap the file is read once, the arrays still view the buffer in place
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+
+        file.seekg(0, std::ios::end);
+        size = (std::size_t) file.tellg();
+        file.seekg(0);
+
+        buffer.resize((size + SCENE_CACHE_ALIGNMENT - 1) / SCENE_CACHE_ALIGNMENT);
+        file.read((char*) buffer.data(), (std::streamsize) size);
+        data = (const unsigned char*) buffer.data();
+        return size > 0 && file;
+#endif
+    }
+
+private:
+#if !PRISMATICA_HAVE_MMAP
+    class alignas(SCENE_CACHE_ALIGNMENT) Block {
+    public:
+        unsigned char bytes[SCENE_CACHE_ALIGNMENT];
+    };
+
+    std::vector<Block> buffer;
+#endif
+};
+
+std::uint64_t AlignCacheOffset(const std::uint64_t& offset) {
+    return (offset + SCENE_CACHE_ALIGNMENT - 1) / SCENE_CACHE_ALIGNMENT * SCENE_CACHE_ALIGNMENT;
+}
+
+// Writes the built scene to path. The file is written next to it and renamed into
+// place, so processes that still map an older cache keep a consistent view.
+bool WriteSceneCache(const Scene& scene, const std::string& path) {
+    std::vector<std::string> sources;
+    std::vector<SceneCacheSource> sourceTable;
+
+    for (const std::string& source : scene.sources) {
+        std::uint64_t hash;
+        if (!HashFile(source, hash)) {
+            std::cerr << SCENE_HINT << "Could not read " << source << '\n';
+            return false;
+        }
+
+        std::error_code error;
+        std::filesystem::path absolute = std::filesystem::absolute(source, error);
+        sources.push_back(error ? source : absolute.lexically_normal().string());
+        sourceTable.push_back({hash, 0, sources.back().size()});
+    }
+
+    SceneCacheHeader header{};
+    std::memcpy(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = SCENE_CACHE_VERSION;
+    header.layout = SceneCacheLayout();
+    header.sourceCount = (std::uint32_t) sources.size();
+    header.emitterPower = scene.emitterPower;
+    VisitSceneArrays(scene, [&](const auto&) { header.arrayCount++; });
+
+    std::uint64_t offset = sizeof(header) + header.arrayCount * sizeof(SceneCacheArray) + sourceTable.size() * sizeof(SceneCacheSource);
+    for (SceneCacheSource& source : sourceTable) {
+        source.pathOffset = offset;
+        offset += source.pathLength;
+    }
+
+    std::vector<SceneCacheArray> arrayTable;
+    VisitSceneArrays(scene, [&](const auto& array) {
+        using Element = typename std::remove_reference<decltype(array[0])>::type;
+        static_assert(std::is_trivially_copyable<Element>::value, "cached arrays are stored as raw bytes");
+
+        offset = AlignCacheOffset(offset);
+        arrayTable.push_back({offset, array.size()});
+        offset += array.size() * sizeof(Element);
+    });
+
+    const std::string temporaryPath = path + ".tmp";
+    std::ofstream file(temporaryPath, std::ios::binary);
+
+    if (!file) {
+        std::cerr << SCENE_HINT << "Could not open " << temporaryPath << " for writing\n";
+        return false;
+    }
+
+    file.write((const char*) &header, sizeof(header));
+    file.write((const char*) arrayTable.data(), arrayTable.size() * sizeof(SceneCacheArray));
+    file.write((const char*) sourceTable.data(), sourceTable.size() * sizeof(SceneCacheSource));
+    for (const std::string& source : sources) file.write(source.data(), source.size());
+
+    std::size_t index = 0;
+    VisitSceneArrays(scene, [&](const auto& array) {
+        using Element = typename std::remove_reference<decltype(array[0])>::type;
+        static const char padding[SCENE_CACHE_ALIGNMENT] = {};
+
+        std::uint64_t position = (std::uint64_t) file.tellp();
+        file.write(padding, (std::streamsize) (arrayTable[index++].offset - position));
+        file.write((const char*) array.data(), (std::streamsize) (array.size() * sizeof(Element)));
+    });
+
+    file.close();
+
+    if (!file || std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        std::cerr << SCENE_HINT << "Could not write " << path << '\n';
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Cross-checks the arrays of a mapped scene, the intersection code indexes them without
+// bounds checks. A cache whose header and sizes look fine can still be truncated or
+// corrupt in between, so every index in it has to land inside its array: SoA components
+// of equal length, material ids, BVH children and leaf ranges, primitive and emitter
+// references. The BVH also has to fit the fixed traversal stacks.
+bool CheckSceneArrays(const Scene& scene, std::string& problem) {
+    auto Fail = [&](const std::string& message) {
+        problem = message;
+        return false;
+    };
+
+    auto Uniform = [](const std::size_t& count, std::initializer_list<std::size_t> sizes) {
+        for (std::size_t size : sizes) if (size != count) return false;
+        return true;
+    };
+
+    const SphereBuffer& spheres = scene.spheres;
+    const PlaneBuffer& planes = scene.planes;
+    const DiskBuffer& disks = scene.disks;
+    const TriangleBuffer& triangles = scene.triangles;
+
+    if (!Uniform(spheres.material.size(), {spheres.centerX.size(), spheres.centerY.size(), spheres.centerZ.size(), spheres.radius.size()})
+        || !Uniform(planes.material.size(), {planes.originX.size(), planes.originY.size(), planes.originZ.size(), planes.normalX.size(), planes.normalY.size(), planes.normalZ.size()})
+        || !Uniform(disks.material.size(), {disks.originX.size(), disks.originY.size(), disks.originZ.size(), disks.normalX.size(), disks.normalY.size(), disks.normalZ.size(), disks.radius.size()})
+        || !Uniform(triangles.material.size(), {triangles.v0X.size(), triangles.v0Y.size(), triangles.v0Z.size(), triangles.edge1X.size(), triangles.edge1Y.size(),
+                                                triangles.edge1Z.size(), triangles.edge2X.size(), triangles.edge2Y.size(), triangles.edge2Z.size()})) {
+        return Fail("primitive arrays of different lengths");
+    }
+
+    for (const MappedArray<MaterialId>* materials : {&spheres.material, &planes.material, &disks.material, &triangles.material}) {
+        for (MaterialId id : *materials) if (id >= scene.materials.size()) return Fail("material index out of range");
+    }
+
+    if (scene.planeBlocks.size() != (planes.size() + PLANE_BLOCK_SIZE - 1) / PLANE_BLOCK_SIZE * 6 * PLANE_BLOCK_SIZE) return Fail("plane blocks don't match the planes");
+
+    // Planes are traced from the blocks, only bounded primitives are referenced
+    auto ValidRef = [&](const std::uint32_t& ref) {
+        std::uint32_t i = PrimitiveIndexOf(ref);
+
+        switch (PrimitiveTypeOf(ref)) {
+            case PrimitiveType::Sphere: return i < spheres.size();
+            case PrimitiveType::Disk: return i < disks.size();
+            case PrimitiveType::Triangle: return i < triangles.size();
+            default: return false;
+        }
+    };
+
+    for (std::uint32_t ref : scene.bvh.primitives) if (!ValidRef(ref)) return Fail("BVH primitive out of range");
+    for (std::uint32_t ref : scene.emitters) if (!ValidRef(ref)) return Fail("emitter out of range");
+    if (scene.emitterCdf.size() != scene.emitters.size()) return Fail("emitter table of different lengths");
+
+    // Walks the tree the way traversal does. Every node can be reached once at most,
+    // which also catches cycles.
+    const MappedArray<BVHNode>& nodes = scene.bvh.nodes;
+    if (nodes.empty()) return scene.bvh.primitives.empty() || Fail("BVH primitives without nodes");
+
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> stack = {{0, 0}};  // node, depth
+    std::size_t visited = 0;
+
+    while (!stack.empty()) {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+        const BVHNode& node = nodes[index];
+
+        if (++visited > nodes.size()) return Fail("BVH nodes reached more than once");
+
+        if (node.IsLeaf()) {
+            if ((std::uint64_t) node.leftOrFirst + node.count > scene.bvh.primitives.size()) return Fail("BVH leaf out of range");
+            continue;
+        }
+
+        if (node.leftOrFirst == 0 || (std::uint64_t) node.leftOrFirst + 1 >= nodes.size()) return Fail("BVH child out of range");
+        if (depth + 1 >= (std::uint32_t) BVH_STACK_SIZE) return Fail("BVH deeper than the traversal stack");
+
+        stack.push_back({node.leftOrFirst, depth + 1});
+        stack.push_back({node.leftOrFirst + 1, depth + 1});
+    }
+
+    return true;
+}
+
+// Maps the cache at path into an empty scene. scenePath is the text scene the cache was
+// made from, it and the meshes recorded in the cache have to hash as they did when the
+// cache was written. False with the reason in stale if the cache can't be used.
+bool MapSceneCache(Scene& scene, const std::string& path, const std::string& scenePath, std::string& stale) {
+    auto mapping = std::make_shared<SceneMapping>();
+
+    if (!mapping->Open(path)) {
+        stale = "no cache at " + path;
+        return false;
+    }
+
+    const unsigned char* data = mapping->data;
+    const std::uint64_t size = mapping->size;
+    SceneCacheHeader header;
+
+    std::uint32_t expectedArrays = 0;
+    VisitSceneArrays(scene, [&](const auto&) { expectedArrays++; });
+
+    if (size < sizeof(header)) {
+        stale = "truncated cache";
+        return false;
+    }
+
+    std::memcpy(&header, data, sizeof(header));
+
+    if (std::memcmp(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic)) != 0) {
+        stale = path + " is not a scene cache";
+        return false;
+    }
+
+    if (header.version != SCENE_CACHE_VERSION || header.layout != SceneCacheLayout() || header.arrayCount != expectedArrays) {
+        stale = "cache written by a different build";
+        return false;
+    }
+
+    const std::uint64_t tablesEnd = sizeof(header) + header.arrayCount * sizeof(SceneCacheArray) + (std::uint64_t) header.sourceCount * sizeof(SceneCacheSource);
+    if (header.sourceCount == 0 || tablesEnd > size) {
+        stale = "truncated cache";
+        return false;
+    }
+
+    const SceneCacheArray* arrays = (const SceneCacheArray*) (data + sizeof(header));
+    const SceneCacheSource* sources = (const SceneCacheSource*) (arrays + header.arrayCount);
+    std::vector<std::string> sourcePaths;
+
+    for (std::uint32_t i = 0; i < header.sourceCount; i++) {
+        if (sources[i].pathOffset + sources[i].pathLength > size) {
+            stale = "truncated cache";
+            return false;
+        }
+
+        // The scene itself may have been given by another relative path since
+        std::string source((const char*) data + sources[i].pathOffset, sources[i].pathLength);
+        std::uint64_t hash;
+
+        if (!HashFile(i == 0 ? scenePath : source, hash) || hash != sources[i].hash) {
+            stale = (i == 0 ? scenePath : source) + " changed";
+            return false;
+        }
+
+        sourcePaths.push_back(source);
+    }
+
+    bool valid = true;
+    std::size_t index = 0;
+    VisitSceneArrays(scene, [&](auto& array) {
+        using Element = typename std::remove_const<typename std::remove_reference<decltype(array[0])>::type>::type;
+        const SceneCacheArray& entry = arrays[index++];
+
+        if (entry.offset % alignof(Element) != 0 || entry.offset > size || entry.count > (size - entry.offset) / sizeof(Element)) {
+            valid = false;
+            return;
+        }
+
+        array.Map((const Element*) (data + entry.offset), (std::size_t) entry.count);
+    });
+
+    std::string problem;
+
+    if (!valid || !CheckSceneArrays(scene, problem)) {
+        scene = Scene{};
+        stale = "corrupt cache" + (problem.empty() ? "" : ": " + problem);
+        return false;
+    }
+
+    scene.emitterPower = header.emitterPower;
+    scene.sources = sourcePaths;
+    scene.mapping = mapping;
+    return true;
+}
+
+// Maps the cache when it is up to date with the scene, otherwise loads the text scene,
+// builds it and rewrites the cache for the next run.
+bool LoadSceneCached(Scene& scene, const std::string& scenePath, const std::string& cachePath) {
+    std::string stale;
+
+    if (MapSceneCache(scene, cachePath, scenePath, stale)) {
+        std::cout << SCENE_HINT << "Mapped " << scene.PrimitiveCount() << " primitives and " << scene.bvh.nodes.size() << " BVH nodes from " << cachePath << '\n';
+        return true;
+    }
+
+    std::cout << SCENE_HINT << "Rebuilding " << cachePath << ": " << stale << '\n';
+    scene = Scene{};
+    if (!LoadScene(scene, scenePath)) return false;
+    BuildAccelerationStructure(scene);
+
+    // A cache that can't be written only costs the next start
+    if (WriteSceneCache(scene, cachePath)) std::cout << SCENE_HINT << "Wrote " << cachePath << '\n';
+    return true;
+}
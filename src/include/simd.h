@@ -0,0 +1,344 @@
+#pragma once
+
+#define SIMD_HINT "[\e[0;34mSIMD\033[0m]\t\t"
+
+// The SIMD kernels are compiled for every instruction set with GCC/Clang target
+// pragmas, so the binary itself doesn't need -march=native. The widest set the CPU
+// supports is picked at runtime, see DetectSimdISA().
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #define PRISMATICA_SIMD_X86 1
+    #include <immintrin.h>
+#else
+    #define PRISMATICA_SIMD_X86 0
+#endif
+
+enum class SimdISA {
+    Scalar,
+    SSE,
+    AVX2,
+    AVX512
+};
+
+constexpr int MAX_PACKET_SIZE = 16;
+
+// The multi-plane kernel has a fixed per-ray reduction cost, below this many planes
+// the scalar loop is faster (see prismatica_microbench)
+constexpr std::size_t SIMD_PLANE_THRESHOLD = 16;
+
+const char* SimdISAName(const SimdISA& isa) {
+    switch (isa) {
+        case SimdISA::SSE: return "sse4.1";
+        case SimdISA::AVX2: return "avx2";
+        case SimdISA::AVX512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+bool ParseSimdISA(const std::string& name, SimdISA& isa) {
+    for (SimdISA candidate : {SimdISA::Scalar, SimdISA::SSE, SimdISA::AVX2, SimdISA::AVX512}) {
+        if (name == SimdISAName(candidate)) {
+            isa = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool SimdISASupported(const SimdISA& isa) {
+#if PRISMATICA_SIMD_X86
+    switch (isa) {
+        case SimdISA::SSE: return __builtin_cpu_supports("sse4.1");
+        case SimdISA::AVX2: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case SimdISA::AVX512: return __builtin_cpu_supports("avx512f");
+        default: return true;
+    }
+#else
+    return isa == SimdISA::Scalar;
+#endif
+}
+
+SimdISA DetectSimdISA() {
+    for (SimdISA isa : {SimdISA::AVX512, SimdISA::AVX2, SimdISA::SSE}) {
+        if (SimdISASupported(isa)) return isa;
+    }
+
+    return SimdISA::Scalar;
+}
+
+// Up to MAX_PACKET_SIZE coherent rays in SoA layout. A kernel of width N only reads
+// and writes the first N lanes.
+class RayPacket {
+public:
+    alignas(64) float originX[MAX_PACKET_SIZE];
+    alignas(64) float originY[MAX_PACKET_SIZE];
+    alignas(64) float originZ[MAX_PACKET_SIZE];
+    alignas(64) float directionX[MAX_PACKET_SIZE];
+    alignas(64) float directionY[MAX_PACKET_SIZE];
+    alignas(64) float directionZ[MAX_PACKET_SIZE];
+    alignas(64) float t[MAX_PACKET_SIZE];
+    alignas(64) std::uint32_t ref[MAX_PACKET_SIZE];  // closest primitive, 0 if nothing was hit
+
+    void Set(const int& lane, const glm::vec3& origin, const glm::vec3& direction) {
+        originX[lane] = origin.x;
+        originY[lane] = origin.y;
+        originZ[lane] = origin.z;
+        directionX[lane] = direction.x;
+        directionY[lane] = direction.y;
+        directionZ[lane] = direction.z;
+        t[lane] = std::numeric_limits<float>::max();
+        ref[lane] = 0;
+    }
+};
+
+alignas(64) static const float SIMD_LANE_INDEX[MAX_PACKET_SIZE] = {
+    0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f, 8.0f, 9.0f, 10.0f, 11.0f, 12.0f, 13.0f, 14.0f, 15.0f
+};
+
+float BitsToFloat(const std::uint32_t& bits) {
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+#if PRISMATICA_SIMD_X86
+
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+namespace sse {
+    constexpr int WIDTH = 4;
+
+    struct vfloat { __m128 v; };
+    struct vmask { __m128 m; };
+
+    inline vfloat Set1(float x) { return {_mm_set1_ps(x)}; }
+    inline vfloat Load(const float* p) { return {_mm_load_ps(p)}; }
+    inline vfloat LoadU(const float* p) { return {_mm_loadu_ps(p)}; }
+    inline void Store(float* p, vfloat a) { _mm_store_ps(p, a.v); }
+    inline void StoreU(float* p, vfloat a) { _mm_storeu_ps(p, a.v); }
+
+    inline vfloat operator+(vfloat a, vfloat b) { return {_mm_add_ps(a.v, b.v)}; }
+    inline vfloat operator-(vfloat a, vfloat b) { return {_mm_sub_ps(a.v, b.v)}; }
+    inline vfloat operator*(vfloat a, vfloat b) { return {_mm_mul_ps(a.v, b.v)}; }
+    inline vfloat operator/(vfloat a, vfloat b) { return {_mm_div_ps(a.v, b.v)}; }
+    inline vfloat Min(vfloat a, vfloat b) { return {_mm_min_ps(a.v, b.v)}; }
+    inline vfloat Max(vfloat a, vfloat b) { return {_mm_max_ps(a.v, b.v)}; }
+    inline vfloat Sqrt(vfloat a) { return {_mm_sqrt_ps(a.v)}; }
+    inline vfloat Abs(vfloat a) { return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)}; }
+
+    inline vmask operator<(vfloat a, vfloat b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+    inline vmask operator<=(vfloat a, vfloat b) { return {_mm_cmple_ps(a.v, b.v)}; }
+    inline vmask operator>(vfloat a, vfloat b) { return {_mm_cmpgt_ps(a.v, b.v)}; }
+    inline vmask operator>=(vfloat a, vfloat b) { return {_mm_cmpge_ps(a.v, b.v)}; }
+    inline vmask operator&(vmask a, vmask b) { return {_mm_and_ps(a.m, b.m)}; }
+    inline vmask operator|(vmask a, vmask b) { return {_mm_or_ps(a.m, b.m)}; }
+
+    // a where the mask is set, b elsewhere
+    inline vfloat Select(vmask m, vfloat a, vfloat b) { return {_mm_blendv_ps(b.v, a.v, m.m)}; }
+    inline bool Any(vmask m) { return _mm_movemask_ps(m.m) != 0; }
+    inline bool All(vmask m) { return _mm_movemask_ps(m.m) == 0xf; }
+
+    inline float HMin(vfloat a) {
+        __m128 m = _mm_min_ps(a.v, _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 3, 0, 1)));
+        m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm_cvtss_f32(m);
+    }
+
+    inline vfloat Floor(vfloat a) { return {_mm_floor_ps(a.v)}; }
+
+    // 2^n for integral n in [-126, 127], built directly in the exponent bits
+    inline vfloat Pow2(vfloat n) {
+        return {_mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n.v), _mm_set1_epi32(127)), 23))};
+    }
+
+    // table[index] per lane, the index is truncated. SSE has no gather instruction.
+    inline vfloat Gather(const float* table, vfloat index) {
+        alignas(16) std::int32_t i[WIDTH];
+        _mm_store_si128((__m128i*) i, _mm_cvttps_epi32(index.v));
+        return {_mm_set_ps(table[i[3]], table[i[2]], table[i[1]], table[i[0]])};
+    }
+
+    // Rounds to nearest and stores WIDTH bytes, saturated to [0, 255]
+    inline void StoreBytes(unsigned char* p, vfloat a) {
+        __m128i words = _mm_packus_epi32(_mm_cvtps_epi32(a.v), _mm_setzero_si128());
+        std::int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+        std::memcpy(p, &bytes, WIDTH);
+    }
+
+    #include "simd_kernels.inl"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+namespace avx2 {
+    constexpr int WIDTH = 8;
+
+    struct vfloat { __m256 v; };
+    struct vmask { __m256 m; };
+
+    inline vfloat Set1(float x) { return {_mm256_set1_ps(x)}; }
+    inline vfloat Load(const float* p) { return {_mm256_load_ps(p)}; }
+    inline vfloat LoadU(const float* p) { return {_mm256_loadu_ps(p)}; }
+    inline void Store(float* p, vfloat a) { _mm256_store_ps(p, a.v); }
+    inline void StoreU(float* p, vfloat a) { _mm256_storeu_ps(p, a.v); }
+
+    inline vfloat operator+(vfloat a, vfloat b) { return {_mm256_add_ps(a.v, b.v)}; }
+    inline vfloat operator-(vfloat a, vfloat b) { return {_mm256_sub_ps(a.v, b.v)}; }
+    inline vfloat operator*(vfloat a, vfloat b) { return {_mm256_mul_ps(a.v, b.v)}; }
+    inline vfloat operator/(vfloat a, vfloat b) { return {_mm256_div_ps(a.v, b.v)}; }
+    inline vfloat Min(vfloat a, vfloat b) { return {_mm256_min_ps(a.v, b.v)}; }
+    inline vfloat Max(vfloat a, vfloat b) { return {_mm256_max_ps(a.v, b.v)}; }
+    inline vfloat Sqrt(vfloat a) { return {_mm256_sqrt_ps(a.v)}; }
+    inline vfloat Abs(vfloat a) { return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)}; }
+
+    inline vmask operator<(vfloat a, vfloat b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+    inline vmask operator<=(vfloat a, vfloat b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)}; }
+    inline vmask operator>(vfloat a, vfloat b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+    inline vmask operator>=(vfloat a, vfloat b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)}; }
+    inline vmask operator&(vmask a, vmask b) { return {_mm256_and_ps(a.m, b.m)}; }
+    inline vmask operator|(vmask a, vmask b) { return {_mm256_or_ps(a.m, b.m)}; }
+
+    inline vfloat Select(vmask m, vfloat a, vfloat b) { return {_mm256_blendv_ps(b.v, a.v, m.m)}; }
+    inline bool Any(vmask m) { return _mm256_movemask_ps(m.m) != 0; }
+    inline bool All(vmask m) { return _mm256_movemask_ps(m.m) == 0xff; }
+
+    inline float HMin(vfloat a) {
+        __m128 m = _mm_min_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+        m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+        m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm_cvtss_f32(m);
+    }
+
+    inline vfloat Floor(vfloat a) { return {_mm256_floor_ps(a.v)}; }
+
+    inline vfloat Pow2(vfloat n) {
+        return {_mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127)), 23))};
+    }
+
+    inline vfloat Gather(const float* table, vfloat index) {
+        return {_mm256_i32gather_ps(table, _mm256_cvttps_epi32(index.v), 4)};
+    }
+
+    inline void StoreBytes(unsigned char* p, vfloat a) {
+        __m256i dwords = _mm256_cvtps_epi32(a.v);
+        __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(dwords), _mm256_extracti128_si256(dwords, 1));
+        _mm_storel_epi64((__m128i*) p, _mm_packus_epi16(words, words));
+    }
+
+    #include "simd_kernels.inl"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+namespace avx512 {
+    constexpr int WIDTH = 16;
+
+    struct vfloat { __m512 v; };
+    struct vmask { __mmask16 m; };
+
+    inline vfloat Set1(float x) { return {_mm512_set1_ps(x)}; }
+    inline vfloat Load(const float* p) { return {_mm512_load_ps(p)}; }
+    inline vfloat LoadU(const float* p) { return {_mm512_loadu_ps(p)}; }
+    inline void Store(float* p, vfloat a) { _mm512_store_ps(p, a.v); }
+    inline void StoreU(float* p, vfloat a) { _mm512_storeu_ps(p, a.v); }
+
+    inline vfloat operator+(vfloat a, vfloat b) { return {_mm512_add_ps(a.v, b.v)}; }
+    inline vfloat operator-(vfloat a, vfloat b) { return {_mm512_sub_ps(a.v, b.v)}; }
+    inline vfloat operator*(vfloat a, vfloat b) { return {_mm512_mul_ps(a.v, b.v)}; }
+    inline vfloat operator/(vfloat a, vfloat b) { return {_mm512_div_ps(a.v, b.v)}; }
+    inline vfloat Min(vfloat a, vfloat b) { return {_mm512_min_ps(a.v, b.v)}; }
+    inline vfloat Max(vfloat a, vfloat b) { return {_mm512_max_ps(a.v, b.v)}; }
+    inline vfloat Sqrt(vfloat a) { return {_mm512_sqrt_ps(a.v)}; }
+    inline vfloat Abs(vfloat a) { return {_mm512_abs_ps(a.v)}; }
+
+    inline vmask operator<(vfloat a, vfloat b) { return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ)}; }
+    inline vmask operator<=(vfloat a, vfloat b) { return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ)}; }
+    inline vmask operator>(vfloat a, vfloat b) { return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ)}; }
+    inline vmask operator>=(vfloat a, vfloat b) { return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ)}; }
+    inline vmask operator&(vmask a, vmask b) { return {(__mmask16) (a.m & b.m)}; }
+    inline vmask operator|(vmask a, vmask b) { return {(__mmask16) (a.m | b.m)}; }
+
+    inline vfloat Select(vmask m, vfloat a, vfloat b) { return {_mm512_mask_blend_ps(m.m, b.v, a.v)}; }
+    inline bool Any(vmask m) { return m.m != 0; }
+    inline bool All(vmask m) { return m.m == 0xffff; }
+    inline float HMin(vfloat a) { return _mm512_reduce_min_ps(a.v); }
+
+    inline vfloat Floor(vfloat a) { return {_mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC)}; }
+
+    inline vfloat Pow2(vfloat n) { return {_mm512_scalef_ps(_mm512_set1_ps(1.0f), n.v)}; }
+
+    inline vfloat Gather(const float* table, vfloat index) {
+        return {_mm512_i32gather_ps(_mm512_cvttps_epi32(index.v), table, 4)};
+    }
+
+    inline void StoreBytes(unsigned char* p, vfloat a) {
+        __m512i dwords = _mm512_max_epi32(_mm512_cvtps_epi32(a.v), _mm512_setzero_si512());
+        _mm_storeu_si128((__m128i*) p, _mm512_cvtusepi32_epi8(dwords));
+    }
+
+    #include "simd_kernels.inl"
+}
+#pragma GCC pop_options
+
+#endif
+
+// Function table for the instruction set picked at startup. packetSize is 1 for the
+// scalar path, in which case the table entries stay empty.
+class SimdKernels {
+public:
+    SimdISA isa = SimdISA::Scalar;
+    int packetSize = 1;
+    void (*tracePacket)(const Scene&, RayPacket&) = nullptr;
+    bool (*closestPlane)(const Scene&, const glm::vec3&, const glm::vec3&, float&, std::uint32_t&) = nullptr;
+    void (*occludedPacket)(const Scene&, RayPacket&) = nullptr;
+    bool (*anyPlane)(const Scene&, const glm::vec3&, const glm::vec3&, const float&) = nullptr;
+    void (*postProcessSpan)(const float*, unsigned char*, const std::size_t&, const std::size_t&, const std::size_t&, const DisplaySettings&) = nullptr;
+    void (*aTrousSpan)(const DenoiseFeatures&, const DenoiseColor&, DenoiseColor&, const std::size_t&, const std::size_t&, const std::size_t&, const int&, const DenoiseSettings&) = nullptr;
+};
+
+SimdKernels SelectSimdKernels(const SimdISA& isa) {
+    SimdKernels kernels{};
+    kernels.isa = isa;
+
+    switch (isa) {
+#if PRISMATICA_SIMD_X86
+        case SimdISA::SSE:
+            kernels.packetSize = sse::WIDTH;
+            kernels.tracePacket = sse::TracePacket;
+            kernels.closestPlane = sse::ClosestPlane;
+            kernels.occludedPacket = sse::OccludedPacket;
+            kernels.anyPlane = sse::AnyPlane;
+            kernels.postProcessSpan = sse::PostProcessSpan;
+            kernels.aTrousSpan = sse::ATrousSpan;
+            break;
+        case SimdISA::AVX2:
+            kernels.packetSize = avx2::WIDTH;
+            kernels.tracePacket = avx2::TracePacket;
+            kernels.closestPlane = avx2::ClosestPlane;
+            kernels.occludedPacket = avx2::OccludedPacket;
+            kernels.anyPlane = avx2::AnyPlane;
+            kernels.postProcessSpan = avx2::PostProcessSpan;
+            kernels.aTrousSpan = avx2::ATrousSpan;
+            break;
+        case SimdISA::AVX512:
+            kernels.packetSize = avx512::WIDTH;
+            kernels.tracePacket = avx512::TracePacket;
+            kernels.closestPlane = avx512::ClosestPlane;
+            kernels.occludedPacket = avx512::OccludedPacket;
+            kernels.anyPlane = avx512::AnyPlane;
+            kernels.postProcessSpan = avx512::PostProcessSpan;
+            kernels.aTrousSpan = avx512::ATrousSpan;
+            break;
+#endif
+        default:
+            kernels.isa = SimdISA::Scalar;
+            break;
+    }
+
+    return kernels;
+}
+
+// Chosen once in main() before any render thread starts
+SimdKernels simdKernels{};
@@ -0,0 +1,505 @@
+// Generic packet and multi-primitive kernels.
+//
+// Included once per instruction set from simd.h, inside a namespace that provides
+// vfloat, vmask, WIDTH and the basic vector operations. Don't include it anywhere else.
+
+class PacketRays {
+public:
+    vfloat originX, originY, originZ;
+    vfloat directionX, directionY, directionZ;
+    vfloat invDirectionX, invDirectionY, invDirectionZ;
+    vfloat t;
+    vfloat ref;  // primitive references stored as raw bits
+
+    void Commit(const vmask& hit, const vfloat& tHit, const std::uint32_t& primitive) {
+        t = Select(hit, tHit, t);
+        ref = Select(hit, Set1(BitsToFloat(primitive)), ref);
+    }
+};
+
+inline vfloat SafeInverse(const vfloat& direction) {
+    vmask tiny = Abs(direction) < Set1(BVH_MIN_DIRECTION);
+    return Set1(1.0f) / Select(tiny, Set1(BVH_MIN_DIRECTION), direction);
+}
+
+inline vmask IntersectAABB(const BVHNode& node, const PacketRays& rays, vfloat& tNear) {
+    vfloat tx0 = (Set1(node.boundsMin[0]) - rays.originX) * rays.invDirectionX;
+    vfloat tx1 = (Set1(node.boundsMax[0]) - rays.originX) * rays.invDirectionX;
+    vfloat ty0 = (Set1(node.boundsMin[1]) - rays.originY) * rays.invDirectionY;
+    vfloat ty1 = (Set1(node.boundsMax[1]) - rays.originY) * rays.invDirectionY;
+    vfloat tz0 = (Set1(node.boundsMin[2]) - rays.originZ) * rays.invDirectionZ;
+    vfloat tz1 = (Set1(node.boundsMax[2]) - rays.originZ) * rays.invDirectionZ;
+
+    tNear = Max(Max(Min(tx0, tx1), Min(ty0, ty1)), Max(Min(tz0, tz1), Set1(0.0f)));
+    vfloat tFar = Min(Min(Max(tx0, tx1), Max(ty0, ty1)), Min(Max(tz0, tz1), rays.t));
+
+    return tNear <= tFar;
+}
+
+inline void IntersectSphere(PacketRays& rays, const glm::vec3& center, const float& radius, const std::uint32_t& primitive) {
+    vfloat deltaX = Set1(center.x) - rays.originX;
+    vfloat deltaY = Set1(center.y) - rays.originY;
+    vfloat deltaZ = Set1(center.z) - rays.originZ;
+
+    vfloat tca = deltaX * rays.directionX + deltaY * rays.directionY + deltaZ * rays.directionZ;
+    vfloat d2 = deltaX * deltaX + deltaY * deltaY + deltaZ * deltaZ - tca * tca;
+    vfloat r2 = Set1(radius * radius);
+    vmask hit = d2 <= r2;
+    if (!Any(hit)) return;
+
+    vfloat thc = Sqrt(Max(r2 - d2, Set1(0.0f)));
+    vfloat t0 = tca - thc;
+    vfloat t1 = tca + thc;
+    vfloat t = Select(t0 < Set1(0.0f), t1, t0);
+
+    hit = hit & (t >= Set1(0.0f)) & (t < rays.t);
+    rays.Commit(hit, t, primitive);
+}
+
+inline vmask IntersectPlane(vfloat& t, const PacketRays& rays, const glm::vec3& origin, const glm::vec3& normal) {
+    vfloat nX = Set1(normal.x), nY = Set1(normal.y), nZ = Set1(normal.z);
+    vfloat denom = nX * rays.directionX + nY * rays.directionY + nZ * rays.directionZ;
+    vfloat dist = (Set1(origin.x) - rays.originX) * nX + (Set1(origin.y) - rays.originY) * nY + (Set1(origin.z) - rays.originZ) * nZ;
+
+    t = dist / denom;
+    return (Abs(denom) >= Set1(1e-6f)) & (t >= Set1(0.0f)) & (t < rays.t);
+}
+
+inline void IntersectPlane(PacketRays& rays, const glm::vec3& origin, const glm::vec3& normal, const std::uint32_t& primitive) {
+    vfloat t;
+    vmask hit = IntersectPlane(t, rays, origin, normal);
+    rays.Commit(hit, t, primitive);
+}
+
+inline void IntersectDisk(PacketRays& rays, const glm::vec3& origin, const glm::vec3& normal, const float& radius, const std::uint32_t& primitive) {
+    vfloat t;
+    vmask hit = IntersectPlane(t, rays, origin, normal);
+    if (!Any(hit)) return;
+
+    vfloat dX = rays.originX + rays.directionX * t - Set1(origin.x);
+    vfloat dY = rays.originY + rays.directionY * t - Set1(origin.y);
+    vfloat dZ = rays.originZ + rays.directionZ * t - Set1(origin.z);
+
+    hit = hit & (dX * dX + dY * dY + dZ * dZ < Set1(radius * radius));
+    rays.Commit(hit, t, primitive);
+}
+
+inline void IntersectTriangle(PacketRays& rays, const glm::vec3& v0, const glm::vec3& edge1, const glm::vec3& edge2, const std::uint32_t& primitive) {
+    // Moeller-Trumbore, one triangle against the whole packet
+    vfloat e1X = Set1(edge1.x), e1Y = Set1(edge1.y), e1Z = Set1(edge1.z);
+    vfloat e2X = Set1(edge2.x), e2Y = Set1(edge2.y), e2Z = Set1(edge2.z);
+
+    vfloat pX = rays.directionY * e2Z - rays.directionZ * e2Y;
+    vfloat pY = rays.directionZ * e2X - rays.directionX * e2Z;
+    vfloat pZ = rays.directionX * e2Y - rays.directionY * e2X;
+
+    vfloat det = e1X * pX + e1Y * pY + e1Z * pZ;
+    vmask hit = Abs(det) >= Set1(1e-9f);
+    if (!Any(hit)) return;
+
+    vfloat invDet = Set1(1.0f) / det;
+    vfloat sX = rays.originX - Set1(v0.x);
+    vfloat sY = rays.originY - Set1(v0.y);
+    vfloat sZ = rays.originZ - Set1(v0.z);
+
+    vfloat u = (sX * pX + sY * pY + sZ * pZ) * invDet;
+    hit = hit & (u >= Set1(0.0f)) & (u <= Set1(1.0f));
+    if (!Any(hit)) return;
+
+    vfloat qX = sY * e1Z - sZ * e1Y;
+    vfloat qY = sZ * e1X - sX * e1Z;
+    vfloat qZ = sX * e1Y - sY * e1X;
+
+    vfloat v = (rays.directionX * qX + rays.directionY * qY + rays.directionZ * qZ) * invDet;
+    vfloat t = (e2X * qX + e2Y * qY + e2Z * qZ) * invDet;
+
+    hit = hit & (v >= Set1(0.0f)) & (u + v <= Set1(1.0f)) & (t >= Set1(0.0f)) & (t < rays.t);
+    rays.Commit(hit, t, primitive);
+}
+
+// Closest hit for the first WIDTH rays of the packet. The packet descends into a node
+// as long as any of its rays still hits it.
+void TracePacket(const Scene& scene, RayPacket& packet) {
+    PacketRays rays;
+    rays.originX = Load(packet.originX);
+    rays.originY = Load(packet.originY);
+    rays.originZ = Load(packet.originZ);
+    rays.directionX = Load(packet.directionX);
+    rays.directionY = Load(packet.directionY);
+    rays.directionZ = Load(packet.directionZ);
+    rays.invDirectionX = SafeInverse(rays.directionX);
+    rays.invDirectionY = SafeInverse(rays.directionY);
+    rays.invDirectionZ = SafeInverse(rays.directionZ);
+    rays.t = Load(packet.t);
+    rays.ref = Set1(BitsToFloat(0));
+
+    const PlaneBuffer& planes = scene.planes;
+    PROFILE_ADD(ProfileCounter::PacketPrimitiveTests, planes.size());
+
+    for (std::size_t i = 0; i < planes.size(); i++) {
+        IntersectPlane(rays, planes.Origin(i), planes.Normal(i), PackPrimitive(PrimitiveType::Plane, i));
+    }
+
+    const BVH& bvh = scene.bvh;
+    vfloat tNear, tFar;
+
+    if (!bvh.empty() && Any(IntersectAABB(bvh.nodes[0], rays, tNear))) {
+        std::uint32_t stack[BVH_STACK_SIZE];
+        int stackSize = 0;
+        const BVHNode* node = &bvh.nodes[0];
+
+        while (true) {
+            PROFILE_COUNT(ProfileCounter::BVHNodes);
+
+            if (node->IsLeaf()) {
+                PROFILE_ADD(ProfileCounter::PacketPrimitiveTests, node->count);
+
+                for (std::uint32_t i = node->leftOrFirst; i < node->leftOrFirst + node->count; i++) {
+                    std::uint32_t ref = bvh.primitives[i];
+                    std::uint32_t index = PrimitiveIndexOf(ref);
+
+                    switch (PrimitiveTypeOf(ref)) {
+                        case PrimitiveType::Sphere:
+                            IntersectSphere(rays, scene.spheres.Center(index), scene.spheres.radius[index], ref);
+                            break;
+                        case PrimitiveType::Disk:
+                            IntersectDisk(rays, scene.disks.Origin(index), scene.disks.Normal(index), scene.disks.radius[index], ref);
+                            break;
+                        case PrimitiveType::Triangle:
+                            IntersectTriangle(rays, scene.triangles.Vertex0(index), scene.triangles.Edge1(index), scene.triangles.Edge2(index), ref);
+                            break;
+                        default:
+                            break;
+                    }
+                }
+            } else {
+                std::uint32_t nearIndex = node->leftOrFirst;
+                std::uint32_t farIndex = nearIndex + 1;
+                vmask nearHit = IntersectAABB(bvh.nodes[nearIndex], rays, tNear);
+                vmask farHit = IntersectAABB(bvh.nodes[farIndex], rays, tFar);
+                bool anyNear = Any(nearHit);
+                bool anyFar = Any(farHit);
+
+                if (anyNear && anyFar) {
+                    // Order by the closest entry of any active ray
+                    const vfloat miss = Set1(std::numeric_limits<float>::max());
+                    if (HMin(Select(farHit, tFar, miss)) < HMin(Select(nearHit, tNear, miss))) std::swap(nearIndex, farIndex);
+
+                    stack[stackSize++] = farIndex;
+                    node = &bvh.nodes[nearIndex];
+                    continue;
+                } else if (anyNear || anyFar) {
+                    node = &bvh.nodes[anyNear ? nearIndex : farIndex];
+                    continue;
+                }
+            }
+
+            // Rays may have found closer hits since the node was pushed, re-test before descending
+            bool found = false;
+            while (stackSize > 0) {
+                const BVHNode* candidate = &bvh.nodes[stack[--stackSize]];
+                if (Any(IntersectAABB(*candidate, rays, tNear))) {
+                    node = candidate;
+                    found = true;
+                    break;
+                }
+            }
+
+            if (!found) break;
+        }
+    }
+
+    Store(packet.t, rays.t);
+    Store(reinterpret_cast<float*>(packet.ref), rays.ref);
+}
+
+// Any-hit for the first WIDTH rays of the packet, each up to its own t. Occluded rays get
+// a negative t, which also takes them out of every further box and primitive test, and
+// the traversal ends once all rays are occluded.
+void OccludedPacket(const Scene& scene, RayPacket& packet) {
+    PacketRays rays;
+    rays.originX = Load(packet.originX);
+    rays.originY = Load(packet.originY);
+    rays.originZ = Load(packet.originZ);
+    rays.directionX = Load(packet.directionX);
+    rays.directionY = Load(packet.directionY);
+    rays.directionZ = Load(packet.directionZ);
+    rays.invDirectionX = SafeInverse(rays.directionX);
+    rays.invDirectionY = SafeInverse(rays.directionY);
+    rays.invDirectionZ = SafeInverse(rays.directionZ);
+    rays.t = Load(packet.t);
+    rays.ref = Set1(BitsToFloat(0));
+
+    const vfloat tMax = rays.t;
+    const vfloat occludedT = Set1(-1.0f);
+
+    // Primitive tests shorten t like for closest hits, any shortened ray is occluded
+    auto Retire = [&]() {
+        vmask occluded = rays.t < tMax;
+        rays.t = Select(occluded, occludedT, rays.t);
+        return All(rays.t < Set1(0.0f));
+    };
+
+    const PlaneBuffer& planes = scene.planes;
+    PROFILE_ADD(ProfileCounter::PacketPrimitiveTests, planes.size());
+
+    for (std::size_t i = 0; i < planes.size(); i++) {
+        IntersectPlane(rays, planes.Origin(i), planes.Normal(i), PackPrimitive(PrimitiveType::Plane, i));
+    }
+
+    const BVH& bvh = scene.bvh;
+    vfloat tNear;
+    bool done = Retire();
+
+    if (!done && !bvh.empty() && Any(IntersectAABB(bvh.nodes[0], rays, tNear))) {
+        std::uint32_t stack[BVH_STACK_SIZE];
+        int stackSize = 0;
+        const BVHNode* node = &bvh.nodes[0];
+
+        while (true) {
+            PROFILE_COUNT(ProfileCounter::BVHNodes);
+
+            if (node->IsLeaf()) {
+                PROFILE_ADD(ProfileCounter::PacketPrimitiveTests, node->count);
+
+                for (std::uint32_t i = node->leftOrFirst; i < node->leftOrFirst + node->count; i++) {
+                    std::uint32_t ref = bvh.primitives[i];
+                    std::uint32_t index = PrimitiveIndexOf(ref);
+
+                    switch (PrimitiveTypeOf(ref)) {
+                        case PrimitiveType::Sphere:
+                            IntersectSphere(rays, scene.spheres.Center(index), scene.spheres.radius[index], ref);
+                            break;
+                        case PrimitiveType::Disk:
+                            IntersectDisk(rays, scene.disks.Origin(index), scene.disks.Normal(index), scene.disks.radius[index], ref);
+                            break;
+                        case PrimitiveType::Triangle:
+                            IntersectTriangle(rays, scene.triangles.Vertex0(index), scene.triangles.Edge1(index), scene.triangles.Edge2(index), ref);
+                            break;
+                        default:
+                            break;
+                    }
+                }
+
+                if (Retire()) break;
+            } else {
+                std::uint32_t first = node->leftOrFirst;
+                bool hitFirst = Any(IntersectAABB(bvh.nodes[first], rays, tNear));
+                bool hitSecond = Any(IntersectAABB(bvh.nodes[first + 1], rays, tNear));
+
+                if (hitFirst || hitSecond) {
+                    if (hitFirst && hitSecond) stack[stackSize++] = first + 1;
+                    node = &bvh.nodes[hitFirst ? first : first + 1];
+                    continue;
+                }
+            }
+
+            // Rays occluded since the node was pushed no longer count
+            bool found = false;
+            while (stackSize > 0) {
+                const BVHNode* candidate = &bvh.nodes[stack[--stackSize]];
+                if (Any(IntersectAABB(*candidate, rays, tNear))) {
+                    node = candidate;
+                    found = true;
+                    break;
+                }
+            }
+
+            if (!found) break;
+        }
+    }
+
+    Store(packet.t, rays.t);
+}
+
+// One ray against WIDTH planes at a time, true as soon as one lies in front of tMax
+bool AnyPlane(const Scene& scene, const glm::vec3& rayOrigin, const glm::vec3& rayDirection, const float& tMax) {
+    const vfloat originX = Set1(rayOrigin.x), originY = Set1(rayOrigin.y), originZ = Set1(rayOrigin.z);
+    const vfloat directionX = Set1(rayDirection.x), directionY = Set1(rayDirection.y), directionZ = Set1(rayDirection.z);
+    const vfloat limit = Set1(tMax);
+
+    const std::size_t count = scene.planes.size();
+    const float* blocks = scene.planeBlocks.data();
+
+    for (std::size_t first = 0; first < count; first += WIDTH) {
+        const float* block = blocks + (first / PLANE_BLOCK_SIZE) * 6 * PLANE_BLOCK_SIZE + first % PLANE_BLOCK_SIZE;
+
+        vfloat pX = LoadU(block + 0 * PLANE_BLOCK_SIZE);
+        vfloat pY = LoadU(block + 1 * PLANE_BLOCK_SIZE);
+        vfloat pZ = LoadU(block + 2 * PLANE_BLOCK_SIZE);
+        vfloat nX = LoadU(block + 3 * PLANE_BLOCK_SIZE);
+        vfloat nY = LoadU(block + 4 * PLANE_BLOCK_SIZE);
+        vfloat nZ = LoadU(block + 5 * PLANE_BLOCK_SIZE);
+
+        vfloat denom = nX * directionX + nY * directionY + nZ * directionZ;
+        vfloat t = ((pX - originX) * nX + (pY - originY) * nY + (pZ - originZ) * nZ) / denom;
+        if (Any((Abs(denom) >= Set1(1e-6f)) & (t >= Set1(0.0f)) & (t < limit))) return true;
+    }
+
+    return false;
+}
+
+// One ray against WIDTH planes at a time. Updates closestT and ref if a plane is closer.
+bool ClosestPlane(const Scene& scene, const glm::vec3& rayOrigin, const glm::vec3& rayDirection, float& closestT, std::uint32_t& ref) {
+    const vfloat originX = Set1(rayOrigin.x), originY = Set1(rayOrigin.y), originZ = Set1(rayOrigin.z);
+    const vfloat directionX = Set1(rayDirection.x), directionY = Set1(rayDirection.y), directionZ = Set1(rayDirection.z);
+    vfloat bestT = Set1(closestT);
+    vfloat bestIndex = Set1(-1.0f);
+
+    const std::size_t count = scene.planes.size();
+    const float* blocks = scene.planeBlocks.data();
+
+    for (std::size_t first = 0; first < count; first += WIDTH) {
+        const float* block = blocks + (first / PLANE_BLOCK_SIZE) * 6 * PLANE_BLOCK_SIZE + first % PLANE_BLOCK_SIZE;
+
+        vfloat pX = LoadU(block + 0 * PLANE_BLOCK_SIZE);
+        vfloat pY = LoadU(block + 1 * PLANE_BLOCK_SIZE);
+        vfloat pZ = LoadU(block + 2 * PLANE_BLOCK_SIZE);
+        vfloat nX = LoadU(block + 3 * PLANE_BLOCK_SIZE);
+        vfloat nY = LoadU(block + 4 * PLANE_BLOCK_SIZE);
+        vfloat nZ = LoadU(block + 5 * PLANE_BLOCK_SIZE);
+
+        vfloat denom = nX * directionX + nY * directionY + nZ * directionZ;
+        vfloat t = ((pX - originX) * nX + (pY - originY) * nY + (pZ - originZ) * nZ) / denom;
+        vmask hit = (Abs(denom) >= Set1(1e-6f)) & (t >= Set1(0.0f)) & (t < bestT);
+
+        bestT = Select(hit, t, bestT);
+        bestIndex = Select(hit, Load(SIMD_LANE_INDEX) + Set1((float) first), bestIndex);
+    }
+
+    alignas(64) float lanesT[WIDTH];
+    alignas(64) float lanesIndex[WIDTH];
+    Store(lanesT, bestT);
+    Store(lanesIndex, bestIndex);
+
+    bool found = false;
+    if (HMin(bestT) >= closestT) return false;
+
+    for (int lane = 0; lane < WIDTH; lane++) {
+        if (lanesIndex[lane] >= 0.0f && lanesT[lane] < closestT) {
+            closestT = lanesT[lane];
+            ref = PackPrimitive(PrimitiveType::Plane, (std::size_t) lanesIndex[lane]);
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+// Display transform of count channel values of row y, see DisplayValue(). first is the
+// position of linear[0] within the row and selects the dither noise.
+void PostProcessSpan(const float* linear, unsigned char* out, const std::size_t& count, const std::size_t& first, const std::size_t& y, const DisplaySettings& display) {
+    const float* lut = SrgbLut();
+    const float scale = std::exp2(display.exposure);
+    const vfloat zero = Set1(0.0f), one = Set1(1.0f);
+    const vfloat rowNoise = Set1(0.00583715f * y);
+    const bool aces = display.toneMapper == ToneMapper::ACES;
+
+    std::size_t i = 0;
+    for (; i + WIDTH <= count; i += WIDTH) {
+        vfloat x = Min(Max(LoadU(linear + i) * Set1(scale), zero), Set1(DISPLAY_MAX_LINEAR));
+
+        if (aces) {
+            x = Min((x * (Set1(2.51f) * x + Set1(0.03f))) / (x * (Set1(2.43f) * x + Set1(0.59f)) + Set1(0.14f)), one);
+        } else {
+            x = x / (x + one);
+        }
+
+        vfloat value = Gather(lut, Sqrt(x) * Set1((float) (SRGB_LUT_SIZE - 1)) + Set1(0.5f));
+
+        if (display.dither) {
+            vfloat f = Set1(0.06711056f) * (Load(SIMD_LANE_INDEX) + Set1((float) (first + i))) + rowNoise;
+            f = Set1(52.9829189f) * (f - Floor(f));
+            value = value + (f - Floor(f)) - Set1(0.5f);
+        }
+
+        StoreBytes(out + i, Min(Max(value, zero), Set1(255.0f)));
+    }
+
+    for (; i < count; i++) {
+        float noise = display.dither ? InterleavedGradientNoise((float) (first + i), (float) y) : 0.5f;
+        out[i] = DisplayValue(linear[i], noise, scale, display.toneMapper, lut);
+    }
+}
+
+// e^x for x <= 0, flushed to 0 below -87. Cephes' exp2f polynomial on [-0.5, 0.5], about
+// one ulp from std::exp.
+inline vfloat Exp(vfloat x) {
+    vfloat t = Max(x, Set1(-87.0f)) * Set1(1.44269504f);
+    vfloat n = Floor(t + Set1(0.5f));
+    vfloat f = t - n;
+
+    vfloat p = Set1(1.535336188319500e-4f);
+    p = p * f + Set1(1.339887440266574e-3f);
+    p = p * f + Set1(9.618437357674640e-3f);
+    p = p * f + Set1(5.550332471162809e-2f);
+    p = p * f + Set1(2.402264791363012e-1f);
+    p = p * f + Set1(6.931472028550421e-1f);
+    p = p * f + Set1(1.0f);
+    return Select(x < Set1(-87.0f), Set1(0.0f), p * Pow2(n));
+}
+
+inline vfloat LuminanceOf(vfloat r, vfloat g, vfloat b) {
+    return Set1(0.2126f) * r + Set1(0.7152f) * g + Set1(0.0722f) * b;
+}
+
+// One a-trous pass over count pixels of row y starting at x0, see ATrousPixel(). The
+// horizontal taps of all of them have to be inside the image, rows above or below it
+// are skipped for the whole span.
+void ATrousSpan(const DenoiseFeatures& features, const DenoiseColor& in, DenoiseColor& out, const std::size_t& y, const std::size_t& x0, const std::size_t& count, const int& step, const DenoiseSettings& settings) {
+    const std::size_t width = features.width;
+    const vfloat zero = Set1(0.0f);
+    const vfloat epsilon = Set1(DENOISE_EPSILON);
+    const vfloat centerWeight = Set1(ATROUS_KERNEL[0] * ATROUS_KERNEL[0]);
+
+    std::size_t i = 0;
+    for (; i + WIDTH <= count; i += WIDTH) {
+        const std::size_t p = y * width + x0 + i;
+        const vfloat normalX = LoadU(&features.normalX[p]), normalY = LoadU(&features.normalY[p]), normalZ = LoadU(&features.normalZ[p]);
+        const vfloat depth = LoadU(&features.depth[p]);
+        const vfloat r = LoadU(&in.r[p]), g = LoadU(&in.g[p]), b = LoadU(&in.b[p]);
+        const vfloat variance = LoadU(&in.variance[p]);
+        const vfloat luminance = LuminanceOf(r, g, b);
+        const vfloat luminanceScale = Set1(1.0f) / (Set1(settings.sigmaLuminance) * Sqrt(Max(variance, zero)) + epsilon);
+
+        const vfloat depthStep = Set1(settings.sigmaDepth * (float) step) * LoadU(&features.depthGradient[p]);
+        const vfloat depthScale[2] = {Set1(1.0f) / (depthStep + epsilon), Set1(1.0f) / (Set1(2.0f) * depthStep + epsilon)};
+
+        vfloat sumR = centerWeight * r, sumG = centerWeight * g, sumB = centerWeight * b;
+        vfloat sumVariance = centerWeight * centerWeight * variance;
+        vfloat weightSum = centerWeight;
+
+        for (int dy = -2; dy <= 2; dy++) {
+            std::ptrdiff_t yq = (std::ptrdiff_t) y + dy * step;
+            if (yq < 0 || yq >= (std::ptrdiff_t) features.height) continue;
+
+            for (int dx = -2; dx <= 2; dx++) {
+                if (dx == 0 && dy == 0) continue;
+
+                const std::size_t q = (std::size_t) yq * width + (std::size_t) ((std::ptrdiff_t) (x0 + i) + dx * step);
+
+                vfloat normalWeight = Max(normalX * LoadU(&features.normalX[q]) + normalY * LoadU(&features.normalY[q]) + normalZ * LoadU(&features.normalZ[q]), zero);
+                for (int k = 0; k < 7; k++) normalWeight = normalWeight * normalWeight;
+
+                vfloat tapR = LoadU(&in.r[q]), tapG = LoadU(&in.g[q]), tapB = LoadU(&in.b[q]);
+                vfloat distance = Abs(luminance - LuminanceOf(tapR, tapG, tapB)) * luminanceScale
+                                + Abs(depth - LoadU(&features.depth[q])) * depthScale[std::max(std::abs(dx), std::abs(dy)) - 1];
+                vfloat weight = Set1(ATROUS_KERNEL[std::abs(dx)] * ATROUS_KERNEL[std::abs(dy)]) * normalWeight * Exp(zero - distance);
+
+                sumR = sumR + weight * tapR;
+                sumG = sumG + weight * tapG;
+                sumB = sumB + weight * tapB;
+                sumVariance = sumVariance + weight * weight * LoadU(&in.variance[q]);
+                weightSum = weightSum + weight;
+            }
+        }
+
+        const vfloat inverseSum = Set1(1.0f) / weightSum;
+        StoreU(&out.r[p], sumR * inverseSum);
+        StoreU(&out.g[p], sumG * inverseSum);
+        StoreU(&out.b[p], sumB * inverseSum);
+        StoreU(&out.variance[p], sumVariance * inverseSum * inverseSum);
+    }
+
+    for (; i < count; i++) ATrousPixel(features, in, out, x0 + i, y, step, settings);
+}
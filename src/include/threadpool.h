@@ -0,0 +1,239 @@
+#pragma once
+
+#define POOL_HINT "[\e[0;36mPOOL\033[0m]\t\t"
+
+enum class PinMode {
+    None,
+    Cores,  // one worker per logical CPU
+    NUMA    // workers spread round-robin over NUMA nodes, free to float inside their node
+};
+
+bool ParsePinMode(const std::string& name, PinMode& mode) {
+    if (name == "none") mode = PinMode::None;
+    else if (name == "cores") mode = PinMode::Cores;
+    else if (name == "numa") mode = PinMode::NUMA;
+    else return false;
+
+    return true;
+}
+
+// "0-3,8,10-11" as used by /sys/devices/system/node/node*/cpulist
+std::vector<int> ParseCPUList(const std::string& list) {
+    std::vector<int> cpus;
+    std::istringstream stream(list);
+    std::string range;
+
+    while (std::getline(stream, range, ',')) {
+        if (range.empty()) continue;
+
+        std::size_t dash = range.find('-');
+        int first = std::atoi(range.c_str());
+        int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+
+        for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    }
+
+    return cpus;
+}
+
+#ifdef __linux__
+
+std::vector<int> AllowedCPUs() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+    }
+
+    return cpus;
+}
+
+// CPUs of every NUMA node, restricted to the ones this process may run on
+std::vector<std::vector<int>> NUMANodes() {
+    std::vector<int> allowed = AllowedCPUs();
+    std::vector<std::vector<int>> nodes;
+
+    for (int node = 0; ; node++) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!file) break;
+
+        std::string list;
+        std::getline(file, list);
+
+        std::vector<int> cpus;
+        for (int cpu : ParseCPUList(list)) {
+            if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) cpus.push_back(cpu);
+        }
+
+        if (!cpus.empty()) nodes.push_back(cpus);
+    }
+
+    if (nodes.empty()) nodes.push_back(allowed);
+    return nodes;
+}
+
+bool PinThread(std::thread& thread, const std::vector<int>& cpus) {
+    if (cpus.empty()) return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) CPU_SET(cpu, &set);
+
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+}
+
+#endif
+
+// Persistent pool of workers. Every Run() splits its tasks into contiguous runs, one
+// per worker deque, so neighbouring tasks stay on the same core. Workers pop from the
+// front of their own deque and steal from the back of the others once it runs dry.
+class ThreadPool {
+public:
+    explicit ThreadPool(std::size_t threadCount, const PinMode& pinMode = PinMode::None) {
+        threadCount = std::max<std::size_t>(1, threadCount);
+        queues = std::vector<WorkQueue>(threadCount);
+
+        for (std::size_t i = 0; i < threadCount; i++) {
+            workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+        }
+
+        Pin(pinMode);
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        wakeWorkers.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    std::size_t size() const { return workers.size(); }
+
+    // Calls task(index, worker) for every index in [0, taskCount) and blocks until all are done
+    void Run(const std::size_t& taskCount, const std::function<void(std::size_t, std::size_t)>& task) {
+        if (taskCount == 0) return;
+
+        for (std::size_t i = 0; i < queues.size(); i++) {
+            std::lock_guard<std::mutex> lock(queues[i].mutex);
+            std::size_t first = i * taskCount / queues.size();
+            std::size_t last = (i + 1) * taskCount / queues.size();
+            for (std::size_t t = first; t < last; t++) queues[i].tasks.push_back(t);
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        currentTask = &task;
+        remaining = taskCount;
+        generation++;
+        wakeWorkers.notify_all();
+
+        jobDone.wait(lock, [&]() { return remaining == 0 && busyWorkers == 0; });
+        currentTask = nullptr;
+    }
+
+private:
+    class alignas(64) WorkQueue {
+    public:
+        std::mutex mutex;
+        std::deque<std::size_t> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<WorkQueue> queues;
+
+    std::mutex mutex;
+    std::condition_variable wakeWorkers;
+    std::condition_variable jobDone;
+    const std::function<void(std::size_t, std::size_t)>* currentTask = nullptr;
+    std::atomic<std::size_t> remaining{0};
+    std::size_t busyWorkers = 0;
+    std::size_t generation = 0;
+    bool stopping = false;
+
+    bool PopOwn(const std::size_t& worker, std::size_t& task) {
+        WorkQueue& queue = queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+
+        task = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+    }
+
+    bool Steal(const std::size_t& worker, std::size_t& task) {
+        for (std::size_t offset = 1; offset < queues.size(); offset++) {
+            WorkQueue& victim = queues[(worker + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.tasks.empty()) continue;
+
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+
+        return false;
+    }
+
+    void WorkerLoop(const std::size_t worker) {
+        std::size_t seenGeneration = 0;
+
+        while (true) {
+            const std::function<void(std::size_t, std::size_t)>* task;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeWorkers.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+                if (stopping) return;
+
+                seenGeneration = generation;
+                task = currentTask;
+                busyWorkers++;
+            }
+
+            // Woke up after the job already finished, the queues may be filling up for the next one
+            std::size_t index;
+            while (task && (PopOwn(worker, index) || Steal(worker, index))) {
+                (*task)(index, worker);
+                remaining--;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            busyWorkers--;
+            if (remaining == 0 && busyWorkers == 0) jobDone.notify_all();
+        }
+    }
+
+    void Pin(const PinMode& pinMode) {
+        if (pinMode == PinMode::None) return;
+
+#ifdef __linux__
+        bool pinned = true;
+
+        if (pinMode == PinMode::Cores) {
+            std::vector<int> cpus = AllowedCPUs();
+            for (std::size_t i = 0; i < workers.size() && !cpus.empty(); i++) {
+                pinned &= PinThread(workers[i], {cpus[i % cpus.size()]});
+            }
+        } else {
+            std::vector<std::vector<int>> nodes = NUMANodes();
+            for (std::size_t i = 0; i < workers.size(); i++) {
+                pinned &= PinThread(workers[i], nodes[i % nodes.size()]);
+            }
+            std::cout << POOL_HINT << "Spreading workers over " << nodes.size() << " NUMA node(s)\n";
+        }
+
+        if (!pinned) std::cerr << POOL_HINT << "Could not pin every worker\n";
+#else
+        std::cerr << POOL_HINT << "Thread pinning is only supported on Linux\n";
+#endif
+    }
+};
@@ -3,48 +3,123 @@
 #define MQTT_HINT "[\e[0;36mMQTT\033[0m]\t\t"
 #define RENDERER_HINT "[\e[0;32mRENDERER\033[0m]\t"
 
-std::size_t Map2Dto1D(const std::size_t& x, const std::size_t& y) {
-    return x + y * VIEWPORT_WIDTH;
-}
-
 void PrintVec4(const glm::vec4& vec) {
     std::cout << "X: " << vec.x << " Y: " << vec.y << " Z: " << vec.z << " W: " << vec.w << "\n";
 }
 
-glm::vec3 Reinhard(const glm::vec3& linearValue) {
-    return linearValue / (linearValue + glm::vec3(1.0f));
+float LinearToSrgb(const float& linearValue) {
+    return linearValue <= 0.0031308f ? 12.92f * linearValue : 1.055f * std::pow(linearValue, 1.0f / 2.4f) - 0.055f;
 }
 
-glm::vec3 ACESFilm(const glm::vec3& x) {
-    const float a = 2.51f;
-    const float b = 0.03f;
-    const float c = 2.43f;
-    const float d = 0.59f;
-    const float e = 0.14f;
-    return glm::clamp((x*(a*x+b))/(x*(c*x+d)+e), glm::vec3(0.0f), glm::vec3(1.0f));
+glm::vec3 LinearToSrgb(const glm::vec3& linearValue) {
+    return glm::vec3(LinearToSrgb(linearValue.x), LinearToSrgb(linearValue.y), LinearToSrgb(linearValue.z));
 }
 
-glm::vec3 LinearToSrgb(const glm::vec3& linearValue) {
-    return glm::pow(linearValue, glm::vec3(1.0 / 2.2));
-}
-
-glm::vec3 UniformSampleHemisphere(glm::vec3 normal, glm::vec2 rand){
-    // cos(theta) = r1 = y
-    // cos^2(theta) + sin^2(theta) = 1 -> sin(theta) = sqrt(1 - cos^2(theta))
-    float sinTheta = std::sqrt(1.0 - rand.x * rand.x);
-    float phi = 2.0 * PI * rand.y;
-    float x = sinTheta * std::cos(phi);
-    float z = sinTheta * std::sin(phi);
-    
-    // Transform the local hemisphere direction to world space aligned with the normal
-    glm::vec3 tangent, bitangent;
-    if (glm::abs(normal.x) > 0.1) {
-        tangent = glm::normalize(glm::cross(normal, glm::vec3(0.0, 1.0, 0.0)));
+enum class ToneMapper {
+    ACES,
+    Reinhard
+};
+
+const char* ToneMapperName(const ToneMapper& toneMapper) {
+    return toneMapper == ToneMapper::Reinhard ? "reinhard" : "aces";
+}
+
+bool ParseToneMapper(const std::string& name, ToneMapper& toneMapper) {
+    for (ToneMapper candidate : {ToneMapper::ACES, ToneMapper::Reinhard}) {
+        if (name == ToneMapperName(candidate)) {
+            toneMapper = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// How the linear film is turned into 8 bit display values. The film is left untouched,
+// so the transform can be redone with other settings without tracing again.
+class DisplaySettings {
+public:
+    float exposure = 0.0f;  // stops
+    ToneMapper toneMapper = ToneMapper::ACES;
+    bool dither = true;
+};
+
+// sRGB encoded values in [0, 255], indexed by the square root of the linear value. The
+// square root flattens the steep start of the curve, so nearest lookup stays well
+// below a twentieth of a step everywhere.
+const float* SrgbLut() {
+    static const std::vector<float> table = []() {
+        std::vector<float> entries(SRGB_LUT_SIZE);
+        for (int i = 0; i < SRGB_LUT_SIZE; i++) {
+            float root = (float) i / (SRGB_LUT_SIZE - 1);
+            entries[i] = 255.0f * LinearToSrgb(root * root);
+        }
+        return entries;
+    }();
+
+    return table.data();
+}
+
+// Jimenez, "Next Generation Post Processing in Call of Duty: Advanced Warfare"
+float InterleavedGradientNoise(const float& x, const float& y) {
+    float f = 0.06711056f * x + 0.00583715f * y;
+    f = 52.9829189f * (f - std::floor(f));
+    return f - std::floor(f);
+}
+
+// Exposure, tonemap, sRGB encode and quantization of one color channel. noise in [0, 1)
+// offsets the rounding, 0.5 rounds to nearest.
+unsigned char DisplayValue(const float& linearValue, const float& noise, const float& scale, const ToneMapper& toneMapper, const float* lut) {
+    // Both curves are flat long before the limit, it keeps x * x finite
+    float x = linearValue * scale;
+    x = x > 0.0f ? std::min(x, DISPLAY_MAX_LINEAR) : 0.0f;  // also catches NaN
+
+    if (toneMapper == ToneMapper::ACES) {
+        x = std::min((x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f), 1.0f);
     } else {
-        tangent = glm::normalize(glm::cross(normal, glm::vec3(1.0, 0.0, 0.0)));
+        x = x / (x + 1.0f);
     }
-    bitangent = normalize(cross(normal, tangent));
 
-    glm::vec3 hemisphereDir = tangent * x + normal * rand.x + bitangent * z;
-    return normalize(hemisphereDir);
-}
\ No newline at end of file
+    float value = lut[(int) (std::sqrt(x) * (SRGB_LUT_SIZE - 1) + 0.5f)] + noise - 0.5f;
+    return (unsigned char) std::nearbyint(std::min(std::max(value, 0.0f), 255.0f));
+}
+
+float Luminance(const glm::vec3& color) {
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// Duff et al., "Building an Orthonormal Basis, Revisited"
+void OrthonormalBasis(const glm::vec3& normal, glm::vec3& tangent, glm::vec3& bitangent) {
+    float sign = std::copysign(1.0f, normal.z);
+    float a = -1.0f / (sign + normal.z);
+    float b = normal.x * normal.y * a;
+    tangent = glm::vec3(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+    bitangent = glm::vec3(b, sign + normal.y * normal.y * a, -normal.y);
+}
+
+// Shirley-Chiu concentric mapping of the unit square onto the unit disk
+glm::vec2 ConcentricSampleDisk(const glm::vec2& rand) {
+    glm::vec2 offset = rand * 2.0f - glm::vec2(1.0f);
+    if (offset.x == 0.0f && offset.y == 0.0f) return glm::vec2(0.0f);
+
+    float r, theta;
+    if (std::abs(offset.x) > std::abs(offset.y)) {
+        r = offset.x;
+        theta = 0.25f * PI * (offset.y / offset.x);
+    } else {
+        r = offset.y;
+        theta = HPI - 0.25f * PI * (offset.x / offset.y);
+    }
+
+    return r * glm::vec2(std::cos(theta), std::sin(theta));
+}
+
+// pdf = cos(theta) / pi
+glm::vec3 CosineSampleHemisphere(const glm::vec3& normal, const glm::vec2& rand) {
+    glm::vec2 d = ConcentricSampleDisk(rand);
+    float z = std::sqrt(std::max(0.0f, 1.0f - glm::dot(d, d)));
+
+    glm::vec3 tangent, bitangent;
+    OrthonormalBasis(normal, tangent, bitangent);
+    return glm::normalize(tangent * d.x + bitangent * d.y + normal * z);
+}
@@ -0,0 +1,308 @@
+#pragma once
+
+// Stream (wavefront) integrator. Instead of following one path to its end before the
+// next one starts, all paths of a tile advance together one bounce at a time, in
+// separate stages over the whole batch: shade every hit grouped by material, trace
+// every shadow ray, then trace every continuation ray. Rays are sorted by direction
+// octant and origin before they are traced, so the packets are coherent and
+// neighbouring rays walk the same BVH nodes.
+//
+// Paths draw the same sample dimensions as in Render() and the film receives the
+// samples in the same order as in RenderTile(), so both integrators produce the same
+// image up to the rounding differences between the scalar and the packet kernels.
+
+// Stable LSD radix sort of entries with the key in bits [32, 32 + keyBits), a byte per
+// pass. Far cheaper than a comparison sort for the short keys used here.
+void RadixSort(std::vector<std::uint64_t>& items, std::vector<std::uint64_t>& scratch, const int& keyBits) {
+    scratch.resize(items.size());
+
+    for (int shift = 32; shift < 32 + keyBits; shift += 8) {
+        std::size_t offsets[257] = {};
+        for (std::uint64_t item : items) offsets[((item >> shift) & 0xFF) + 1]++;
+        for (int bucket = 0; bucket < 256; bucket++) offsets[bucket + 1] += offsets[bucket];
+        for (std::uint64_t item : items) scratch[offsets[(item >> shift) & 0xFF]++] = item;
+        items.swap(scratch);
+    }
+}
+
+// Rays waiting for a stage, as structure-of-arrays so packets are filled straight from it
+class RayQueue {
+public:
+    std::vector<float> originX, originY, originZ;
+    std::vector<float> directionX, directionY, directionZ;
+    std::vector<float> tMax;
+    std::vector<std::uint32_t> path;
+    std::vector<std::uint64_t> order;  // sort key in the upper half, queue index in the lower
+    std::vector<std::uint64_t> scratch;
+
+    std::size_t size() const { return path.size(); }
+
+    glm::vec3 Origin(const std::size_t& i) const {
+        return glm::vec3(originX[i], originY[i], originZ[i]);
+    }
+
+    glm::vec3 Direction(const std::size_t& i) const {
+        return glm::vec3(directionX[i], directionY[i], directionZ[i]);
+    }
+
+    void Clear() {
+        originX.clear();
+        originY.clear();
+        originZ.clear();
+        directionX.clear();
+        directionY.clear();
+        directionZ.clear();
+        tMax.clear();
+        path.clear();
+    }
+
+    void Push(const glm::vec3& origin, const glm::vec3& direction, const float& t, const std::uint32_t& pathIndex) {
+        originX.push_back(origin.x);
+        originY.push_back(origin.y);
+        originZ.push_back(origin.z);
+        directionX.push_back(direction.x);
+        directionY.push_back(direction.y);
+        directionZ.push_back(direction.z);
+        tMax.push_back(t);
+        path.push_back(pathIndex);
+    }
+
+    // Groups the rays by direction octant, then by the Morton code of their origin on a
+    // 16^3 grid over the bounds of all origins in the queue
+    void Sort() {
+        const std::size_t count = size();
+        order.resize(count);
+        if (count == 0) return;
+
+        glm::vec3 lower = Origin(0), upper = Origin(0);
+        for (std::size_t i = 1; i < count; i++) {
+            lower = glm::min(lower, Origin(i));
+            upper = glm::max(upper, Origin(i));
+        }
+
+        glm::vec3 scale = 15.0f / glm::max(upper - lower, glm::vec3(1e-6f));
+
+        for (std::size_t i = 0; i < count; i++) {
+            glm::uvec3 cell = glm::uvec3((Origin(i) - lower) * scale);
+            std::uint32_t octant = (directionX[i] < 0.0f) | (directionY[i] < 0.0f) << 1 | (directionZ[i] < 0.0f) << 2;
+            std::uint32_t key = octant << 12 | MortonCode3D(cell.x, cell.y, cell.z);
+            order[i] = (std::uint64_t) key << 32 | i;
+        }
+
+        RadixSort(order, scratch, 15);
+    }
+
+private:
+    // Interleaves the lower 4 bits of x, y and z
+    static std::uint32_t MortonCode3D(std::uint32_t x, std::uint32_t y, std::uint32_t z) {
+        auto Spread = [](std::uint32_t v) {
+            v &= 0xF;
+            v = (v | (v << 4)) & 0x0C3;
+            v = (v | (v << 2)) & 0x249;
+            return v;
+        };
+
+        return Spread(x) | (Spread(y) << 1) | (Spread(z) << 2);
+    }
+};
+
+// Per worker buffers, kept between tiles so a pass does not allocate once they are warm
+class WavefrontWorkspace {
+public:
+    std::vector<HitData> cameraHits;
+    std::vector<glm::vec3> cameraDirections;
+
+    // One entry per path of the batch
+    std::vector<PathState> paths;
+    std::vector<Sampler> samplers;
+    std::vector<HitData> hits;
+    std::vector<glm::vec3> shadowContribution;
+
+    std::vector<std::uint32_t> active;       // paths with a hit to shade
+    std::vector<std::uint64_t> shadeOrder;   // material in the upper half, path in the lower
+    std::vector<std::uint64_t> scratch;
+    RayQueue shadowRays, bounceRays;
+};
+
+// Traces the queue in sorted order, a packet at a time. Lanes past the end of the queue
+// duplicate the last ray. Visit receives the queue index and the hit of every ray.
+template <typename Visit>
+void TraceQueue(const Scene& scene, const RayQueue& queue, Visit&& visit) {
+    const std::size_t packetSize = simdKernels.packetSize;
+    RayPacket packet;
+    HitData hits[MAX_PACKET_SIZE];
+
+    for (std::size_t first = 0; first < queue.size(); first += packetSize) {
+        std::size_t count = std::min(packetSize, queue.size() - first);
+
+        if (packetSize > 1) {
+            for (std::size_t lane = 0; lane < packetSize; lane++) {
+                std::uint32_t i = (std::uint32_t) queue.order[first + std::min(lane, count - 1)];
+                packet.Set(lane, queue.Origin(i), queue.Direction(i));
+            }
+
+            TracePacket(scene, packet, hits);
+        } else {
+            std::uint32_t i = (std::uint32_t) queue.order[first];
+            RayTraceScene(scene, hits[0], queue.Origin(i), queue.Direction(i));
+        }
+
+        for (std::size_t lane = 0; lane < count; lane++) visit((std::uint32_t) queue.order[first + lane], hits[lane]);
+    }
+}
+
+// Same as TraceQueue() for occlusion up to every ray's tMax
+template <typename Visit>
+void OccludedQueue(const Scene& scene, const RayQueue& queue, Visit&& visit) {
+    const std::size_t packetSize = simdKernels.packetSize;
+    RayPacket packet;
+    bool occluded[MAX_PACKET_SIZE];
+
+    for (std::size_t first = 0; first < queue.size(); first += packetSize) {
+        std::size_t count = std::min(packetSize, queue.size() - first);
+
+        if (packetSize > 1) {
+            for (std::size_t lane = 0; lane < packetSize; lane++) {
+                std::uint32_t i = (std::uint32_t) queue.order[first + std::min(lane, count - 1)];
+                packet.Set(lane, queue.Origin(i), queue.Direction(i));
+                packet.t[lane] = queue.tMax[i];
+            }
+
+            OccludedPacket(scene, packet, occluded);
+        } else {
+            std::uint32_t i = (std::uint32_t) queue.order[first];
+            occluded[0] = Occluded(scene, queue.Origin(i), queue.Direction(i), queue.tMax[i]);
+        }
+
+        for (std::size_t lane = 0; lane < count; lane++) visit((std::uint32_t) queue.order[first + lane], occluded[lane]);
+    }
+}
+
+// Adds sampleCount samples, starting at sample index firstSample, to every pixel of the
+// tile, WAVEFRONT_BATCH_SIZE paths at a time. Returns the number of rays traced.
+std::uint64_t RenderTileWavefront(const Scene& scene, Film& film, const Tile& tile, const RenderSettings& settings, const std::uint32_t& firstSample, const std::uint32_t& sampleCount) {
+    thread_local WavefrontWorkspace workspace;
+    WavefrontWorkspace& w = workspace;
+
+    const std::size_t packetSize = simdKernels.packetSize;
+    const std::size_t tileWidth = tile.x1 - tile.x0;
+    const std::size_t pixelCount = tileWidth * (tile.y1 - tile.y0);
+    std::uint64_t rays = 0;
+
+    // The camera does not jitter, its hits are shared by all samples of the pass
+    HitData hits[MAX_PACKET_SIZE];
+    glm::vec3 rayDirs[MAX_PACKET_SIZE];
+    w.cameraHits.resize(pixelCount);
+    w.cameraDirections.resize(pixelCount);
+
+    for (std::size_t y = tile.y0; y < tile.y1; y++) {
+        for (std::size_t x0 = tile.x0; x0 < tile.x1; x0 += packetSize) {
+            std::size_t count = std::min(packetSize, tile.x1 - x0);
+            TraceCameraRays(scene, settings.camera, x0, y, count, hits, rayDirs);
+            rays += count;
+            if (firstSample == 0 && film.HasFeatures()) RecordFeatures(scene, film, x0, y, count, hits, rayDirs);
+
+            std::size_t pixel = (y - tile.y0) * tileWidth + (x0 - tile.x0);
+            std::copy(hits, hits + count, w.cameraHits.begin() + pixel);
+            std::copy(rayDirs, rayDirs + count, w.cameraDirections.begin() + pixel);
+        }
+    }
+
+    // Paths are numbered pixel by pixel, sample by sample, like the loops in RenderTile()
+    const std::size_t pathCount = pixelCount * sampleCount;
+
+    for (std::size_t firstPath = 0; firstPath < pathCount; firstPath += WAVEFRONT_BATCH_SIZE) {
+        const std::size_t batch = std::min<std::size_t>(WAVEFRONT_BATCH_SIZE, pathCount - firstPath);
+
+        w.paths.resize(batch);
+        w.samplers.resize(batch);
+        w.hits.resize(batch);
+        w.shadowContribution.resize(batch);
+        w.active.clear();
+
+        for (std::size_t p = 0; p < batch; p++) {
+            std::size_t pixel = (firstPath + p) / sampleCount;
+            std::uint32_t sample = firstSample + (std::uint32_t) ((firstPath + p) % sampleCount);
+
+            w.samplers[p] = settings.sampler;
+            w.samplers[p].StartPixelSample(tile.x0 + pixel % tileWidth, tile.y0 + pixel / tileWidth, sample);
+            w.paths[p] = PathState{};
+            w.paths[p].direction = w.cameraDirections[pixel];
+            w.hits[p] = w.cameraHits[pixel];
+
+            if (w.hits[p].rayHit) {
+                w.active.push_back((std::uint32_t) p);
+            } else {
+                PROFILE_COUNT(ProfileCounter::Misses);
+                PROFILE_PATH_DEPTH(0);
+            }
+        }
+
+        for (int depth = 0; !w.active.empty(); depth++) {
+            // Shade, grouped by material so every material's code and data stay hot
+            w.shadeOrder.clear();
+            for (std::uint32_t p : w.active) w.shadeOrder.push_back((std::uint64_t) w.hits[p].material << 32 | p);
+            RadixSort(w.shadeOrder, w.scratch, scene.materials.size() > 256 ? 16 : 8);
+
+            w.shadowRays.Clear();
+            w.bounceRays.Clear();
+
+            for (std::uint64_t entry : w.shadeOrder) {
+                std::uint32_t p = (std::uint32_t) entry;
+                PathState& path = w.paths[p];
+                ShadowRay shadow;
+
+                bool alive = ShadeVertex(scene, w.hits[p], depth, settings, w.samplers[p], path, shadow);
+
+                // Same segment as Visible() tests
+                if (shadow.traced) {
+                    glm::vec3 delta = shadow.target - shadow.origin;
+                    float distance = glm::length(delta);
+                    w.shadowRays.Push(shadow.origin, delta / distance, distance * (1.0f - 1e-3f), p);
+                    w.shadowContribution[p] = shadow.contribution;
+                }
+
+                if (alive) {
+                    w.bounceRays.Push(path.origin, path.direction, std::numeric_limits<float>::max(), p);
+                } else {
+                    PROFILE_PATH_DEPTH(depth);
+                }
+            }
+
+            // Shadow rays
+            rays += w.shadowRays.size();
+            PROFILE_ADD(ProfileCounter::ShadowRays, w.shadowRays.size());
+
+            w.shadowRays.Sort();
+            OccludedQueue(scene, w.shadowRays, [&](const std::uint32_t& i, const bool& occluded) {
+                std::uint32_t p = w.shadowRays.path[i];
+                if (!occluded) w.paths[p].color += w.shadowContribution[p];
+            });
+
+            // Continuation rays, the paths that hit something are shaded next round
+            rays += w.bounceRays.size();
+            PROFILE_ADD(ProfileCounter::BounceRays, w.bounceRays.size());
+
+            w.active.clear();
+            w.bounceRays.Sort();
+            TraceQueue(scene, w.bounceRays, [&](const std::uint32_t& i, const HitData& hit) {
+                std::uint32_t p = w.bounceRays.path[i];
+                w.hits[p] = hit;
+
+                if (hit.rayHit) {
+                    w.active.push_back(p);
+                } else {
+                    PROFILE_COUNT(ProfileCounter::Misses);
+                    PROFILE_PATH_DEPTH(depth + 1);
+                }
+            });
+        }
+
+        for (std::size_t p = 0; p < batch; p++) {
+            std::size_t pixel = (firstPath + p) / sampleCount;
+            film.AddSample(film.Index(tile.x0 + pixel % tileWidth, tile.y0 + pixel / tileWidth), w.paths[p].color);
+        }
+    }
+
+    return rays;
+}
@@ -1,151 +1,511 @@
-#include <iostream>
-#include <cmath>
-#include <array>
-#include <chrono>
-#include <algorithm>
-#include <vector>
-#include <random>
-#include <sstream>
-#include <thread>
-#include <mutex>
-#include <functional>
-
-#ifdef MQTT_BENCHMARK_MODE
-    #include <mqtt/client.h>
-#endif
+#include "include/prismatica.h"
 
 // STB for image writes
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
 
-// GLM since I don't want to implement MAD myself lol suck it arduino
-#define GLM_FORCE_INTRINSICS
-#include <glm/glm.hpp>
-#include <glm/gtc/matrix_transform.hpp>
-
-// MQTT parameters
-const std::string BROKER_URL = "industrial.api.ubidots.com:1883";
-const std::string CLIENT_ID = "ubidots_mqtt_cpp_client";
-const std::string TOKEN = "BBUS-FJ0t8ffIFZZqVjAbWIfcBtFEhNoIJC";
-const std::string DEVICE_LABEL = "mqttraytracer";
-const std::string VARIABLE_LABEL = "rendertime";
-const int QOS = 0;
-
-#include "include/constants.h"
-#include "include/utils.h"
-#include "include/intersections.h"
-#include "include/renderer.h"
-
-#ifdef MQTT_BENCHMARK_MODE
-    class callback : public virtual mqtt::callback {
-        void connected(const std::string& cause) override {
-            std::cout << MQTT_HINT << "Connection successful" << std::endl;
+// Where and how a frame is written. Streaming writes every band as soon as it is done,
+// otherwise the 8 bit image is collected and handed to stb, which also compresses in
+// builds without zlib. AOVs are always streamed, to AovPath() of aovPath.
+class FrameOutput {
+public:
+    std::string path;
+    ImageFormat format = ImageFormat::PNG;
+    EncodeSettings encode{};
+    DisplaySettings display{};
+    bool streaming = false;
+    bool denoise = false;  // needs the whole frame as one band
+    DenoiseSettings denoiseSettings{};
+    std::string aovPath;  // empty for none
+    ImageFormat aovFormat = ImageFormat::PNG;
+};
+
+// Renders one frame and queues its encoding on the output thread, which may still be
+// busy with it when this returns. renderMs excludes the time spent waiting for room in
+// the output queue. False if the output could not be opened or a write failed, the
+// failed file is reported where it fails and the files of its frame are removed.
+bool RenderFrame(const Scene& scene, ThreadPool& pool, const RenderSettings& settings, const std::size_t& tileSize, const std::size_t& bandHeight,
+                 const FrameOutput& frameOutput, OutputThread& output, RenderStats& stats, double& renderMs) {
+    const Camera& camera = settings.camera;
+    const std::string path = frameOutput.path;
+    std::shared_ptr<ImageStreamWriter> writer;
+    std::vector<std::shared_ptr<ImageStreamWriter>> aovWriters;
+    std::vector<std::string> aovFiles;
+    std::vector<unsigned char> image;
+
+    // Every output is opened before the first band is traced. If one can't be opened,
+    // the files opened before it are removed again instead of being left with a header only.
+    std::vector<std::string> openedPaths;
+
+    // A failed job leaves its queued successors undone, so the writers are released
+    // once the queue has drained and the partial files are removed
+    auto Abandon = [&]() {
+        output.Wait();
+        writer.reset();
+        aovWriters.clear();
+        for (const std::string& opened : openedPaths) std::remove(opened.c_str());
+        return false;
+    };
+
+    if (frameOutput.streaming) {
+        writer = std::make_shared<ImageStreamWriter>();
+        if (!writer->Open(path, frameOutput.format, camera.width, camera.height, frameOutput.encode)) return false;
+        openedPaths.push_back(path);
+    } else {
+        image.resize(3 * camera.width * camera.height);
+    }
+
+    for (Aov aov : AOVS) {
+        if (frameOutput.aovPath.empty()) break;
+        aovFiles.push_back(AovPath(frameOutput.aovPath, aov));
+        aovWriters.push_back(std::make_shared<ImageStreamWriter>());
+        if (!aovWriters.back()->Open(aovFiles.back(), frameOutput.aovFormat, camera.width, camera.height, frameOutput.encode)) return Abandon();
+        openedPaths.push_back(aovFiles.back());
+    }
+
+    // Jobs run after the frame has moved on, so they remove its files themselves
+    auto Remove = [openedPaths]() {
+        for (const std::string& opened : openedPaths) std::remove(opened.c_str());
+    };
+
+    auto Discard = [Remove](const std::string& failed) {
+        std::cerr << OUTPUT_HINT << "Could not write " + failed + "\n";
+        Remove();
+        return false;
+    };
+
+    // Only blocking on a full queue is output time, tonemapping and denoising are rendering
+    double submitMs = 0.0;
+    auto Submit = [&](std::function<bool()> job) {
+        auto submitStart = std::chrono::high_resolution_clock::now();
+        bool submitted = output.Submit(std::move(job));
+        submitMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - submitStart).count();
+        return submitted;
+    };
+
+    // The band film is gone once the callback returns, so the jobs get a copy
+    bool outputOk = true;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    stats = RenderBands(scene, pool, settings, tileSize, bandHeight, [&](const Film& band) {
+        const std::size_t rowSize = 3 * band.width;
+
+        // The AOVs come from the film as rendered, the image from the denoised one
+        for (std::size_t i = 0; i < aovWriters.size() && outputOk; i++) {
+            const bool linear = IsLinearFormat(frameOutput.aovFormat);
+            std::vector<float> rows = AovRows(band, AOVS[i], linear);
+
+            outputOk = Submit([writer = aovWriters[i], rows = std::move(rows), rowSize, linear, aovFile = aovFiles[i], Discard]() {
+                std::vector<unsigned char> bytes(rowSize);
+                bool ok = true;
+
+                for (std::size_t first = 0; first < rows.size() && ok; first += rowSize) {
+                    if (linear) {
+                        ok = writer->WriteRow(&rows[first]);
+                        continue;
+                    }
+
+                    for (std::size_t k = 0; k < rowSize; k++) bytes[k] = (unsigned char) (glm::clamp(rows[first + k], 0.0f, 1.0f) * 255.0f + 0.5f);
+                    ok = writer->WriteRow(bytes.data());
+                }
+
+                return ok || Discard(aovFile);
+            });
         }
 
-        void connection_lost(const std::string& cause) override {
-            std::cout << "\nConnection lost" << std::endl;
-            if (!cause.empty())
-                std::cout << "\tcause: " << cause << std::endl;
+        if (!outputOk) return false;
+
+        std::unique_ptr<Film> denoised;
+        if (frameOutput.denoise) denoised = std::make_unique<Film>(Denoise(band, pool, frameOutput.denoiseSettings));
+        const Film& film = denoised ? *denoised : band;
+
+        // Images are stored top row first, y points up
+        if (frameOutput.streaming && IsLinearFormat(frameOutput.format)) {
+            std::vector<float> linear(rowSize * film.height);
+            for (std::size_t row = 0; row < film.height; row++) {
+                const glm::vec3* source = &film.mean[film.Index(0, film.y0 + film.height - 1 - row)];
+                std::memcpy(&linear[rowSize * row], source, rowSize * sizeof(float));
+            }
+
+            outputOk = Submit([writer, linear = std::move(linear), rowSize, path, Discard]() {
+                bool ok = true;
+                for (std::size_t first = 0; first < linear.size() && ok; first += rowSize) ok = writer->WriteRow(&linear[first]);
+                return ok || Discard(path);
+            });
+        } else if (frameOutput.streaming) {
+            std::vector<unsigned char> rgb(rowSize * film.height);
+            PostProcess(film, pool, frameOutput.display, rgb.data());
+
+            outputOk = Submit([writer, rgb = std::move(rgb), rowSize, path, Discard]() {
+                bool ok = true;
+                for (std::size_t first = 0; first < rgb.size() && ok; first += rowSize) ok = writer->WriteRow(&rgb[first]);
+                return ok || Discard(path);
+            });
+        } else {
+            PostProcess(film, pool, frameOutput.display, &image[3 * camera.width * (camera.height - film.y0 - film.height)]);
+        }
+
+        return outputOk;
+    });
+
+    renderMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() - submitMs;
+    if (!outputOk) return Abandon();
+
+    std::size_t width = camera.width, height = camera.height;
+
+    outputOk = output.Submit([writer, aovWriters, image = std::move(image), path, aovFiles, width, height, Discard]() {
+        bool ok = writer ? writer->Close() : stbi_write_png(path.c_str(), (int) width, (int) height, 3, image.data(), 0) != 0;
+
+        // The frame is only kept if every file of it could be written
+        if (!ok) {
+            if (!writer) std::remove(path.c_str());
+            return Discard(path);
         }
 
-        void message_arrived(mqtt::const_message_ptr msg) override {
-            std::cout << "\nMessage arrived" << std::endl;
-            std::cout << "topic: '" << msg->get_topic() << "'" << std::endl;
-            std::cout << "payload: '" << msg->to_string() << "'" << std::endl;
+        for (std::size_t i = 0; i < aovWriters.size(); i++) {
+            if (aovWriters[i]->Close()) continue;
+            if (!writer) std::remove(path.c_str());
+            return Discard(aovFiles[i]);
         }
 
-        void delivery_complete(mqtt::delivery_token_ptr token) override {}
+        std::cout << OUTPUT_HINT << "Wrote " + path + "\n";
+        for (const std::string& aovFile : aovFiles) std::cout << OUTPUT_HINT << "Wrote " + aovFile + "\n";
+        return true;
+    }, Remove);
+
+    return outputOk || Abandon();
+}
+
+// JPEG encoder of the preview, stb lives in this translation unit
+bool EncodeJpeg(const unsigned char* rgb, const std::size_t& width, const std::size_t& height, const int& quality, std::vector<unsigned char>& jpeg) {
+    jpeg.clear();
+    auto Append = [](void* context, void* data, int size) {
+        std::vector<unsigned char>& bytes = *(std::vector<unsigned char>*) context;
+        bytes.insert(bytes.end(), (unsigned char*) data, (unsigned char*) data + size);
     };
-#endif
 
-int main() {
+    return stbi_write_jpg_to_func(Append, &jpeg, (int) width, (int) height, 3, rgb, quality) != 0;
+}
+
+int main(int argc, char* argv[]) {
     // Init
-    stbi_flip_vertically_on_write(1);
+    std::string scenePath;
+    std::string sceneCachePath;
+    std::string outputPath = "test.png";
+    ImageFormat outputFormat = ImageFormat::PNG;
+    std::string aovPath;
+    ImageFormat aovFormat = ImageFormat::PNG;
+    bool denoise = false;
+    std::size_t bandHeight = 0;
+    DisplaySettings display{};
+    EncodeSettings encode{};
+    PublishSettings publish{};
+    PreviewSettings preview{};
+    std::string profilePrefix;
+    std::string keyframesPath;
+    long frames = 0;
+    SimdISA isa = DetectSimdISA();
+    std::size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    std::size_t tileSize = TILE_SIZE;
+    PinMode pinMode = PinMode::None;
+    RenderSettings settings{};
+    bool samplesGiven = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--scene" && i + 1 < argc) {
+            scenePath = argv[++i];
+        } else if (arg == "--scene-cache" && i + 1 < argc) {
+            sceneCachePath = argv[++i];
+        } else if (arg == "--isa" && i + 1 < argc) {
+            if (!ParseSimdISA(argv[++i], isa) || !SimdISASupported(isa)) {
+                std::cerr << SIMD_HINT << argv[i] << " is not available on this CPU\n";
+                return 1;
+            }
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threadCount = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--tile-size" && i + 1 < argc) {
+            tileSize = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--pin" && i + 1 < argc) {
+            if (!ParsePinMode(argv[++i], pinMode)) {
+                std::cerr << POOL_HINT << "Unknown pin mode " << argv[i] << '\n';
+                return 1;
+            }
+        } else if (arg == "--sampler" && i + 1 < argc) {
+            if (!ParseSamplerType(argv[++i], settings.sampler.type)) {
+                std::cerr << RENDERER_HINT << "Unknown sampler " << argv[i] << '\n';
+                return 1;
+            }
+        } else if (arg == "--integrator" && i + 1 < argc) {
+            if (!ParseIntegrator(argv[++i], settings.integrator)) {
+                std::cerr << RENDERER_HINT << "Unknown integrator " << argv[i] << '\n';
+                return 1;
+            }
+        } else if (arg == "--seed" && i + 1 < argc) {
+            settings.sampler.seed = (std::uint32_t) std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--spp" && i + 1 < argc) {
+            settings.samplesPerPixel = (std::uint32_t) std::max(1, std::atoi(argv[++i]));
+            samplesGiven = true;
+        } else if (arg == "--target-error" && i + 1 < argc) {
+            settings.targetError = std::max(0.0f, (float) std::atof(argv[++i]));
+        } else if (arg == "--time-budget" && i + 1 < argc) {
+            settings.timeBudget = std::max(0.0, std::atof(argv[++i]));
+        } else if (arg == "--width" && i + 1 < argc) {
+            settings.camera.width = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--height" && i + 1 < argc) {
+            settings.camera.height = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--camera" && i + 6 < argc) {
+            glm::vec3 eye, target;
+            for (int k = 0; k < 3; k++) eye[k] = (float) std::atof(argv[++i]);
+            for (int k = 0; k < 3; k++) target[k] = (float) std::atof(argv[++i]);
+            if (!settings.camera.LookAt(eye, target)) {
+                std::cerr << RENDERER_HINT << "--camera needs a target apart from the eye\n";
+                return 1;
+            }
+        } else if (arg == "--fov" && i + 1 < argc) {
+            settings.camera.fov = glm::radians((float) std::atof(argv[++i]));
+        } else if (arg == "--output" && i + 1 < argc) {
+            outputPath = argv[++i];
+            if (!ImageFormatFromPath(outputPath, outputFormat)) {
+                std::cerr << OUTPUT_HINT << "Unknown image format " << outputPath << ", use .png, .ppm, .pfm or .exr\n";
+                return 1;
+            }
+        } else if (arg == "--aov" && i + 1 < argc) {
+            aovPath = argv[++i];
+            if (!ImageFormatFromPath(aovPath, aovFormat)) {
+                std::cerr << OUTPUT_HINT << "Unknown image format " << aovPath << ", use .png, .ppm, .pfm or .exr\n";
+                return 1;
+            }
+        } else if (arg == "--denoise") {
+            denoise = true;
+        } else if (arg == "--exposure" && i + 1 < argc) {
+            display.exposure = (float) std::atof(argv[++i]);
+        } else if (arg == "--tonemap" && i + 1 < argc) {
+            if (!ParseToneMapper(argv[++i], display.toneMapper)) {
+                std::cerr << OUTPUT_HINT << "Unknown tonemapper " << argv[i] << ", use aces or reinhard\n";
+                return 1;
+            }
+        } else if (arg == "--no-dither") {
+            display.dither = false;
+        } else if (arg == "--png-level" && i + 1 < argc) {
+            encode.compressionLevel = std::min(std::max(std::atoi(argv[++i]), 0), 9);
+        } else if (arg == "--exr-precision" && i + 1 < argc) {
+            std::string precision = argv[++i];
+            if (precision != "half" && precision != "float") {
+                std::cerr << OUTPUT_HINT << "Unknown EXR precision " << precision << ", use half or float\n";
+                return 1;
+            }
+            encode.halfFloat = precision == "half";
+        } else if (arg == "--band-height" && i + 1 < argc) {
+            bandHeight = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--publish" && i + 1 < argc) {
+            publish.url = argv[++i];
+        } else if (arg == "--publish-topic" && i + 1 < argc) {
+            publish.topic = argv[++i];
+        } else if (arg == "--preview" && i + 1 < argc) {
+            preview.sink = argv[++i];
+        } else if (arg == "--preview-control" && i + 1 < argc) {
+            preview.control = argv[++i];
+        } else if (arg == "--preview-interval" && i + 1 < argc) {
+            preview.interval = std::max(0.0, std::atof(argv[++i]) / 1000.0);
+        } else if (arg == "--max-depth" && i + 1 < argc) {
+            settings.maxDepth = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--keyframes" && i + 1 < argc) {
+            keyframesPath = argv[++i];
+        } else if (arg == "--frames" && i + 1 < argc) {
+            frames = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--profile" && i + 1 < argc) {
+            profilePrefix = argv[++i];
+            if (!INSTRUMENTATION_ENABLED) {
+                std::cerr << PROFILE_HINT << "Built without instrumentation, configure with -DPRISMATICA_INSTRUMENTATION=ON\n";
+                return 1;
+            }
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--scene <file>] [--scene-cache <file>] [--isa scalar|sse4.1|avx2|avx512]"
+                      << " [--threads <n>] [--tile-size <px>] [--pin none|cores|numa]"
+                      << " [--sampler random|stratified|sobol|bluenoise] [--seed <n>] [--integrator megakernel|wavefront]"
+                      << " [--max-depth <bounces>] [--spp <n>] [--target-error <e>] [--time-budget <s>]"
+                      << " [--width <px>] [--height <px>] [--camera <eye xyz> <target xyz>] [--fov <degrees>]"
+                      << " [--output <file.png|file.ppm|file.pfm|file.exr>] [--band-height <rows>]"
+                      << " [--denoise] [--aov <file.png|file.ppm|file.pfm|file.exr>]"
+                      << " [--png-level <0-9>] [--exr-precision half|float]"
+                      << " [--exposure <stops>] [--tonemap aces|reinhard] [--no-dither]"
+                      << " [--publish <file:path|tcp://host:port>] [--publish-topic <topic>]"
+                      << " [--preview <file:path|stdout|http://127.0.0.1:port>] [--preview-control <file|->] [--preview-interval <ms>]"
+                      << " [--keyframes <file>] [--frames <n>] [--profile <prefix>]\n";
+            return 1;
+        }
+    }
 
-    #ifdef MQTT_BENCHMARK_MODE
-        mqtt::async_client client(BROKER_URL, CLIENT_ID);
-        callback cb;
-        client.set_callback(cb);
+    // The preview stream owns stdout, the log goes to stderr
+    if (preview.sink == "stdout") std::cout.rdbuf(std::cerr.rdbuf());
 
-        mqtt::connect_options connOpts;
-        connOpts.set_clean_session(true);
-        connOpts.set_user_name(TOKEN);
-        connOpts.set_password("");
-    #endif
+    // An error target or a deadline decides when to stop, don't cap them at the default sample count
+    if (!samplesGiven && (settings.targetError > 0.0f || settings.timeBudget > 0.0)) settings.samplesPerPixel = ADAPTIVE_MAX_SAMPLES;
+    if (!samplesGiven && !preview.sink.empty()) settings.samplesPerPixel = PREVIEW_SAMPLES;
+    settings.sampler.samplesPerPixel = settings.samplesPerPixel;
+    settings.features = denoise || !aovPath.empty();
 
-    static std::array<unsigned char, 3 * VIEWPORT_WIDTH * VIEWPORT_HEIGHT> pngBuffer{};
-    static std::array<glm::vec3, VIEWPORT_WIDTH * VIEWPORT_HEIGHT> frameBuffer{};
-    glm::mat4 cameraViewMatrix = glm::mat4(1.0f);
+    if (!sceneCachePath.empty() && scenePath.empty()) {
+        std::cerr << SCENE_HINT << "--scene-cache needs the --scene it caches\n";
+        return 1;
+    }
 
-    auto start = std::chrono::high_resolution_clock::now();
+    if (!preview.sink.empty() && (!keyframesPath.empty() || frames > 0 || denoise || !aovPath.empty())) {
+        std::cerr << PREVIEW_HINT << "--preview renders a single view, it can't be combined with --keyframes, --frames, --denoise or --aov\n";
+        return 1;
+    }
 
-    const std::size_t numTiles = THREADS;
-    const std::size_t tileSize = VIEWPORT_HEIGHT / numTiles;
+    if (!preview.control.empty() && preview.sink.empty()) {
+        std::cerr << PREVIEW_HINT << "--preview-control needs a --preview sink\n";
+        return 1;
+    }
 
-    std::cout << RENDERER_HINT << "Tiles: " << numTiles << " Tile Height: " << tileSize << '\n';
+    // The filter reaches across band boundaries
+    if (denoise && bandHeight > 0 && bandHeight < (std::size_t) settings.camera.height) {
+        std::cerr << RENDERER_HINT << "--denoise needs the whole image, it can't be combined with --band-height\n";
+        return 1;
+    }
 
-    std::vector<std::thread> threads;
+    // Output paths of an animation are numbered, see FramePath()
+    CameraPath cameraPath{};
 
-    for (std::size_t tile = 0; tile < numTiles; tile++) {
-        threads.emplace_back(
-            DispatchTile, 
-            std::ref(frameBuffer), 
-            tile,
-            std::cref(cameraViewMatrix)
-        );
+    if (!keyframesPath.empty()) {
+        if (!LoadCameraPath(cameraPath, keyframesPath, settings.camera)) return 1;
+        if (frames > 0) cameraPath.frames = (std::size_t) frames;
     }
 
-    for (auto& thread : threads) {
-        thread.join();
+    Scene scene{};
+    auto sceneStart = std::chrono::high_resolution_clock::now();
+
+    if (scenePath.empty()) {
+        scene = CornellBoxScene();
+        BuildAccelerationStructure(scene);
+    } else if (!sceneCachePath.empty()) {
+        if (!LoadSceneCached(scene, scenePath, sceneCachePath)) return 1;
+    } else {
+        if (!LoadScene(scene, scenePath)) return 1;
+        BuildAccelerationStructure(scene);
     }
 
-    for (std::size_t i = 0; i < frameBuffer.size(); i++) {
-        // Assuming the data is 8 bit normalized
-        int r = frameBuffer.at(i).x * 255;
-        int g = frameBuffer.at(i).y * 255;
-        int b = frameBuffer.at(i).z * 255;
+    std::cout << SCENE_HINT << "Scene ready in " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sceneStart).count() << "ms\n";
 
-        r = r < 0 ? 0 : r;
-        g = g < 0 ? 0 : g;
-        b = b < 0 ? 0 : b;
+    simdKernels = SelectSimdKernels(isa);
+    std::cout << SIMD_HINT << "Using " << SimdISAName(simdKernels.isa) << " kernels, packet size " << simdKernels.packetSize << '\n';
 
-        pngBuffer.at(i * 3) = r;
-        pngBuffer.at(i * 3 + 1) = g;
-        pngBuffer.at(i * 3 + 2) = b;
+    const Camera& camera = settings.camera;
+    ThreadPool pool(threadCount, pinMode);
+
+    // Counters of the scene setup are not part of the profile
+    profiler.Reset();
+
+    // The preview publishes its steps instead of writing --output
+    if (!preview.sink.empty()) {
+        PreviewSink sink;
+        PreviewControl control;
+
+        if (!sink.Open(preview, EncodeJpeg)) return 1;
+        if (!preview.control.empty() && !control.Start(preview.control, settings.camera)) return 1;
+
+        std::cout << PREVIEW_HINT << "Resolution: " << camera.width << "x" << camera.height << " Threads: " << pool.size() << " SPP: " << settings.samplesPerPixel
+                  << " Sink: " << preview.sink << (preview.control.empty() ? "" : " Control: " + preview.control) << '\n';
+        return RunPreview(scene, pool, settings, tileSize, display, preview, sink, preview.control.empty() ? nullptr : &control) ? 0 : 1;
     }
 
-    stbi_write_png("test.png", VIEWPORT_WIDTH, VIEWPORT_HEIGHT, 3, pngBuffer.data(), 0);
-    std::cout << RENDERER_HINT << "Wrote " << pngBuffer.size() << " elements (hopefully)\n";
+    // Without --band-height the whole image is a single band
+    FrameOutput frameOutput{};
+    frameOutput.path = outputPath;
+    frameOutput.format = outputFormat;
+    frameOutput.encode = encode;
+    frameOutput.display = display;
+    frameOutput.streaming = bandHeight > 0 || outputFormat != ImageFormat::PNG;
+    frameOutput.denoise = denoise;
+    frameOutput.aovPath = aovPath;
+    frameOutput.aovFormat = aovFormat;
+    if (bandHeight == 0) bandHeight = camera.height;
+    stbi_write_png_compression_level = encode.compressionLevel;
+
+    // --frames alone renders the same view repeatedly, which measures throughput
+    const bool animated = !keyframesPath.empty() || frames > 0;
+    const std::size_t frameCount = !cameraPath.keys.empty() ? cameraPath.FrameCount() : std::max<std::size_t>(frames, 1);
+
+    std::cout << RENDERER_HINT << "Resolution: " << camera.width << "x" << camera.height << " Threads: " << pool.size() << " Tile Size: " << tileSize;
+    if (bandHeight < camera.height) std::cout << " Band Height: " << bandHeight;
+    std::cout << '\n';
+    std::cout << RENDERER_HINT << "Sampler: " << SamplerTypeName(settings.sampler.type) << " Seed: " << settings.sampler.seed << " Max Depth: " << settings.maxDepth
+              << " Integrator: " << IntegratorName(settings.integrator) << (denoise ? " Denoised" : "") << '\n';
+    if (animated) std::cout << ANIMATION_HINT << "Frames: " << frameCount << " Keyframes: " << cameraPath.keys.size() << '\n';
+
+    // The scene, the pool and the output thread are shared by all frames. Every frame
+    // queues its encoding and moves on, so frame n is written while n + 1 traces.
+    OutputThread output;
+    RenderStats stats{};
+    double renderMs = 0.0;
 
-    auto stop = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds> (stop - start);
+    auto start = std::chrono::high_resolution_clock::now();
 
-    std::cout << RENDERER_HINT << "Execution took " << duration.count() << "ms\n";
+    for (std::size_t frame = 0; frame < frameCount; frame++) {
+        RenderSettings frameSettings = settings;
+        if (!cameraPath.keys.empty()) cameraPath.Apply(frameSettings.camera, cameraPath.FrameTime(frame));
+        if (animated) frameOutput.path = FramePath(outputPath, frame);
+        if (animated && !aovPath.empty()) frameOutput.aovPath = FramePath(aovPath, frame);
 
-    #ifdef MQTT_BENCHMARK_MODE
-        std::ostringstream oss;
-        oss << duration.count();
+        RenderStats frameStats{};
+        double frameMs = 0.0;
 
-        std::string pubTopic = "/v1.6/devices/" + DEVICE_LABEL;
-        std::string payload = "{\"" + VARIABLE_LABEL + "\": " + oss.str() + "}";
+        // The file that failed has been reported by then
+        if (!RenderFrame(scene, pool, frameSettings, tileSize, bandHeight, frameOutput, output, frameStats, frameMs)) return 1;
 
-        try {
-            std::cout << MQTT_HINT << "Connecting to the broker" << std::endl;
-            client.connect(connOpts)->wait();
+        if (animated) {
+            std::cout << ANIMATION_HINT << "Frame " << frame + 1 << "/" << frameCount << ": " << (long long) frameMs << "ms, "
+                      << frameStats.rays / (frameMs * 1000.0) << " Mrays/s, " << (double) frameStats.samples / (camera.width * camera.height) << " spp\n";
+        } else {
+            std::cout << RENDERER_HINT << "Passes: " << frameStats.passes << " Average SPP: " << (double) frameStats.samples / (camera.width * camera.height)
+                      << " Converged Tiles: " << frameStats.convergedTiles << "/" << frameStats.tiles << (frameStats.outOfTime ? " (time budget reached)" : "") << '\n';
+        }
+
+        stats.Merge(frameStats);
+        renderMs += frameMs;
+    }
+
+    if (!output.Wait()) return 1;
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds> (stop - start);
 
-            mqtt::message_ptr pubmsg = mqtt::make_message(pubTopic, payload);
-            pubmsg->set_qos(QOS);
+    if (animated) {
+        double seconds = std::max(std::chrono::duration<double>(stop - start).count(), 1e-3);
+        std::cout << ANIMATION_HINT << "Rendered " << frameCount << " frames, " << frameCount / seconds << " frames/s, "
+                  << stats.rays / (renderMs * 1000.0) << " Mrays/s\n";
+    }
+
+    std::cout << RENDERER_HINT << "Execution took " << duration.count() << "ms (rendering " << (long long) renderMs << "ms)\n";
 
-            client.publish(pubmsg)->wait_for(std::chrono::seconds(10));
-            std::this_thread::sleep_for(std::chrono::seconds(5));
+    // Writes <prefix>.trace.json and <prefix>.heatmap.png
+    if (!profilePrefix.empty()) {
+        PrintProfileSummary();
 
-            client.disconnect()->wait();
-            std::cout << MQTT_HINT << "Disconnected" << std::endl;
-        } catch (const mqtt::exception& exc) {
-            std::cerr << "Error: " << exc.what() << std::endl;
+        std::size_t mapWidth, mapHeight;
+        std::vector<unsigned char> heatmap = TileCostHeatmap(camera.width, camera.height, mapWidth, mapHeight);
+        std::string tracePath = profilePrefix + ".trace.json";
+        std::string heatmapPath = profilePrefix + ".heatmap.png";
+
+        if (!WriteChromeTrace(tracePath)) return 1;
+        if (!stbi_write_png(heatmapPath.c_str(), (int) mapWidth, (int) mapHeight, 3, heatmap.data(), 0)) {
+            std::cerr << PROFILE_HINT << "Could not write " << heatmapPath << '\n';
             return 1;
         }
-    #endif
+
+        std::cout << PROFILE_HINT << "Wrote " << tracePath << " and " << heatmapPath << '\n';
+    }
+
+    // Only the rendering is published, the time it takes to write the image depends on the disk
+    if (publish.Enabled()) {
+        std::ostringstream payload;
+        payload << "{\"rendertime\": " << (long long) renderMs << ", \"mrays\": " << stats.rays / (renderMs * 1000.0) << "}";
+        if (!Publish(publish, payload.str())) return 1;
+    }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,61 @@
+// Converts a text scene into the binary cache that Prismatica maps with --scene-cache.
+// The renderer rebuilds stale caches by itself, the tool prepares them ahead of time
+// or checks whether they are still current.
+//
+// prismatica_scenecache <file.scene> <cache file> [--check]
+
+#include "../include/prismatica.h"
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> paths;
+    bool check = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--check") {
+            check = true;
+        } else if (!arg.empty() && arg[0] != '-') {
+            paths.push_back(arg);
+        } else {
+            paths.clear();
+            break;
+        }
+    }
+
+    if (paths.size() != 2) {
+        std::cerr << "Usage: " << argv[0] << " <file.scene> <cache file> [--check]\n";
+        return 1;
+    }
+
+    const std::string& scenePath = paths[0];
+    const std::string& cachePath = paths[1];
+
+    // Exit code 2 tells scripts that the cache needs a rebuild
+    if (check) {
+        Scene scene{};
+        std::string stale;
+
+        if (!MapSceneCache(scene, cachePath, scenePath, stale)) {
+            std::cout << SCENE_HINT << cachePath << " is stale: " << stale << '\n';
+            return 2;
+        }
+
+        std::cout << SCENE_HINT << cachePath << " is up to date with " << scene.sources.size() << " source files\n";
+        return 0;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    Scene scene{};
+    if (!LoadScene(scene, scenePath)) return 1;
+    BuildAccelerationStructure(scene);
+    if (!WriteSceneCache(scene, cachePath)) return 1;
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::ifstream cache(cachePath, std::ios::binary | std::ios::ate);
+
+    std::cout << SCENE_HINT << "Wrote " << cachePath << " (" << (long long) cache.tellg() / 1024 << " KiB, " << scene.PrimitiveCount() << " primitives, "
+              << scene.bvh.nodes.size() << " BVH nodes) in " << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << "ms\n";
+    return 0;
+}